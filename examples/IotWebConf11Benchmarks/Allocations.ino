@@ -0,0 +1,106 @@
+/**
+ * Allocations: the library handlers should serve requests from the arena and
+ * stack buffers, without using the heap. Every request kind is served a few
+ * times, while the bench server records the heap held by the request at each
+ * call of the handler into the server (see BenchServer::heldHeap).
+ * Allocations freed between these calls cannot be seen this way. When the
+ * sketch is built with a counting allocator, define BENCH_ALLOCATION_COUNTER
+ * as the name of its counter (an unsigned long with C linkage), and the
+ * allocations are counted as well.
+ */
+
+#define BENCH_ALLOCATION_REQUESTS 10
+
+#ifdef BENCH_ALLOCATION_COUNTER
+extern "C" unsigned long BENCH_ALLOCATION_COUNTER;
+#endif
+
+void benchConfigPage()
+{
+  benchServer.requestMethod = HTTP_GET;
+  benchServer.requestUri = "/";
+  benchServer.argCount = 0;
+  benchConf.handleConfig();
+}
+
+void benchRefusedForm()
+{
+  benchServer.requestMethod = HTTP_POST;
+  benchServer.requestUri = "/";
+  benchServer.argCount = BENCH_FORM_ARGS;
+  benchServer.argNames = benchFormNames;
+  benchServer.argValues = benchFormValues;
+  benchConf.handleConfig();
+}
+
+void benchNotFoundPage()
+{
+  benchServer.requestMethod = HTTP_GET;
+  benchServer.requestUri = "/favicon.ico";
+  benchServer.argCount = 0;
+  benchConf.handleNotFound();
+}
+
+void benchProbe()
+{
+  benchServer.requestMethod = HTTP_GET;
+  benchServer.requestUri = "/generate_204";
+  benchServer.argCount = 0;
+  benchConf.handleNotFound();
+}
+
+void benchLogPage()
+{
+  benchServer.requestMethod = HTTP_GET;
+  benchServer.requestUri = "/log";
+  benchServer.argCount = 0;
+  benchConf.handleLog();
+}
+
+/**
+ * Serves the request a few times after a first one, that might initialize
+ * static data, and checks that no heap was used.
+ */
+void checkAllocations(const char* name, void (*request)())
+{
+  benchServer.reset();
+  request();
+
+  size_t heldHeap = 0;
+  unsigned long allocations = 0;
+  for (unsigned int i = 0; i < BENCH_ALLOCATION_REQUESTS; i++)
+  {
+    benchServer.reset();
+#ifdef BENCH_ALLOCATION_COUNTER
+    unsigned long allocationsBefore = BENCH_ALLOCATION_COUNTER;
+#endif
+    request();
+#ifdef BENCH_ALLOCATION_COUNTER
+    allocations += BENCH_ALLOCATION_COUNTER - allocationsBefore;
+#endif
+    if (heldHeap < benchServer.heldHeap)
+    {
+      heldHeap = benchServer.heldHeap;
+    }
+  }
+
+  char line[96];
+  snprintf(line, sizeof(line),
+      "allocations: %s, %u bytes held, %lu allocations / %u requests", name,
+      (unsigned int)heldHeap, allocations, BENCH_ALLOCATION_REQUESTS);
+  Serial.println(line);
+  snprintf(line, sizeof(line), "allocations: %s without heap", name);
+  check(line, (heldHeap == 0) && (allocations == 0));
+}
+
+void benchmarkAllocations()
+{
+  checkAllocations("config page", benchConfigPage);
+  checkAllocations("refused form", benchRefusedForm);
+  checkAllocations("not found", benchNotFoundPage);
+  checkAllocations("captive portal probe", benchProbe);
+  checkAllocations("log", benchLogPage);
+  check("allocations: arena did not overflow",
+      benchConf.getArena()->getOverflowCount() == 0);
+  benchServer.argCount = 0;
+}
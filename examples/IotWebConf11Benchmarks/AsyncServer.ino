@@ -0,0 +1,342 @@
+/**
+ * Asynchronous server: time to load a page with its assets, and the number
+ * of connections needed for it, with and without keep-alive. The client
+ * connects to the server of the board itself over the loopback address.
+ * Then the config portal page is loaded by concurrent clients, each
+ * keeping its connection for all of its loads.
+ */
+
+#define BENCH_ASYNC_PORT 8080
+#define BENCH_PAGE_LOADS 10
+#define BENCH_ASSET_SIZE 1500
+#define BENCH_FETCH_TIMEOUT_MS 1000
+
+const char* const benchPageAssets[] = {"/", "/style.css", "/script.js",
+    "/logo.svg"};
+#define BENCH_ASSET_COUNT (sizeof(benchPageAssets) / sizeof(benchPageAssets[0]))
+
+IotWebConfAsyncServer benchAsyncServer(BENCH_ASYNC_PORT);
+char benchAsset[BENCH_ASSET_SIZE + 1];
+
+void handleBenchAsset()
+{
+  benchAsyncServer.send(200, "text/plain", benchAsset);
+}
+
+/**
+ * Sends one request on the connection and reads the response, while
+ * serving the server. Returns false on a failed or incomplete response.
+ */
+boolean fetchBenchAsset(WiFiClient& client, const char* path, boolean keepAlive)
+{
+  char request[96];
+  snprintf(request, sizeof(request),
+      "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: %s\r\n\r\n", path,
+      keepAlive ? "keep-alive" : "close");
+  client.write((const uint8_t*)request, strlen(request));
+
+  char head[256];
+  size_t headLength = 0;
+  char* body = NULL;
+  size_t bodyLength = 0;
+  long contentLength = -1;
+  unsigned long start = millis();
+  while (millis() - start < BENCH_FETCH_TIMEOUT_MS)
+  {
+    benchAsyncServer.handleClient();
+    while (client.available() > 0)
+    {
+      int c = client.read();
+      if (body != NULL)
+      {
+        bodyLength += 1;
+      }
+      else if (headLength < sizeof(head) - 1)
+      {
+        head[headLength++] = c;
+        head[headLength] = '\0';
+        body = strstr(head, "\r\n\r\n");
+        if (body != NULL)
+        {
+          char* field = strstr(head, "Content-Length: ");
+          contentLength = field == NULL ? -1 : atol(field + 16);
+        }
+      }
+    }
+    if ((body != NULL) && (contentLength == (long)bodyLength))
+    {
+      return strncmp(head, "HTTP/1.1 200", 12) == 0;
+    }
+    yield();
+  }
+  return false;
+}
+
+/**
+ * Loads the page with its assets BENCH_PAGE_LOADS times. Returns the
+ * elapsed microseconds, fetched counts the completed responses.
+ */
+unsigned long loadBenchPages(boolean keepAlive, unsigned int* fetched)
+{
+  *fetched = 0;
+  unsigned long startUs = micros();
+  for (unsigned int load = 0; load < BENCH_PAGE_LOADS; load++)
+  {
+    WiFiClient client;
+    for (byte i = 0; i < BENCH_ASSET_COUNT; i++)
+    {
+      if (!client.connected() &&
+          !client.connect(IPAddress(127, 0, 0, 1), BENCH_ASYNC_PORT))
+      {
+        break;
+      }
+      if (fetchBenchAsset(client, benchPageAssets[i], keepAlive))
+      {
+        *fetched += 1;
+      }
+      if (!keepAlive)
+      {
+        client.stop();
+      }
+    }
+    client.stop();
+    // -- Let the server notice the closed connection.
+    benchAsyncServer.handleClient();
+  }
+  return micros() - startUs;
+}
+
+// -- The config page of a second instance, served by the asynchronous
+// server.
+#define BENCH_PORTAL_CLIENTS IOTWEBCONF_ASYNC_MAX_CONNECTIONS
+#define BENCH_PORTAL_LOADS 5
+#define BENCH_PORTAL_TIMEOUT_MS 5000
+
+ESPWIFI benchPortal("benchPortal", NULL, NULL, "benchPassword");
+
+void handleBenchPortal()
+{
+  benchPortal.handleConfig();
+}
+
+/**
+ * A client loading the portal page over a single connection. The chunked
+ * response is decoded as it arrives.
+ */
+class BenchPortalClient
+{
+public:
+  WiFiClient client;
+  unsigned int loaded = 0;
+  unsigned long pageLength = 0;
+  boolean failed = false;
+
+  void request()
+  {
+    static const char request[] =
+        "GET /portal HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    this->client.write((const uint8_t*)request, sizeof(request) - 1);
+    this->step = BENCH_PORTAL_HEAD;
+    this->headLength = 0;
+    this->bodyLength = 0;
+  }
+
+  /**
+   * Reads what is available, returns true when the page is complete.
+   */
+  boolean receive()
+  {
+    while (!this->failed && (this->client.available() > 0))
+    {
+      if (this->feed(this->client.read()))
+      {
+        this->loaded += 1;
+        this->pageLength = this->bodyLength;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  enum
+  {
+    BENCH_PORTAL_HEAD,
+    BENCH_PORTAL_SIZE,
+    BENCH_PORTAL_DATA,
+    BENCH_PORTAL_DATA_END,
+    BENCH_PORTAL_LAST
+  } step;
+  char head[256];
+  size_t headLength;
+  unsigned long chunkLength;
+  unsigned long bodyLength;
+
+  boolean feed(char c)
+  {
+    switch (this->step)
+    {
+      case BENCH_PORTAL_HEAD:
+        if (this->headLength >= sizeof(this->head) - 1)
+        {
+          this->failed = true;
+          return false;
+        }
+        this->head[this->headLength++] = c;
+        this->head[this->headLength] = '\0';
+        if (strstr(this->head, "\r\n\r\n") != NULL)
+        {
+          this->failed = (strncmp(this->head, "HTTP/1.1 200", 12) != 0) ||
+              (strstr(this->head, "Transfer-Encoding: chunked") == NULL);
+          this->chunkLength = 0;
+          this->step = BENCH_PORTAL_SIZE;
+        }
+        return false;
+      case BENCH_PORTAL_SIZE:
+        if (c == '\n')
+        {
+          this->step = this->chunkLength == 0 ? BENCH_PORTAL_LAST
+                                              : BENCH_PORTAL_DATA;
+        }
+        else if (isxdigit(c))
+        {
+          this->chunkLength = this->chunkLength * 16 +
+              (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+        }
+        return false;
+      case BENCH_PORTAL_DATA:
+        this->bodyLength += 1;
+        if (--this->chunkLength == 0)
+        {
+          this->step = BENCH_PORTAL_DATA_END;
+        }
+        return false;
+      case BENCH_PORTAL_DATA_END:
+        if (c == '\n')
+        {
+          this->step = BENCH_PORTAL_SIZE;
+        }
+        return false;
+      case BENCH_PORTAL_LAST:
+        return c == '\n';
+    }
+    return false;
+  }
+};
+
+BenchPortalClient benchPortalClients[BENCH_PORTAL_CLIENTS];
+
+/**
+ * Every client loads the page BENCH_PORTAL_LOADS times, all of them at the
+ * same time. Returns the elapsed microseconds.
+ */
+unsigned long loadBenchPortal()
+{
+  unsigned long startUs = micros();
+  for (byte i = 0; i < BENCH_PORTAL_CLIENTS; i++)
+  {
+    BenchPortalClient* portalClient = &benchPortalClients[i];
+    portalClient->failed =
+        !portalClient->client.connect(IPAddress(127, 0, 0, 1), BENCH_ASYNC_PORT);
+    if (!portalClient->failed)
+    {
+      portalClient->request();
+    }
+  }
+
+  unsigned long start = millis();
+  byte pending = BENCH_PORTAL_CLIENTS;
+  while ((pending > 0) && (millis() - start < BENCH_PORTAL_TIMEOUT_MS))
+  {
+    benchAsyncServer.handleClient();
+    pending = 0;
+    for (byte i = 0; i < BENCH_PORTAL_CLIENTS; i++)
+    {
+      BenchPortalClient* portalClient = &benchPortalClients[i];
+      if (portalClient->failed || (portalClient->loaded >= BENCH_PORTAL_LOADS))
+      {
+        continue;
+      }
+      if (portalClient->receive() &&
+          (portalClient->loaded < BENCH_PORTAL_LOADS))
+      {
+        portalClient->request();
+      }
+      pending += portalClient->loaded < BENCH_PORTAL_LOADS ? 1 : 0;
+    }
+    yield();
+  }
+  unsigned long elapsedUs = micros() - startUs;
+
+  for (byte i = 0; i < BENCH_PORTAL_CLIENTS; i++)
+  {
+    benchPortalClients[i].client.stop();
+  }
+  benchAsyncServer.handleClient();
+  return elapsedUs;
+}
+
+void benchmarkAsyncServer()
+{
+  memset(benchAsset, 'a', BENCH_ASSET_SIZE);
+  benchAsset[BENCH_ASSET_SIZE] = '\0';
+  for (byte i = 0; i < BENCH_ASSET_COUNT; i++)
+  {
+    benchAsyncServer.on(benchPageAssets[i], handleBenchAsset);
+  }
+  benchAsyncServer.begin();
+
+  unsigned int fetched;
+  unsigned long connections = benchAsyncServer.getConnectionCount();
+  unsigned long requests = benchAsyncServer.getRequestCount();
+  unsigned long elapsedUs = loadBenchPages(true, &fetched);
+  report("async server, keep-alive", BENCH_PAGE_LOADS, "page loads", elapsedUs);
+  connections = benchAsyncServer.getConnectionCount() - connections;
+  requests = benchAsyncServer.getRequestCount() - requests;
+  report("async server, keep-alive", connections, "connections", elapsedUs);
+  check("async server: every asset loaded with keep-alive",
+      (fetched == BENCH_PAGE_LOADS * BENCH_ASSET_COUNT) &&
+      (requests == fetched));
+  check("async server: one connection per page load",
+      connections == BENCH_PAGE_LOADS);
+
+  connections = benchAsyncServer.getConnectionCount();
+  elapsedUs = loadBenchPages(false, &fetched);
+  report("async server, close", BENCH_PAGE_LOADS, "page loads", elapsedUs);
+  connections = benchAsyncServer.getConnectionCount() - connections;
+  report("async server, close", connections, "connections", elapsedUs);
+  check("async server: every asset loaded without keep-alive",
+      fetched == BENCH_PAGE_LOADS * BENCH_ASSET_COUNT);
+  check("async server: one connection per asset",
+      connections == BENCH_PAGE_LOADS * BENCH_ASSET_COUNT);
+  check("async server: responses queued in pooled blocks",
+      benchAsyncServer.getOverflowCount() == 0);
+
+  // -- The pages of the library are streamed in chunks, so the connections
+  // are kept alive.
+  benchPortal.setServerBackend(&benchAsyncServer);
+  benchAsyncServer.on("/portal", handleBenchPortal);
+  connections = benchAsyncServer.getConnectionCount();
+  unsigned long overflows = benchAsyncServer.getOverflowCount();
+  elapsedUs = loadBenchPortal();
+  connections = benchAsyncServer.getConnectionCount() - connections;
+  overflows = benchAsyncServer.getOverflowCount() - overflows;
+  unsigned int loaded = 0;
+  for (byte i = 0; i < BENCH_PORTAL_CLIENTS; i++)
+  {
+    loaded += benchPortalClients[i].failed ? 0 : benchPortalClients[i].loaded;
+  }
+  char name[48];
+  snprintf(name, sizeof(name), "async server, portal, %d clients",
+      BENCH_PORTAL_CLIENTS);
+  report(name, loaded, "page loads", elapsedUs);
+  Serial.print("async server, portal: ");
+  Serial.print(benchPortalClients[0].pageLength);
+  Serial.print(" bytes per page, ");
+  Serial.print(overflows);
+  Serial.println(" output blocks from the heap");
+  check("async server: every portal page loaded",
+      loaded == BENCH_PORTAL_CLIENTS * BENCH_PORTAL_LOADS);
+  check("async server: portal pages kept the connections alive",
+      connections == BENCH_PORTAL_CLIENTS);
+}
@@ -0,0 +1,173 @@
+
+#ifndef BenchServer_h
+#define BenchServer_h
+
+#include <ESPWIFI.h>
+
+/**
+ * Server backend feeding a prepared request to ESPWIFI handlers, and
+ * recording the response instead of sending it.
+ */
+class BenchServer : public IotWebConfServer
+{
+public:
+  // -- The request.
+  const char* requestUri = "/";
+  HTTPMethod requestMethod = HTTP_GET;
+  const char* requestHost = "192.168.4.1";
+  const char* requestCookie = NULL;
+  int argCount = 0;
+  const char* const* argNames = NULL;
+  const char* const* argValues = NULL;
+
+  // -- The response: status of send(), total bytes of the body or the
+  // pre-serialized response, and the start of it.
+  int status = 0;
+  size_t responseLength = 0;
+  char response[512];
+  char headers[256];
+
+  // -- Most heap held by the request, compared to reset(), sampled whenever
+  // the handler calls the server.
+  size_t heldHeap = 0;
+
+  /**
+   * Forget the previous response.
+   */
+  void reset()
+  {
+    this->status = 0;
+    this->responseLength = 0;
+    this->response[0] = '\0';
+    this->headers[0] = '\0';
+    this->heldHeap = 0;
+    this->_freeHeap = ESP.getFreeHeap();
+  }
+
+  void begin() {}
+  void handleClient() {}
+
+  String uri() { return this->requestUri; }
+  HTTPMethod method()
+  {
+    this->sampleHeap();
+    return this->requestMethod;
+  }
+  String hostHeader() { return this->requestHost; }
+  int readUri(char* target, size_t size)
+  {
+    return this->copy(this->requestUri, target, size);
+  }
+  int readHostHeader(char* target, size_t size)
+  {
+    return this->copy(this->requestHost, target, size);
+  }
+  int readHeader(const char* name, char* target, size_t size)
+  {
+    if ((strcasecmp(name, "Cookie") != 0) || (this->requestCookie == NULL))
+    {
+      return -1;
+    }
+    return this->copy(this->requestCookie, target, size);
+  }
+  String header(const char* name)
+  {
+    if ((strcasecmp(name, "Cookie") == 0) && (this->requestCookie != NULL))
+    {
+      return this->requestCookie;
+    }
+    return String();
+  }
+  int args()
+  {
+    this->sampleHeap();
+    return this->argCount;
+  }
+  String arg(int i) { return i < this->argCount ? this->argValues[i] : ""; }
+  String argName(int i) { return i < this->argCount ? this->argNames[i] : ""; }
+  String arg(const char* name)
+  {
+    int i = this->findArg(name);
+    return i < 0 ? "" : this->argValues[i];
+  }
+  boolean hasArg(const char* name)
+  {
+    this->sampleHeap();
+    return this->findArg(name) >= 0;
+  }
+  int readArg(const char* name, char* target, size_t size)
+  {
+    int i = this->findArg(name);
+    return i < 0 ? -1 : this->copy(this->argValues[i], target, size);
+  }
+  boolean authenticate(const char* username, const char* password)
+  {
+    return true;
+  }
+  void requestAuthentication() { this->status = 401; }
+  IPAddress localIP() { return IPAddress(192, 168, 4, 1); }
+
+  void sendHeader(const String& name, const String& value)
+  {
+    this->sampleHeap();
+    size_t used = strlen(this->headers);
+    snprintf(this->headers + used, sizeof(this->headers) - used, "%s: %s\r\n",
+        name.c_str(), value.c_str());
+  }
+  void send(int code, const char* contentType, const String& content)
+  {
+    this->status = code;
+    this->write((const uint8_t*)content.c_str(), content.length());
+  }
+  void write(const uint8_t* data, size_t length)
+  {
+    this->sampleHeap();
+    if (this->responseLength < sizeof(this->response) - 1)
+    {
+      size_t count = sizeof(this->response) - 1 - this->responseLength;
+      count = length < count ? length : count;
+      memcpy(this->response + this->responseLength, data, count);
+      this->response[this->responseLength + count] = '\0';
+    }
+    this->responseLength += length;
+  }
+  void close() { this->sampleHeap(); }
+
+private:
+  uint32_t _freeHeap = 0;
+
+  void sampleHeap()
+  {
+    uint32_t freeHeap = ESP.getFreeHeap();
+    if ((freeHeap < this->_freeHeap) &&
+        (this->heldHeap < this->_freeHeap - freeHeap))
+    {
+      this->heldHeap = this->_freeHeap - freeHeap;
+    }
+  }
+
+  int copy(const char* value, char* target, size_t size)
+  {
+    this->sampleHeap();
+    if (size > 0)
+    {
+      strncpy(target, value, size - 1);
+      target[size - 1] = '\0';
+    }
+    return strlen(value);
+  }
+
+  int findArg(const char* name)
+  {
+    for (int i = 0; i < this->argCount; i++)
+    {
+      if (strcmp(this->argNames[i], name) == 0)
+      {
+        return i;
+      }
+    }
+    return -1;
+  }
+};
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * Config page: render time with the compiled log level, and the share of
+ * logging in it. Log records are only stored while rendering, formatting is
+ * deferred. Build with -DIOTWEBCONF_LOG_LEVEL=IOTWEBCONF_LOG_LEVEL_NONE (or
+ * _DEBUG) to compare the render time without (or with all) logging.
+ */
+
+#define BENCH_CONFIG_RENDERS 200
+
+void benchmarkConfigPage()
+{
+  benchServer.requestUri = "/";
+  benchServer.reset();
+  benchConf.handleConfig();
+
+  unsigned long firstRecord = IotWebConfLog::getNextSequence();
+  unsigned long startUs = micros();
+  for (unsigned int i = 0; i < BENCH_CONFIG_RENDERS; i++)
+  {
+    benchServer.reset();
+    benchConf.handleConfig();
+  }
+  unsigned long renderUs = micros() - startUs;
+  unsigned long records = IotWebConfLog::getNextSequence() - firstRecord;
+
+  char name[40];
+  snprintf(name, sizeof(name), "config page, log level %d",
+      IOTWEBCONF_LOG_LEVEL);
+  report(name, BENCH_CONFIG_RENDERS, "renders", renderUs);
+  Serial.print("config page: ");
+  Serial.print((unsigned long)benchServer.responseLength);
+  Serial.print(" bytes, ");
+  Serial.print(records / BENCH_CONFIG_RENDERS);
+  Serial.println(" log records per render");
+
+  // -- The same amount of records added directly is the cost of logging in
+  // the render time.
+  startUs = micros();
+  for (unsigned long i = 0; i < records; i++)
+  {
+    IotWebConfLog::add(IOTWEBCONF_LOG_LEVEL_DEBUG, F("Rendering "), "benchParam");
+  }
+  unsigned long logUs = micros() - startUs;
+  report("log ring", records, "records added", logUs);
+
+  check("config page: page sent",
+      (strncmp(benchServer.response, "HTTP/1.1 200", 12) == 0) &&
+          (benchServer.responseLength > 1000));
+  check("config page: logging below a quarter of the render time",
+      logUs < renderUs / 4);
+}
@@ -0,0 +1,102 @@
+/**
+ * DNS responder: queries answered per second, and malformed packets, that
+ * must be dropped. The packet buffer stands in for the UDP socket.
+ */
+
+#define BENCH_DNS_QUERIES 10000
+
+/**
+ * Writes a query for the name with one question into the packet.
+ * Returns the length of the query.
+ */
+int buildDnsQuery(uint8_t* packet, const char* name, uint16_t qtype)
+{
+  const uint8_t header[] = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  memcpy(packet, header, sizeof(header));
+  int pos = sizeof(header);
+  while (*name != '\0')
+  {
+    const char* dot = strchr(name, '.');
+    int length = dot == NULL ? strlen(name) : dot - name;
+    packet[pos++] = length;
+    memcpy(packet + pos, name, length);
+    pos += length;
+    name += dot == NULL ? length : length + 1;
+  }
+  packet[pos++] = 0;
+  packet[pos++] = qtype >> 8;
+  packet[pos++] = qtype & 0xFF;
+  packet[pos++] = 0x00;
+  packet[pos++] = 0x01; // -- Class IN.
+  return pos;
+}
+
+void benchmarkDnsResponder()
+{
+  IotWebConfDnsResponder responder;
+  WiFi.mode(WIFI_STA);
+  responder.start(5353, IPAddress(192, 168, 4, 1));
+
+  uint8_t query[IOTWEBCONF_DNS_MAX_PACKET];
+  uint8_t packet[IOTWEBCONF_DNS_MAX_PACKET];
+  int querySize = buildDnsQuery(query, "connectivitycheck.gstatic.com", 1);
+
+  unsigned long answered = 0;
+  unsigned long startUs = micros();
+  for (unsigned int i = 0; i < BENCH_DNS_QUERIES; i++)
+  {
+    memcpy(packet, query, querySize);
+    if (responder.respond(packet, querySize) > 0)
+    {
+      answered += 1;
+    }
+  }
+  report("dns responder", answered, "queries answered", micros() - startUs);
+
+  memcpy(packet, query, querySize);
+  int length = responder.respond(packet, querySize);
+  check("dns responder: A query answered with the portal address",
+      (length == querySize + 16) && (packet[0] == 0x12) &&
+      (packet[1] == 0x34) && (packet[2] == 0x85) && (packet[7] == 1) &&
+      (packet[length - 4] == 192) && (packet[length - 1] == 1));
+
+  querySize = buildDnsQuery(packet, "example.com", 28);
+  length = responder.respond(packet, querySize);
+  check("dns responder: AAAA query answered without records",
+      (length == querySize) && (packet[7] == 0));
+
+  // -- Malformed packets.
+  querySize = buildDnsQuery(query, "example.com", 1);
+  memcpy(packet, query, querySize);
+  check("dns responder: short header dropped",
+      responder.respond(packet, 11) == 0);
+  check("dns responder: header without question dropped",
+      responder.respond(packet, 12) == 0);
+  check("dns responder: truncated class dropped",
+      responder.respond(packet, querySize - 1) == 0);
+  check("dns responder: oversized packet dropped",
+      responder.respond(packet, IOTWEBCONF_DNS_MAX_PACKET + 1) == 0);
+
+  memcpy(packet, query, querySize);
+  packet[2] |= 0x80;
+  check("dns responder: response dropped",
+      responder.respond(packet, querySize) == 0);
+
+  memcpy(packet, query, querySize);
+  packet[5] = 2;
+  check("dns responder: two questions dropped",
+      responder.respond(packet, querySize) == 0);
+
+  memcpy(packet, query, querySize);
+  packet[12] = 63;
+  check("dns responder: label past the end dropped",
+      responder.respond(packet, querySize) == 0);
+
+  memcpy(packet, query, querySize);
+  packet[12] = 0xC0;
+  check("dns responder: compressed question dropped",
+      responder.respond(packet, querySize) == 0);
+
+  responder.stop();
+}
@@ -0,0 +1,51 @@
+/**
+ * Footprint: size of the objects a sketch keeps for its whole run. Buffers
+ * used by one request (or DNS query) at a time are shared by the instances,
+ * and are reported separately.
+ */
+
+// -- Recorded sizeof(ESPWIFI) with the default flags, for boards (32 bit) and
+// host builds (64 bit). Record the new value here, when a change is meant to
+// grow the object. Builds with any of the opt-in features enabled can provide
+// their own baseline with BENCH_ESPWIFI_SIZE_BASELINE.
+#ifdef IOTWEBCONF_CONFIG_LEAN_CALLBACKS
+# define BENCH_ESPWIFI_SIZE_32 1128
+# define BENCH_ESPWIFI_SIZE_64 1960
+#else
+# define BENCH_ESPWIFI_SIZE_32 1224
+# define BENCH_ESPWIFI_SIZE_64 2152
+#endif
+
+#if !defined(BENCH_ESPWIFI_SIZE_BASELINE) && \
+    !defined(IOTWEBCONF_CONFIG_USE_PULL_UPDATE) && \
+    !defined(IOTWEBCONF_CONFIG_USE_STATIC_IP) && \
+    !defined(IOTWEBCONF_CONFIG_USE_METRICS) && \
+    !defined(IOTWEBCONF_CONFIG_USE_PROFILER) && \
+    !defined(IOTWEBCONF_CONFIG_USE_HEAP_TRACKER)
+# define BENCH_ESPWIFI_SIZE_BASELINE \
+    (sizeof(void*) == 4 ? BENCH_ESPWIFI_SIZE_32 : BENCH_ESPWIFI_SIZE_64)
+#endif
+
+void reportSize(const char* name, size_t size)
+{
+  Serial.print("footprint: ");
+  Serial.print(name);
+  Serial.print(" ");
+  Serial.print((unsigned long)size);
+  Serial.println(" bytes");
+}
+
+void benchmarkFootprint()
+{
+  reportSize("ESPWIFI", sizeof(ESPWIFI));
+  reportSize("IotWebConfDnsResponder", sizeof(IotWebConfDnsResponder));
+  reportSize("IotWebConfAsyncServer", sizeof(IotWebConfAsyncServer));
+  reportSize("shared arena", sizeof(IotWebConfArena));
+  reportSize("shared DNS packet buffer", IOTWEBCONF_DNS_MAX_PACKET);
+
+#ifdef BENCH_ESPWIFI_SIZE_BASELINE
+  reportSize("ESPWIFI baseline", BENCH_ESPWIFI_SIZE_BASELINE);
+  check("footprint: ESPWIFI not grown over the baseline",
+      sizeof(ESPWIFI) <= BENCH_ESPWIFI_SIZE_BASELINE);
+#endif
+}
@@ -0,0 +1,83 @@
+/**
+ * Heap soak: portal traffic replayed through the library handlers many times.
+ * No WiFi connection is made, so WiFi and lwIP do not allocate meanwhile, and
+ * any change of the free heap or of the largest free block is kept by the
+ * requests themselves. (On a connected device, the heap tracker also sees the
+ * allocations of the network stack.)
+ */
+
+#define BENCH_SOAK_ROUNDS 500
+
+/**
+ * One round of traffic: config page, refused form, not found, log.
+ */
+void replayPortalTraffic()
+{
+  benchServer.requestMethod = HTTP_GET;
+  benchServer.requestUri = "/";
+  benchServer.argCount = 0;
+  benchServer.reset();
+  benchConf.handleConfig();
+
+  benchServer.requestMethod = HTTP_POST;
+  benchServer.argCount = BENCH_FORM_ARGS;
+  benchServer.argNames = benchFormNames;
+  benchServer.argValues = benchFormValues;
+  benchServer.reset();
+  benchConf.handleConfig();
+
+  benchServer.requestMethod = HTTP_GET;
+  benchServer.requestUri = "/favicon.ico";
+  benchServer.argCount = 0;
+  benchServer.reset();
+  benchConf.handleNotFound();
+
+  benchServer.requestUri = "/log";
+  benchServer.reset();
+  benchConf.handleLog();
+}
+
+void benchmarkHeapSoak()
+{
+  // -- The first round might initialize static data.
+  replayPortalTraffic();
+
+  uint32_t freeHeapBefore;
+  uint32_t largestBlockBefore;
+  IotWebConfHeapTracker::sample(&freeHeapBefore, &largestBlockBefore);
+#ifdef IOTWEBCONF_CONFIG_USE_HEAP_TRACKER
+  benchConf.getHeapTracker()->reset();
+#endif
+
+  unsigned long startUs = micros();
+  for (unsigned int i = 0; i < BENCH_SOAK_ROUNDS; i++)
+  {
+    replayPortalTraffic();
+  }
+  report("heap soak", BENCH_SOAK_ROUNDS * 4, "requests", micros() - startUs);
+
+  uint32_t freeHeapAfter;
+  uint32_t largestBlockAfter;
+  IotWebConfHeapTracker::sample(&freeHeapAfter, &largestBlockAfter);
+  Serial.print("heap soak: free heap ");
+  Serial.print(freeHeapBefore);
+  Serial.print(" -> ");
+  Serial.print(freeHeapAfter);
+  Serial.print(", largest block ");
+  Serial.print(largestBlockBefore);
+  Serial.print(" -> ");
+  Serial.println(largestBlockAfter);
+
+  check("heap soak: nothing retained", freeHeapBefore <= freeHeapAfter);
+  check("heap soak: largest block kept", largestBlockBefore <= largestBlockAfter);
+#ifdef IOTWEBCONF_CONFIG_USE_HEAP_TRACKER
+  // -- Without a network stack running, the tracker sees the requests only.
+  boolean balanced = true;
+  for (byte kind = 0; kind < IOTWEBCONF_HEAP_KINDS; kind++)
+  {
+    const IotWebConfHeapUsage* usage = benchConf.getHeapTracker()->getUsage(kind);
+    balanced = balanced && (usage->retainingRequests == 0);
+  }
+  check("heap soak: tracker saw no retaining request", balanced);
+#endif
+}
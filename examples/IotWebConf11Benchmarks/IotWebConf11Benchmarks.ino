@@ -0,0 +1,89 @@
+/**
+ * Example: Benchmarks
+ * Description:
+ *   This sketch is not an application, but a collection of measurements and
+ *   self checks for the building blocks of ESPWIFI. Each tab of the sketch
+ *   covers one part of the library, and prints its results to the serial
+ *   console, like:
+ *     timer wheel: 48 timers, 120 us / 1000 ticks
+ *     [PASS] timer wheel: periodic timers fired
+ *   The last line reports the number of failed checks.
+ *
+ *   No WiFi connection is made, so the sketch can be run on a bare board.
+ *   (The server is measured with connections over the loopback address.)
+ */
+
+#include <ESPWIFI.h>
+#include "BenchServer.h"
+
+unsigned int failedChecks = 0;
+
+// -- Handlers are called directly with requests prepared in the BenchServer.
+BenchServer benchServer;
+ESPWIFI benchConf("benchThing", NULL, NULL, "benchPassword");
+
+// -- A config form, that is refused: thing name is too short, so the form is
+// rendered again with the errors, and nothing is saved.
+const char* const benchFormNames[] = {"iotSave", "iwcThingName",
+    "iwcApPassword", "iwcWifiSsid", "iwcWifiPassword", "iwcApTimeout"};
+const char* const benchFormValues[] = {"true", "ab", "", "benchNetwork", "",
+    "30"};
+#define BENCH_FORM_ARGS (sizeof(benchFormNames) / sizeof(benchFormNames[0]))
+
+void setup()
+{
+  Serial.begin(115200);
+  Serial.println();
+  Serial.println("Starting benchmarks...");
+  benchConf.setServerBackend(&benchServer);
+
+  benchmarkFootprint();
+  benchmarkTimerWheel();
+  benchmarkRoaming();
+  benchmarkDnsResponder();
+  benchmarkPathTable();
+  benchmarkNotFound();
+  benchmarkConfigPage();
+  benchmarkHeapSoak();
+  benchmarkAllocations();
+  benchmarkAsyncServer();
+  benchmarkUpdateDigest();
+  benchmarkUpdateFlash();
+  benchmarkUpdateGzip();
+
+  Serial.print("Failed checks: ");
+  Serial.println(failedChecks);
+}
+
+void loop()
+{
+}
+
+/**
+ * Print the result of a self check.
+ */
+void check(const char* name, boolean passed)
+{
+  if (!passed)
+  {
+    failedChecks += 1;
+  }
+  Serial.print(passed ? "[PASS] " : "[FAIL] ");
+  Serial.println(name);
+}
+
+/**
+ * Print a measurement as "name: count label, elapsed us".
+ */
+void report(const char* name, unsigned long count, const char* label,
+    unsigned long elapsedUs)
+{
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(count);
+  Serial.print(" ");
+  Serial.print(label);
+  Serial.print(", ");
+  Serial.print(elapsedUs);
+  Serial.println(" us");
+}
@@ -0,0 +1,64 @@
+/**
+ * Not found responses: unknown URLs with many long arguments must not make
+ * the response, or the heap used, grow.
+ */
+
+#define BENCH_NOT_FOUND_REQUESTS 1000
+#define BENCH_NOT_FOUND_ARGS 16
+
+char benchLongValue[201];
+const char* benchArgNames[BENCH_NOT_FOUND_ARGS];
+const char* benchArgValues[BENCH_NOT_FOUND_ARGS];
+
+void benchmarkNotFound()
+{
+  memset(benchLongValue, 'x', sizeof(benchLongValue) - 1);
+  benchLongValue[sizeof(benchLongValue) - 1] = '\0';
+  for (byte i = 0; i < BENCH_NOT_FOUND_ARGS; i++)
+  {
+    benchArgNames[i] = "scanner";
+    benchArgValues[i] = benchLongValue;
+  }
+  benchServer.requestUri = "/cgi-bin/unknown.php";
+  benchServer.argCount = BENCH_NOT_FOUND_ARGS;
+  benchServer.argNames = benchArgNames;
+  benchServer.argValues = benchArgValues;
+
+  // -- The first request might initialize static data.
+  benchServer.reset();
+  benchConf.handleNotFound();
+
+  size_t largestResponse = 0;
+  uint32_t freeHeapBefore = ESP.getFreeHeap();
+  unsigned long startUs = micros();
+  for (unsigned int i = 0; i < BENCH_NOT_FOUND_REQUESTS; i++)
+  {
+    benchServer.reset();
+    benchConf.handleNotFound();
+    if (largestResponse < benchServer.responseLength)
+    {
+      largestResponse = benchServer.responseLength;
+    }
+  }
+  report("not found", BENCH_NOT_FOUND_REQUESTS, "requests", micros() - startUs);
+  uint32_t freeHeapAfter = ESP.getFreeHeap();
+
+  Serial.print("not found: largest response ");
+  Serial.print((unsigned long)largestResponse);
+  Serial.print(" bytes, free heap ");
+  Serial.print(freeHeapBefore);
+  Serial.print(" -> ");
+  Serial.println(freeHeapAfter);
+
+  check("not found: 404 sent",
+      strncmp(benchServer.response, "HTTP/1.1 404", 12) == 0);
+#ifdef IOTWEBCONF_NOT_FOUND_DETAILS_MAX_LEN
+  check("not found: details capped",
+      largestResponse <= 256 + IOTWEBCONF_NOT_FOUND_DETAILS_MAX_LEN);
+#else
+  check("not found: static response", largestResponse <= 256);
+#endif
+  check("not found: heap stays flat", freeHeapBefore <= freeHeapAfter);
+
+  benchServer.argCount = 0;
+}
@@ -0,0 +1,70 @@
+/**
+ * Path table of the captive portal probes: lookup time, and lookups with
+ * colliding paths in a full table.
+ */
+
+#define BENCH_PATH_LOOKUPS 10000
+
+const char* const benchProbePaths[] = {"/generate_204", "/gen_204",
+    "/hotspot-detect.html", "/library/test/success.html", "/connecttest.txt",
+    "/ncsi.txt", "/success.txt"};
+#define BENCH_PROBE_COUNT (sizeof(benchProbePaths) / sizeof(benchProbePaths[0]))
+
+char benchCollidingPaths[IOTWEBCONF_PATH_TABLE_SLOTS][6];
+
+void benchmarkPathTable()
+{
+  IotWebConfPathTable probes;
+  for (byte i = 0; i < BENCH_PROBE_COUNT; i++)
+  {
+    probes.add(benchProbePaths[i]);
+  }
+
+  unsigned long found = 0;
+  unsigned long startUs = micros();
+  for (unsigned int i = 0; i < BENCH_PATH_LOOKUPS; i++)
+  {
+    const char* path = benchProbePaths[i % BENCH_PROBE_COUNT];
+    if (probes.find(path, strlen(path)) >= 0)
+    {
+      found += 1;
+    }
+  }
+  report("path table", found, "probe lookups", micros() - startUs);
+
+  boolean allFound = true;
+  for (byte i = 0; i < BENCH_PROBE_COUNT; i++)
+  {
+    const char* path = benchProbePaths[i];
+    allFound = allFound && (probes.find(path, strlen(path)) == i);
+  }
+  check("path table: every probe found", allFound);
+  check("path table: unknown path not found",
+      (probes.find("/", 1) < 0) && (probes.find("/generate_205", 13) < 0));
+
+  // -- Same length and second character: all paths collide, and the chain
+  // wraps around the end of the slots.
+  IotWebConfPathTable colliding;
+  byte added = 0;
+  for (byte i = 0; i < IOTWEBCONF_PATH_TABLE_SLOTS; i++)
+  {
+    snprintf(benchCollidingPaths[i], sizeof(benchCollidingPaths[i]), "/f%02u", i);
+    if (colliding.add(benchCollidingPaths[i]) == i)
+    {
+      added += 1;
+    }
+  }
+  check("path table: full table refuses the last path",
+      (added == IOTWEBCONF_PATH_TABLE_SLOTS - 1) &&
+      (colliding.getCount() == IOTWEBCONF_PATH_TABLE_SLOTS - 1));
+
+  allFound = true;
+  for (byte i = 0; i < added; i++)
+  {
+    allFound = allFound && (colliding.find(benchCollidingPaths[i], 4) == i);
+  }
+  check("path table: colliding paths found, none evicted", allFound);
+  check("path table: lookup in a full table ends",
+      (colliding.find(benchCollidingPaths[added], 4) < 0) &&
+      (colliding.find("/f99", 4) < 0));
+}
@@ -0,0 +1,95 @@
+/**
+ * Roaming: a recorded RSSI trace is fed through the roaming policy, one
+ * sample per IOTWEBCONF_ROAMING_SAMPLE_MS, to check the smoothing, the
+ * hysteresis and the rate limits. Nothing is scanned or connected.
+ */
+
+#define BENCH_ROAMING_THRESHOLD -75
+
+/**
+ * Feeds count samples of the same RSSI from *now on. Returns the number of
+ * samples until a scan was due (the scan is then started), or zero if no scan
+ * was due.
+ */
+unsigned int feedRssi(IotWebConfRoamingPolicy* policy, unsigned long* now,
+    int32_t rssi, unsigned int count)
+{
+  unsigned int due = 0;
+  for (unsigned int i = 1; i <= count; i++)
+  {
+    *now += IOTWEBCONF_ROAMING_SAMPLE_MS;
+    policy->addSample(rssi);
+    if ((due == 0) && policy->isScanDue(*now))
+    {
+      policy->scanStarted(*now);
+      due = i;
+    }
+  }
+  return due;
+}
+
+void benchmarkRoaming()
+{
+  IotWebConfRoamingPolicy policy;
+  policy.setRssiThreshold(BENCH_ROAMING_THRESHOLD);
+  unsigned long now = 1000;
+
+  // -- Good signal, with a single deep drop.
+  unsigned int due = feedRssi(&policy, &now, -60, 10);
+  due += feedRssi(&policy, &now, -95, 1);
+  due += feedRssi(&policy, &now, -60, 5);
+  check("roaming: no scan for a single weak sample", due == 0);
+  policy.addSample(0);
+  check("roaming: invalid samples ignored",
+      (policy.getSmoothedRssi() <= -60) && (policy.getSmoothedRssi() > -65));
+
+  // -- Signal drops for good: the average follows with a delay (1/8 weight
+  // of each sample), then a scan is started.
+  unsigned long start = now;
+  due = feedRssi(&policy, &now, -85, 30);
+  unsigned long scanMs = start + due * IOTWEBCONF_ROAMING_SAMPLE_MS;
+  Serial.print("roaming: scan started after ");
+  Serial.print(due);
+  Serial.println(" weak samples");
+  check("roaming: scan started, when the average got below the threshold",
+      (due >= 5) && (due <= 10));
+
+  // -- Signal stays weak: the next scan is started with the first sample
+  // after the scan interval.
+  start = now;
+  due = feedRssi(&policy, &now, -85,
+      IOTWEBCONF_ROAMING_SCAN_INTERVAL_MS / IOTWEBCONF_ROAMING_SAMPLE_MS);
+  unsigned long nextScanMs = start + due * IOTWEBCONF_ROAMING_SAMPLE_MS;
+  check("roaming: next scan after the scan interval",
+      (due > 0) &&
+      (nextScanMs - scanMs > IOTWEBCONF_ROAMING_SCAN_INTERVAL_MS) &&
+      (nextScanMs - scanMs <=
+          IOTWEBCONF_ROAMING_SCAN_INTERVAL_MS + IOTWEBCONF_ROAMING_SAMPLE_MS));
+
+  // -- The integer average stops short of the samples by less than a dB.
+  int smoothed = policy.getSmoothedRssi();
+  check("roaming: average settled on the weak signal",
+      (smoothed >= -85) && (smoothed <= -84));
+
+  // -- Only clearly better access points are chosen.
+  check("roaming: access point within the hysteresis is not better",
+      !policy.isBetter(smoothed + IOTWEBCONF_ROAMING_HYSTERESIS_DB - 1));
+  check("roaming: access point over the hysteresis is better",
+      policy.isBetter(smoothed + IOTWEBCONF_ROAMING_HYSTERESIS_DB));
+
+  // -- After roaming, no scan in the minimal roaming interval, even with a
+  // weak signal.
+  policy.roamed(now);
+  unsigned int roamInterval = IOTWEBCONF_ROAMING_MIN_INTERVAL_MS /
+      IOTWEBCONF_ROAMING_SAMPLE_MS;
+  due = feedRssi(&policy, &now, -85, roamInterval);
+  check("roaming: no scan in the roaming interval", due == 0);
+  due = feedRssi(&policy, &now, -85, 2);
+  check("roaming: scan after the roaming interval", due > 0);
+  check("roaming: attempts counted", policy.getRoamCount() == 1);
+
+  // -- Disabled roaming never scans.
+  IotWebConfRoamingPolicy disabled;
+  due = feedRssi(&disabled, &now, -90, 100);
+  check("roaming: no scan, when disabled", due == 0);
+}
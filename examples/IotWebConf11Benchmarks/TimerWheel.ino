@@ -0,0 +1,155 @@
+/**
+ * Timer wheel: cost of advancing the wheel with many registered timers,
+ * compared to polling every timer with millis() in each pass.
+ */
+
+#define BENCH_TIMER_COUNT 48
+#define BENCH_TIMER_RUN_MS 10000
+
+class CountingTimer : public IotWebConfTimer
+{
+public:
+  CountingTimer()
+      : IotWebConfTimer(iotWebConfMethod<CountingTimer, &CountingTimer::fire>(this))
+  {
+  }
+  void fire() { this->count += 1; }
+  unsigned long count = 0;
+};
+
+CountingTimer benchTimers[BENCH_TIMER_COUNT];
+
+/**
+ * One-shot timer starting itself again on expiry, like the blinking.
+ */
+class RestartingTimer : public IotWebConfTimer
+{
+public:
+  RestartingTimer(IotWebConfTimerWheel* wheel)
+      : IotWebConfTimer(
+            iotWebConfMethod<RestartingTimer, &RestartingTimer::fire>(this))
+  {
+    this->wheel = wheel;
+  }
+  void fire()
+  {
+    this->count += 1;
+    this->wheel->start(this, 100);
+  }
+  IotWebConfTimerWheel* wheel;
+  unsigned long count = 0;
+};
+
+/**
+ * Advances the wheel in 1 ms steps, returns the elapsed microseconds.
+ */
+unsigned long runTimerWheel(byte timerCount)
+{
+  IotWebConfTimerWheel wheel;
+  for (byte i = 0; i < timerCount; i++)
+  {
+    benchTimers[i].count = 0;
+    wheel.start(&benchTimers[i], (i + 1) * 10, (i + 1) * 10);
+  }
+  unsigned long start = millis();
+  unsigned long startUs = micros();
+  for (unsigned long t = 1; t <= BENCH_TIMER_RUN_MS; t++)
+  {
+    wheel.process(start + t);
+  }
+  unsigned long elapsedUs = micros() - startUs;
+  for (byte i = 0; i < timerCount; i++)
+  {
+    wheel.stop(&benchTimers[i]);
+  }
+  return elapsedUs;
+}
+
+/**
+ * The same timers, checked one by one in every pass.
+ */
+unsigned long runTimerPolling(byte timerCount)
+{
+  unsigned long lastFired[BENCH_TIMER_COUNT];
+  unsigned long start = millis();
+  for (byte i = 0; i < timerCount; i++)
+  {
+    benchTimers[i].count = 0;
+    lastFired[i] = start;
+  }
+  unsigned long startUs = micros();
+  for (unsigned long t = 1; t <= BENCH_TIMER_RUN_MS; t++)
+  {
+    unsigned long now = start + t;
+    for (byte i = 0; i < timerCount; i++)
+    {
+      if ((unsigned long)(i + 1) * 10 <= now - lastFired[i])
+      {
+        lastFired[i] = now;
+        benchTimers[i].fire();
+      }
+    }
+  }
+  return micros() - startUs;
+}
+
+void benchmarkTimerWheel()
+{
+  report("timer wheel", 8, "timers / 10000 passes", runTimerWheel(8));
+  report("timer wheel", BENCH_TIMER_COUNT, "timers / 10000 passes",
+      runTimerWheel(BENCH_TIMER_COUNT));
+
+  // -- Every timer should have fired once per period (one less is accepted,
+  // as the first expiry is rounded up to the next tick).
+  boolean fired = true;
+  for (byte i = 0; i < BENCH_TIMER_COUNT; i++)
+  {
+    unsigned long expected = BENCH_TIMER_RUN_MS / ((i + 1) * 10);
+    if ((benchTimers[i].count > expected) ||
+        (benchTimers[i].count + 1 < expected))
+    {
+      fired = false;
+    }
+  }
+  check("timer wheel: periodic timers fired once per period", fired);
+
+  report("millis() polling", 8, "timers / 10000 passes", runTimerPolling(8));
+  report("millis() polling", BENCH_TIMER_COUNT, "timers / 10000 passes",
+      runTimerPolling(BENCH_TIMER_COUNT));
+
+  // -- One-shot timers fire once, stopped timers never.
+  IotWebConfTimerWheel wheel;
+  benchTimers[0].count = 0;
+  benchTimers[1].count = 0;
+  wheel.start(&benchTimers[0], 50);
+  wheel.start(&benchTimers[1], 50);
+  wheel.stop(&benchTimers[1]);
+  unsigned long start = millis();
+  for (unsigned long t = 1; t <= 1000; t++)
+  {
+    wheel.process(start + t);
+  }
+  check("timer wheel: one-shot timer fired once",
+      (benchTimers[0].count == 1) && !benchTimers[0].isActive());
+  check("timer wheel: stopped timer did not fire", benchTimers[1].count == 0);
+
+  // -- The wheel is processed late, and the expired timer is restarted from
+  // its callback, while the wheel still catches up with the ticks missed.
+  IotWebConfTimerWheel lateWheel;
+  RestartingTimer restarting(&lateWheel);
+  lateWheel.process(millis());
+  lateWheel.start(&restarting, 100);
+  delay(300);
+  lateWheel.process(millis());
+  check("timer wheel: restarted timer fired once in a late pass",
+      restarting.count == 1);
+  unsigned long restartMs = millis();
+  while ((restarting.count == 1) && (millis() - restartMs < 200))
+  {
+    lateWheel.process(millis());
+  }
+  unsigned long delayMs = millis() - restartMs;
+  check("timer wheel: restarted timer fired after its delay",
+      (restarting.count == 2) && (delayMs >= 90));
+  lateWheel.stop(&restarting);
+}
@@ -0,0 +1,148 @@
+/**
+ * SHA-256 verification of firmware uploads (ESP32 only, ESP8266 uses the
+ * update server of the core). Uploads are posted to an update server over
+ * the loopback address. The image starts with a wrong magic byte, so Update
+ * refuses it before anything is written to flash: an upload that passed the
+ * digest check fails with the error of Update instead.
+ */
+
+#ifdef ESP32
+
+#define BENCH_UPDATE_PORT 8081
+#define BENCH_IMAGE_SIZE 1024
+#define BENCH_UPDATE_TIMEOUT_MS 2000
+
+WebServer benchUpdateWebServer(BENCH_UPDATE_PORT);
+IotWebConfSyncServer benchUpdateServer(&benchUpdateWebServer);
+HTTPUpdateServer benchUpdater;
+uint8_t benchImage[BENCH_IMAGE_SIZE];
+char benchImageDigest[65];
+
+/**
+ * Posts the image, and returns the response in the buffer.
+ *   @query - Appended to the path, e.g. "?sha256=...".
+ *   @headers - Additional request headers, each ending with "\r\n".
+ */
+void postBenchImage(const char* query, const char* headers, char* response,
+    size_t size)
+{
+  static const char partHead[] =
+      "--bench\r\nContent-Disposition: form-data; name=\"update\"; "
+      "filename=\"image.bin\"\r\nContent-Type: application/octet-stream\r\n\r\n";
+  static const char partTail[] = "\r\n--bench--\r\n";
+  char head[320];
+  snprintf(head, sizeof(head),
+      "POST /firmware%s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n"
+      "Content-Type: multipart/form-data; boundary=bench\r\n"
+      "Content-Length: %u\r\n%s\r\n",
+      query, (unsigned int)(strlen(partHead) + BENCH_IMAGE_SIZE + strlen(partTail)),
+      headers);
+
+  response[0] = '\0';
+  WiFiClient client;
+  if (!client.connect(IPAddress(127, 0, 0, 1), BENCH_UPDATE_PORT))
+  {
+    return;
+  }
+  client.write((const uint8_t*)head, strlen(head));
+  client.write((const uint8_t*)partHead, strlen(partHead));
+  client.write(benchImage, BENCH_IMAGE_SIZE);
+  client.write((const uint8_t*)partTail, strlen(partTail));
+
+  size_t length = 0;
+  unsigned long start = millis();
+  while (millis() - start < BENCH_UPDATE_TIMEOUT_MS)
+  {
+    benchUpdateServer.handleClient();
+    while ((client.available() > 0) && (length < size - 1))
+    {
+      response[length++] = client.read();
+    }
+    response[length] = '\0';
+    if ((length > 0) && !client.connected())
+    {
+      break;
+    }
+    delay(1);
+  }
+  client.stop();
+}
+
+void benchmarkUpdateDigest()
+{
+  for (unsigned int i = 0; i < BENCH_IMAGE_SIZE; i++)
+  {
+    benchImage[i] = i & 0xFF;
+  }
+  uint8_t digest[32];
+  mbedtls_sha256_context context;
+  mbedtls_sha256_init(&context);
+  mbedtls_sha256_starts(&context, 0);
+  mbedtls_sha256_update(&context, benchImage, BENCH_IMAGE_SIZE);
+  mbedtls_sha256_finish(&context, digest);
+  mbedtls_sha256_free(&context);
+  for (byte i = 0; i < 32; i++)
+  {
+    snprintf(benchImageDigest + i * 2, 3, "%02x", digest[i]);
+  }
+
+  // -- The sketch collects a header of its own, before and after the server
+  // is started. The digest header of the update server must stay collected.
+  benchUpdateServer.collectHeader("X-Bench-Before");
+  benchUpdater.setup(&benchUpdateWebServer, "/firmware", "", "");
+  benchUpdateServer.begin();
+  benchUpdateServer.collectHeader("X-Bench-After");
+
+  char query[80];
+  char headers[96];
+  char response[256];
+  const char* wrongDigest =
+      "0000000000000000000000000000000000000000000000000000000000000000";
+
+  snprintf(query, sizeof(query), "?sha256=%s", wrongDigest);
+  postBenchImage(query, "", response, sizeof(response));
+  check("update digest: wrong digest argument refused",
+      strstr(response, "SHA-256 digest mismatch") != NULL);
+
+  snprintf(query, sizeof(query), "?sha256=%s", benchImageDigest);
+  postBenchImage(query, "", response, sizeof(response));
+  check("update digest: matching digest argument accepted",
+      (strstr(response, "Update error") != NULL) &&
+      (strstr(response, "SHA-256") == NULL));
+
+  snprintf(headers, sizeof(headers),
+      "X-Update-SHA256: %s\r\nX-Bench-Before: 1\r\nX-Bench-After: 2\r\n",
+      wrongDigest);
+  postBenchImage("", headers, response, sizeof(response));
+  check("update digest: wrong digest header refused",
+      strstr(response, "SHA-256 digest mismatch") != NULL);
+  check("update digest: headers of the sketch collected",
+      (benchUpdateServer.header("X-Bench-Before") == "1") &&
+      (benchUpdateServer.header("X-Bench-After") == "2"));
+
+  snprintf(headers, sizeof(headers), "X-Update-SHA256: %s\r\n",
+      benchImageDigest);
+  postBenchImage("", headers, response, sizeof(response));
+  check("update digest: matching digest header accepted",
+      (strstr(response, "Update error") != NULL) &&
+      (strstr(response, "SHA-256") == NULL));
+
+  postBenchImage("", "", response, sizeof(response));
+  check("update digest: upload without digest not verified",
+      (strstr(response, "Update error") != NULL) &&
+      (strstr(response, "SHA-256") == NULL));
+
+  postBenchImage("?sha256=1234", "", response, sizeof(response));
+  check("update digest: malformed digest refused",
+      strstr(response, "Invalid SHA-256 digest") != NULL);
+
+  benchUpdateWebServer.stop();
+}
+
+#else
+
+void benchmarkUpdateDigest()
+{
+}
+
+#endif
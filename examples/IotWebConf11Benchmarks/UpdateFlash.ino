@@ -0,0 +1,265 @@
+/**
+ * OTA throughput (ESP32 only): an image is uploaded to the update server over
+ * the loopback address, and written to a fake flash instead of Update. The
+ * fake flash records the size of every write, and takes time for writing
+ * like a real flash does. The upload is sent by a separate task, as the
+ * WebServer reads a whole upload in one handleClient() call.
+ */
+
+#ifdef ESP32
+
+#define BENCH_OTA_PORT 8082
+#define BENCH_OTA_IMAGE_SIZE 65536
+#define BENCH_OTA_SEND_CHUNK 1460
+#define BENCH_OTA_TIMEOUT_MS 10000
+// -- Time of the fake flash for erasing and writing a KB.
+#define BENCH_FLASH_US_PER_KB 1000
+#define BENCH_FLASH_SECTOR_SIZE 4096
+
+/**
+ * Records the writes, and keeps a checksum of the data instead of storing it.
+ */
+class BenchFlash : public IotWebConfUpdateTarget
+{
+public:
+  bool begin()
+  {
+    this->writes = 0;
+    this->bytes = 0;
+    this->smallest = 0;
+    this->largest = 0;
+    this->partialSectors = 0;
+    this->checksum = 0;
+    this->ended = false;
+    this->activated = false;
+    return true;
+  }
+  size_t write(uint8_t* data, size_t length)
+  {
+    this->writes += 1;
+    this->bytes += length;
+    this->smallest = (this->writes == 1) || (length < this->smallest)
+        ? length
+        : this->smallest;
+    this->largest = length > this->largest ? length : this->largest;
+    this->partialSectors += (length % BENCH_FLASH_SECTOR_SIZE) == 0 ? 0 : 1;
+    this->checksum = benchChecksum(this->checksum, data, length);
+    delayMicroseconds(length * BENCH_FLASH_US_PER_KB / 1024);
+    return length;
+  }
+  bool end()
+  {
+    this->ended = true;
+    return true;
+  }
+  void abort() {}
+  bool hasError() { return false; }
+  void printError(Print& out) { out.print("Bench flash failed"); }
+  void activate() { this->activated = true; }
+
+  unsigned long writes;
+  size_t bytes;
+  size_t smallest;
+  size_t largest;
+  unsigned long partialSectors;
+  uint32_t checksum;
+  boolean ended;
+  boolean activated;
+};
+
+WebServer benchOtaWebServer(BENCH_OTA_PORT);
+IotWebConfSyncServer benchOtaServer(&benchOtaWebServer);
+HTTPUpdateServer benchOtaUpdater;
+BenchFlash benchFlash;
+uint8_t* benchOtaImage = NULL;
+
+// -- The upload of the sending task.
+const uint8_t* benchOtaPayload;
+size_t benchOtaPayloadLength;
+volatile boolean benchOtaSent;
+char benchOtaResponse[256];
+
+uint32_t benchChecksum(uint32_t checksum, const uint8_t* data, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    checksum = checksum * 31 + data[i];
+  }
+  return checksum;
+}
+
+/**
+ * A firmware like image: starts with the magic byte, code like runs of
+ * pseudo random bytes, and repeated parts, as in tables and texts.
+ */
+void fillBenchOtaImage(uint8_t* image, size_t size)
+{
+  uint32_t state = 2463534242UL;
+  size_t i = 0;
+  while (i < size)
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    size_t run = 16 + (state & 63);
+    boolean repeat = (i >= 1024) && ((state & 0x300) != 0);
+    size_t from = repeat ? i - 1 - ((state >> 10) % 1024) : 0;
+    for (size_t j = 0; (j < run) && (i < size); j++, i++)
+    {
+      if (repeat)
+      {
+        image[i] = image[from + j];
+      }
+      else
+      {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        image[i] = (state & 0x8000) ? (state & 0x0F) : (state >> 24);
+      }
+    }
+  }
+  image[0] = 0xE9;
+}
+
+/**
+ * Task posting benchOtaPayload as a file upload, and reading the response.
+ */
+void sendBenchOta(void* parameter)
+{
+  static const char partHead[] =
+      "--bench\r\nContent-Disposition: form-data; name=\"update\"; "
+      "filename=\"image.bin\"\r\nContent-Type: application/octet-stream\r\n\r\n";
+  static const char partTail[] = "\r\n--bench--\r\n";
+  char head[256];
+  snprintf(head, sizeof(head),
+      "POST /firmware HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n"
+      "Content-Type: multipart/form-data; boundary=bench\r\n"
+      "Content-Length: %u\r\n\r\n",
+      (unsigned int)(strlen(partHead) + benchOtaPayloadLength + strlen(partTail)));
+
+  WiFiClient client;
+  if (client.connect(IPAddress(127, 0, 0, 1), BENCH_OTA_PORT))
+  {
+    client.write((const uint8_t*)head, strlen(head));
+    client.write((const uint8_t*)partHead, strlen(partHead));
+    for (size_t sent = 0; sent < benchOtaPayloadLength;
+         sent += BENCH_OTA_SEND_CHUNK)
+    {
+      size_t count = benchOtaPayloadLength - sent;
+      client.write(benchOtaPayload + sent,
+          count < BENCH_OTA_SEND_CHUNK ? count : BENCH_OTA_SEND_CHUNK);
+    }
+    client.write((const uint8_t*)partTail, strlen(partTail));
+
+    size_t length = 0;
+    unsigned long start = millis();
+    while ((millis() - start < BENCH_OTA_TIMEOUT_MS) &&
+        (client.connected() || (client.available() > 0)))
+    {
+      while ((client.available() > 0) &&
+          (length < sizeof(benchOtaResponse) - 1))
+      {
+        benchOtaResponse[length++] = client.read();
+      }
+      delay(1);
+    }
+    benchOtaResponse[length] = '\0';
+  }
+  client.stop();
+  benchOtaSent = true;
+  vTaskDelete(NULL);
+}
+
+/**
+ * Uploads the payload, while serving the update server. Returns the elapsed
+ * microseconds until the response was read.
+ */
+unsigned long uploadBenchOta(const uint8_t* payload, size_t length)
+{
+  benchOtaPayload = payload;
+  benchOtaPayloadLength = length;
+  benchOtaSent = false;
+  benchOtaResponse[0] = '\0';
+  unsigned long startUs = micros();
+  if (xTaskCreate(sendBenchOta, "benchOta", 4096, NULL, 1, NULL) != pdPASS)
+  {
+    return 0;
+  }
+  unsigned long start = millis();
+  while (!benchOtaSent && (millis() - start < BENCH_OTA_TIMEOUT_MS))
+  {
+    benchOtaServer.handleClient();
+    delay(1);
+  }
+  return micros() - startUs;
+}
+
+/**
+ * Returns true, if the last upload reached the fake flash complete, and the
+ * update was finished.
+ */
+boolean checkBenchOta()
+{
+  return (strstr(benchOtaResponse, "Update Success") != NULL) &&
+      benchFlash.ended && benchFlash.activated &&
+      (benchFlash.bytes == BENCH_OTA_IMAGE_SIZE) &&
+      (benchFlash.checksum ==
+          benchChecksum(0, benchOtaImage, BENCH_OTA_IMAGE_SIZE));
+}
+
+void benchmarkUpdateFlash()
+{
+  benchOtaImage = (uint8_t*)malloc(BENCH_OTA_IMAGE_SIZE);
+  if (benchOtaImage == NULL)
+  {
+    check("ota: image allocated", false);
+    return;
+  }
+  fillBenchOtaImage(benchOtaImage, BENCH_OTA_IMAGE_SIZE);
+  benchOtaUpdater.setUpdateTarget(&benchFlash);
+  benchOtaUpdater.setup(&benchOtaWebServer, "/firmware", "", "");
+  benchOtaServer.begin();
+
+  unsigned long elapsedUs = uploadBenchOta(benchOtaImage, BENCH_OTA_IMAGE_SIZE);
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+  report("ota upload, double buffer", BENCH_OTA_IMAGE_SIZE / 1024, "KB",
+      elapsedUs);
+#else
+  report("ota upload", BENCH_OTA_IMAGE_SIZE / 1024, "KB", elapsedUs);
+#endif
+  const IotWebConfUpdateStats& stats = benchOtaUpdater.getStats();
+  Serial.print("ota upload: ");
+  Serial.print(elapsedUs == 0 ? 0 :
+      (unsigned long)((uint64_t)BENCH_OTA_IMAGE_SIZE * 1000 / elapsedUs));
+  Serial.print(" KB/s, ");
+  Serial.print(stats.flashWriteUs);
+  Serial.print(" us writing flash, ");
+  Serial.print(stats.networkWaitUs);
+  Serial.println(" us waiting for the network");
+  Serial.print("ota flash: ");
+  Serial.print(benchFlash.writes);
+  Serial.print(" writes of ");
+  Serial.print((unsigned long)benchFlash.smallest);
+  Serial.print(" - ");
+  Serial.print((unsigned long)benchFlash.largest);
+  Serial.print(" bytes, ");
+  Serial.print(benchFlash.partialSectors);
+  Serial.println(" not sector sized");
+
+  check("ota: image written completely", checkBenchOta());
+  check("ota: written bytes counted",
+      stats.writtenBytes == BENCH_OTA_IMAGE_SIZE);
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+  // -- Blocks are written whole, except the last one.
+  check("ota: flash written in blocks", benchFlash.partialSectors <= 1);
+#endif
+}
+
+#else
+
+void benchmarkUpdateFlash()
+{
+}
+
+#endif
@@ -0,0 +1,255 @@
+/**
+ * Compressed uploads (ESP32 only): the image of the OTA throughput benchmark
+ * is uploaded plain and gzip compressed, to the same fake flash, comparing
+ * the bytes sent and the time until the update finished. The image is
+ * compressed here with a minimal deflate encoder (fixed Huffman codes, one
+ * match candidate per position), so gzip tools do somewhat better.
+ */
+
+#if defined(ESP32) && defined(IOTWEBCONF_UPDATE_GZIP)
+
+#define BENCH_DEFLATE_HASH_SIZE 4096
+#define BENCH_DEFLATE_WINDOW 32768
+#define BENCH_DEFLATE_MIN_MATCH 3
+#define BENCH_DEFLATE_MAX_MATCH 258
+
+static const uint16_t benchLengthBase[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+    67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint16_t benchDistanceBase[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+    769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+
+/**
+ * Writes a single deflate block with the fixed Huffman codes.
+ */
+class BenchDeflater
+{
+public:
+  BenchDeflater(uint8_t* output)
+  {
+    this->output = output;
+    // -- Last block, fixed codes.
+    this->writeBits(1, 1);
+    this->writeBits(1, 2);
+  }
+  void writeLiteral(uint8_t value) { this->writeSymbol(value); }
+  void writeMatch(uint16_t length, uint16_t distance)
+  {
+    byte code = 0;
+    while ((code < 28) && (benchLengthBase[code + 1] <= length))
+    {
+      code++;
+    }
+    this->writeSymbol(257 + code);
+    this->writeBits(length - benchLengthBase[code],
+        (code < 8) || (code == 28) ? 0 : (code - 4) / 4);
+
+    code = 0;
+    while ((code < 29) && (benchDistanceBase[code + 1] <= distance))
+    {
+      code++;
+    }
+    this->writeCode(code, 5);
+    this->writeBits(distance - benchDistanceBase[code],
+        code < 4 ? 0 : code / 2 - 1);
+  }
+  /**
+   * Ends the block, returns the length of the output.
+   */
+  size_t finish()
+  {
+    this->writeSymbol(256);
+    if (this->bitCount > 0)
+    {
+      this->output[this->length++] = this->bits;
+    }
+    return this->length;
+  }
+
+private:
+  uint8_t* output;
+  size_t length = 0;
+  uint32_t bits = 0;
+  byte bitCount = 0;
+
+  void writeBits(uint32_t value, byte count)
+  {
+    this->bits |= value << this->bitCount;
+    this->bitCount += count;
+    while (this->bitCount >= 8)
+    {
+      this->output[this->length++] = this->bits & 0xFF;
+      this->bits >>= 8;
+      this->bitCount -= 8;
+    }
+  }
+  // -- Huffman codes are written starting with their most significant bit.
+  void writeCode(uint16_t code, byte count)
+  {
+    uint16_t reversed = 0;
+    for (byte i = 0; i < count; i++)
+    {
+      reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    this->writeBits(reversed, count);
+  }
+  void writeSymbol(uint16_t symbol)
+  {
+    if (symbol < 144)
+    {
+      this->writeCode(0x30 + symbol, 8);
+    }
+    else if (symbol < 256)
+    {
+      this->writeCode(0x190 + symbol - 144, 9);
+    }
+    else if (symbol < 280)
+    {
+      this->writeCode(symbol - 256, 7);
+    }
+    else
+    {
+      this->writeCode(0xC0 + symbol - 280, 8);
+    }
+  }
+};
+
+uint32_t benchCrc32(const uint8_t* data, size_t length)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (byte bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+uint16_t benchDeflateHash(const uint8_t* data)
+{
+  return ((data[0] << 8) ^ (data[1] << 4) ^ data[2]) &
+      (BENCH_DEFLATE_HASH_SIZE - 1);
+}
+
+/**
+ * Compresses the data to gzip format. The output must have room for
+ * length + length / 8 + 32 bytes. Returns the length of the compressed
+ * data, or 0 when out of memory.
+ */
+size_t gzipBenchImage(const uint8_t* data, size_t length, uint8_t* output)
+{
+  int32_t* head =
+      (int32_t*)malloc(BENCH_DEFLATE_HASH_SIZE * sizeof(int32_t));
+  if (head == NULL)
+  {
+    return 0;
+  }
+  for (size_t i = 0; i < BENCH_DEFLATE_HASH_SIZE; i++)
+  {
+    head[i] = -1;
+  }
+
+  static const uint8_t gzipHeader[] = {
+      0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+  memcpy(output, gzipHeader, sizeof(gzipHeader));
+  BenchDeflater deflater(output + sizeof(gzipHeader));
+
+  size_t i = 0;
+  while (i < length)
+  {
+    size_t matchLength = 0;
+    size_t matchFrom = 0;
+    if (i + BENCH_DEFLATE_MIN_MATCH <= length)
+    {
+      uint16_t hash = benchDeflateHash(data + i);
+      int32_t candidate = head[hash];
+      head[hash] = i;
+      if ((candidate >= 0) && (i - candidate <= BENCH_DEFLATE_WINDOW))
+      {
+        size_t maxLength = length - i < BENCH_DEFLATE_MAX_MATCH
+            ? length - i
+            : BENCH_DEFLATE_MAX_MATCH;
+        while ((matchLength < maxLength) &&
+            (data[candidate + matchLength] == data[i + matchLength]))
+        {
+          matchLength++;
+        }
+        matchFrom = candidate;
+      }
+    }
+    if (matchLength >= BENCH_DEFLATE_MIN_MATCH)
+    {
+      deflater.writeMatch(matchLength, i - matchFrom);
+      for (size_t j = i + 1; (j < i + matchLength) &&
+          (j + BENCH_DEFLATE_MIN_MATCH <= length); j++)
+      {
+        head[benchDeflateHash(data + j)] = j;
+      }
+      i += matchLength;
+    }
+    else
+    {
+      deflater.writeLiteral(data[i]);
+      i++;
+    }
+  }
+  free(head);
+
+  size_t outputLength = sizeof(gzipHeader) + deflater.finish();
+  uint32_t trailer[2] = {benchCrc32(data, length), (uint32_t)length};
+  for (byte k = 0; k < 8; k++)
+  {
+    output[outputLength++] = trailer[k / 4] >> (8 * (k % 4));
+  }
+  return outputLength;
+}
+
+void benchmarkUpdateGzip()
+{
+  if (benchOtaImage == NULL)
+  {
+    return;
+  }
+  uint8_t* compressed = (uint8_t*)malloc(
+      BENCH_OTA_IMAGE_SIZE + BENCH_OTA_IMAGE_SIZE / 8 + 32);
+  size_t compressedLength = compressed == NULL
+      ? 0
+      : gzipBenchImage(benchOtaImage, BENCH_OTA_IMAGE_SIZE, compressed);
+  if (compressedLength == 0)
+  {
+    free(compressed);
+    check("gzip: image compressed", false);
+    return;
+  }
+
+  unsigned long plainUs = uploadBenchOta(benchOtaImage, BENCH_OTA_IMAGE_SIZE);
+  boolean plainWritten = checkBenchOta();
+  unsigned long compressedUs = uploadBenchOta(compressed, compressedLength);
+  boolean compressedWritten = checkBenchOta();
+  free(compressed);
+
+  report("ota upload, plain", BENCH_OTA_IMAGE_SIZE, "bytes sent", plainUs);
+  report("ota upload, gzip", compressedLength, "bytes sent", compressedUs);
+  Serial.print("ota gzip: ");
+  Serial.print((unsigned long)(compressedLength * 100 / BENCH_OTA_IMAGE_SIZE));
+  Serial.print(" % of the plain size, ");
+  Serial.print(plainUs == 0 ? 0 : compressedUs * 100 / plainUs);
+  Serial.println(" % of the plain time");
+
+  check("gzip: compressed image is smaller",
+      compressedLength < BENCH_OTA_IMAGE_SIZE);
+  check("gzip: plain upload written completely", plainWritten);
+  check("gzip: compressed upload inflated completely", compressedWritten);
+}
+
+#else
+
+void benchmarkUpdateGzip()
+{
+}
+
+#endif
@@ -12,6 +12,95 @@
 
 #define IOTWEBCONF_STATUS_ENABLED (this->_statusPin >= 0)
 
+// -- Counters are updated in place, and compiled out without metrics.
+#ifdef IOTWEBCONF_CONFIG_USE_METRICS
+# define IOTWEBCONF_METRIC_ADD(COUNTER, VALUE) this->_metrics.COUNTER += (VALUE)
+#else
+# define IOTWEBCONF_METRIC_ADD(COUNTER, VALUE)
+#endif
+
+// -- Duration of the enclosing scope is added to the histogram of the phase.
+#ifdef IOTWEBCONF_CONFIG_USE_PROFILER
+# define IOTWEBCONF_PROFILE(PHASE) \
+    IotWebConfProfileScope profileScope(&this->_profiler, PHASE)
+#else
+# define IOTWEBCONF_PROFILE(PHASE)
+#endif
+
+// -- Heap usage of the enclosing scope is tracked as a request of the handler.
+#ifdef IOTWEBCONF_CONFIG_USE_HEAP_TRACKER
+# define IOTWEBCONF_HEAP_TRACK(HANDLER) \
+    IotWebConfHeapScope heapScope(&this->_heapTracker, HANDLER)
+#else
+# define IOTWEBCONF_HEAP_TRACK(HANDLER)
+#endif
+
+#define IOTWEBCONF_HTTP_NO_CACHE_HEADERS \
+  "Cache-Control: no-cache, no-store, must-revalidate\r\n" \
+  "Pragma: no-cache\r\n" \
+  "Expires: -1\r\n"
+
+#ifdef IOTWEBCONF_NOT_FOUND_DETAILS_MAX_LEN
+/**
+ * Writes the text to the client, but not more than the remaining capacity.
+ */
+static void writeCapped(
+    IotWebConfServer* server, const char* text, size_t* remaining)
+{
+  size_t length = strlen(text);
+  if (length > *remaining)
+  {
+    length = *remaining;
+  }
+  if (length > 0)
+  {
+    server->write((const uint8_t*)text, length);
+    *remaining -= length;
+  }
+}
+#endif
+
+#ifdef IOTWEBCONF_CONFIG_USE_METRICS
+static const char* const IOTWEBCONF_METRICS_STATES[] = {
+    "boot", "not_configured", "ap_mode", "connecting", "online"};
+static const char* const IOTWEBCONF_METRICS_HANDLERS[] = {
+    "config", "not_found", "captive", "log", "trace", "networks", "metrics"};
+
+/**
+ * Formats a line of the metrics output, and writes it to the client.
+ */
+static void writeMetric(IotWebConfServer* server, const char* format, ...)
+{
+  char line[192];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (length > 0)
+  {
+    server->write(
+        (const uint8_t*)line,
+        (size_t)length < sizeof(line) ? length : sizeof(line) - 1);
+  }
+}
+#endif
+
+#if IOTWEBCONF_LOG_LEVEL >= IOTWEBCONF_LOG_LEVEL_DEBUG
+/**
+ * Value of the parameter as it can appear in the log.
+ */
+static const char* loggedValue(IotWebConfParameter* parameter)
+{
+# ifndef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
+  if (strcmp("password", parameter->type) == 0)
+  {
+    return "<hidden>";
+  }
+# endif
+  return parameter->valueBuffer;
+}
+#endif
+
 IotWebConfParameter::IotWebConfParameter()
 {
 }
@@ -56,13 +145,36 @@ IotWebConfSeparator::IotWebConfSeparator(const char* label)
 
 ////////////////////////////////////////////////////////////////
 
+IotWebConfHtmlFormatProvider ESPWIFI::_defaultHtmlFormatProvider;
+IotWebConfArena ESPWIFI::_arena;
+WiFiClient ESPWIFI::_renderClient;
+ESPWIFI* ESPWIFI::_renderOwner = NULL;
+const uint8_t* ESPWIFI::_connectBssid = NULL;
+int32_t ESPWIFI::_connectChannel = 0;
+
 ESPWIFI::ESPWIFI(
     const char* defaultThingName, DNSServer* dnsServer, WebServer* server,
     const char* initialApPassword, const char* configVersion)
 {
+  this->_forceDefaultPassword = false;
+  this->_skipApStartup = false;
+  this->_apTimedOut = false;
+  this->_wifiConnectionTimedOut = false;
+  this->_keepApWhileConnecting = false;
+  this->_apKept = false;
+  this->_unreachable = false;
+  this->_apProbeScanning = false;
+  this->_rememberLease = false;
+  this->_ipConfigured = false;
+  this->_roamingScanning = false;
+  this->_roaming = false;
+  this->_networkScanning = false;
+
   strncpy(this->_thingName, defaultThingName, IOTWEBCONF_WORD_LEN);
+  this->dropSessions();
   this->_dnsServer = dnsServer;
   this->_server = server;
+  this->_syncServer.setWebServer(server);
   this->_initialApPassword = initialApPassword;
   this->_configVersion = configVersion;
   itoa(this->_apTimeoutMs / 1000, this->_apTimeoutStr, 10);
@@ -77,6 +189,33 @@ ESPWIFI::ESPWIFI(
   this->addParameter(&this->_wifiSsidParameter);
   this->addParameter(&this->_wifiPasswordParameter);
   this->addParameter(&this->_apTimeoutParameter);
+#ifdef IOTWEBCONF_CONFIG_USE_STATIC_IP
+  this->_staticIp[0] = '\0';
+  this->_staticGateway[0] = '\0';
+  this->_staticNetmask[0] = '\0';
+  this->_staticDns[0] = '\0';
+  this->_staticIpParameter = IotWebConfParameter("Static IP (empty for DHCP)", "iwcStaticIp", this->_staticIp, IOTWEBCONF_IP_LEN);
+  this->_staticGatewayParameter = IotWebConfParameter("Gateway", "iwcGateway", this->_staticGateway, IOTWEBCONF_IP_LEN);
+  this->_staticNetmaskParameter = IotWebConfParameter("Netmask", "iwcNetmask", this->_staticNetmask, IOTWEBCONF_IP_LEN, "text", NULL, "255.255.255.0");
+  this->_staticDnsParameter = IotWebConfParameter("DNS server", "iwcDns", this->_staticDns, IOTWEBCONF_IP_LEN);
+  this->addParameter(&this->_staticIpParameter);
+  this->addParameter(&this->_staticGatewayParameter);
+  this->addParameter(&this->_staticNetmaskParameter);
+  this->addParameter(&this->_staticDnsParameter);
+#endif
+  this->_lease.marker = 0;
+
+  this->_blinkTimer.callback = iotWebConfMethod<ESPWIFI, &ESPWIFI::doBlink>(this);
+  this->_apTimeoutTimer.callback =
+      iotWebConfMethod<ESPWIFI, &ESPWIFI::apTimedOut>(this);
+  this->_wifiConnectionTimer.callback =
+      iotWebConfMethod<ESPWIFI, &ESPWIFI::wifiConnectionTimedOut>(this);
+  this->_apTeardownTimer.callback =
+      iotWebConfMethod<ESPWIFI, &ESPWIFI::teardownKeptAp>(this);
+  this->_apProbeTimer.callback =
+      iotWebConfMethod<ESPWIFI, &ESPWIFI::startApProbe>(this);
+  this->_roamingTimer.callback =
+      iotWebConfMethod<ESPWIFI, &ESPWIFI::sampleRssi>(this);
 }
 
 char* ESPWIFI::getThingName()
@@ -103,6 +242,8 @@ void ESPWIFI::setupUpdateServer(
 
 boolean ESPWIFI::init()
 {
+  IotWebConfTrace::begin();
+
   // -- Setup pins.
   if (this->_configPin >= 0)
   {
@@ -113,6 +254,7 @@ boolean ESPWIFI::init()
   {
     pinMode(this->_statusPin, OUTPUT);
     digitalWrite(this->_statusPin, IOTWEBCONF_STATUS_ON);
+    this->startTimer(&this->_blinkTimer, this->_blinkOnMs);
   }
 
   // -- Load configuration from EEPROM.
@@ -130,6 +272,10 @@ boolean ESPWIFI::init()
   {
     this->_apTimeoutMs = atoi(this->_apTimeoutStr) * 1000;
   }
+  if (this->_rememberLease)
+  {
+    this->leaseLoad();
+  }
 
   // -- Setup mdns
 #ifdef ESP8266
@@ -181,10 +327,14 @@ void ESPWIFI::configInit()
     size += current->getLength();
     current = current->_nextParameter;
   }
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-  Serial.print("Config size: ");
-  Serial.println(size);
-#endif
+  IOTWEBCONF_LOG_INFO_VALUE(F("Config size: "), size);
+
+  this->_leaseStart =
+      IOTWEBCONF_CONFIG_START + IOTWEBCONF_CONFIG_VESION_LENGTH + size;
+  if (this->_rememberLease)
+  {
+    size += sizeof(IotWebConfLease);
+  }
 
   EEPROM.begin(
       IOTWEBCONF_CONFIG_START + IOTWEBCONF_CONFIG_VESION_LENGTH + size);
@@ -204,40 +354,13 @@ boolean ESPWIFI::configLoad()
       if (current->getId() != NULL)
       {
         this->readEepromValue(start, current->valueBuffer, current->getLength());
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-        const char* defaultMarker = "";
-#endif
+        IOTWEBCONF_LOG_DEBUG_TEXT(F("Loaded config "), current->getId());
         if ((strlen(current->valueBuffer) == 0) && (current->defaultValue != NULL))
         {
           strncpy(current->valueBuffer, current->defaultValue, current->getLength());
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-          defaultMarker = " (using default)";
-#endif
-        }
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-        Serial.print("Loaded config '");
-        Serial.print(current->getId());
-        Serial.print("'= ");
-# ifdef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
-        Serial.print("'");
-        Serial.print(current->valueBuffer);
-        Serial.print("'");
-        Serial.println(defaultMarker);
-# else
-        if (strcmp("password", current->type) == 0)
-        {
-          Serial.print(F("<hidden>"));
-          Serial.println(defaultMarker);
-        }
-        else
-        {
-          Serial.print("'");
-          Serial.print(current->valueBuffer);
-          Serial.print("'");
-          Serial.println(defaultMarker);
+          IOTWEBCONF_LOG_DEBUG(F("  (using default)"));
         }
-# endif
-#endif
+        IOTWEBCONF_LOG_DEBUG_TEXT(F("  value: "), loggedValue(current));
 
         start += current->getLength();
       }
@@ -254,45 +377,83 @@ boolean ESPWIFI::configLoad()
 
 void ESPWIFI::configSave()
 {
+  IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_SAVE);
+  this->_saveStep = IOTWEBCONF_SAVE_IDLE;
   this->configSaveConfigVersion();
   IotWebConfParameter* current = this->_firstParameter;
   int start = IOTWEBCONF_CONFIG_START + IOTWEBCONF_CONFIG_VESION_LENGTH;
   while (current != NULL)
   {
-    if (current->getId() != NULL)
-    {
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-      Serial.print("Saving config '");
-      Serial.print(current->getId());
-      Serial.print("'= ");
-# ifdef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
-      Serial.print("'");
-      Serial.print(current->valueBuffer);
-      Serial.println("'");
-# else
-      if (strcmp("password", current->type) == 0)
-      {
-        Serial.print(F("<hidden>"));
-      }
-      else
-      {
-        Serial.print("'");
-        Serial.print(current->valueBuffer);
-        Serial.println("'");
-      }
-# endif
-#endif
+    start = this->configSaveParameter(current, start);
+    current = current->_nextParameter;
+  }
+  this->configCommit();
+}
+
+/**
+ * Start saving the configuration in steps. The steps are performed by
+ * continueConfigSave() in the following doLoop() passes.
+ */
+void ESPWIFI::startConfigSave()
+{
+  this->configSaveConfigVersion();
+  this->_saveParameter = this->_firstParameter;
+  this->_saveOffset = IOTWEBCONF_CONFIG_START + IOTWEBCONF_CONFIG_VESION_LENGTH;
+  this->_saveStep = IOTWEBCONF_SAVE_WRITE;
+}
 
-      this->writeEepromValue(start, current->valueBuffer, current->getLength());
-      start += current->getLength();
+void ESPWIFI::continueConfigSave()
+{
+  IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_SAVE);
+  if (this->_saveStep == IOTWEBCONF_SAVE_WRITE)
+  {
+    while ((this->_saveParameter != NULL) && this->hasLoopBudget())
+    {
+      this->_saveOffset =
+          this->configSaveParameter(this->_saveParameter, this->_saveOffset);
+      this->_saveParameter = this->_saveParameter->_nextParameter;
     }
-    current = current->_nextParameter;
+    if (this->_saveParameter == NULL)
+    {
+      // -- Flash commit is performed in a pass of its own.
+      this->_saveStep = IOTWEBCONF_SAVE_COMMIT;
+    }
+  }
+  else if (this->_saveStep == IOTWEBCONF_SAVE_COMMIT)
+  {
+    this->_saveStep = IOTWEBCONF_SAVE_IDLE;
+    this->configCommit();
+  }
+}
+
+/**
+ * Writes a single parameter to the EEPROM buffer, returns the start offset of
+ * the next parameter.
+ */
+int ESPWIFI::configSaveParameter(IotWebConfParameter* current, int start)
+{
+  if (current->getId() == NULL)
+  {
+    return start;
   }
+  IOTWEBCONF_LOG_DEBUG_TEXT(F("Saving config "), current->getId());
+  IOTWEBCONF_LOG_DEBUG_TEXT(F("  value: "), loggedValue(current));
+
+  this->writeEepromValue(start, current->valueBuffer, current->getLength());
+  return start + current->getLength();
+}
+
+void ESPWIFI::configCommit()
+{
   EEPROM.commit();
+  IOTWEBCONF_METRIC_ADD(flashCommits, 1);
+
+  // -- Password might have been changed.
+  this->dropSessions();
 
   this->_apTimeoutMs = atoi(this->_apTimeoutStr) * 1000;
 
-  if (this->_configSavedCallback != NULL)
+  if (this->_configSavedCallback)
   {
     this->_configSavedCallback();
   }
@@ -333,17 +494,17 @@ void ESPWIFI::configSaveConfigVersion()
   }
 }
 
-void ESPWIFI::setWifiConnectionCallback(std::function<void()> func)
+void ESPWIFI::setWifiConnectionCallback(IotWebConfFunction<void()> func)
 {
   this->_wifiConnectionCallback = func;
 }
 
-void ESPWIFI::setConfigSavedCallback(std::function<void()> func)
+void ESPWIFI::setConfigSavedCallback(IotWebConfFunction<void()> func)
 {
   this->_configSavedCallback = func;
 }
 
-void ESPWIFI::setFormValidator(std::function<boolean()> func)
+void ESPWIFI::setFormValidator(IotWebConfFunction<boolean()> func)
 {
   this->_formValidator = func;
 }
@@ -353,141 +514,71 @@ void ESPWIFI::setWifiConnectionTimeoutMs(unsigned long millis)
   this->_wifiConnectionTimeoutMs = millis;
 }
 
+void ESPWIFI::setApTimeoutMs(unsigned long apTimeoutMs)
+{
+  this->_apTimeoutMs = apTimeoutMs;
+  if (this->_apTimeoutTimer.isActive())
+  {
+    // -- Reschedule the running timeout relative to the AP start.
+    unsigned long elapsed = millis() - this->_apStartTimeMs;
+    this->startTimer(
+        &this->_apTimeoutTimer,
+        elapsed < apTimeoutMs ? apTimeoutMs - elapsed : 0);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void ESPWIFI::handleConfig()
 {
+  IOTWEBCONF_HEAP_TRACK(IOTWEBCONF_HANDLER_CONFIG);
+  IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_CONFIG);
+  IOTWEBCONF_METRIC_ADD(httpRequests[IOTWEBCONF_HANDLER_CONFIG], 1);
   if (this->_state == IOTWEBCONF_STATE_ONLINE)
   {
     // -- Authenticate
-    if (!this->_server->authenticate(
-            IOTWEBCONF_ADMIN_USER_NAME, this->_apPassword))
+    if (!this->authenticate(this->_webServer))
     {
       IOTWEBCONF_DEBUG_LINE(F("Requesting authentication."));
-      this->_server->requestAuthentication();
+      this->_webServer->requestAuthentication();
       return;
     }
   }
 
-  if (!this->_server->hasArg("iotSave") || !this->validateForm())
+  if (!this->_webServer->hasArg("iotSave") || !this->validateForm())
   {
     // -- Display config portal
     IOTWEBCONF_DEBUG_LINE(F("Configuration page requested."));
-    String page = htmlFormatProvider->getHead();
-    page.replace("{v}", "Config ESP");
-    page += htmlFormatProvider->getScript();
-    page += htmlFormatProvider->getStyle();
-    page += htmlFormatProvider->getHeadExtension();
-    page += htmlFormatProvider->getHeadEnd();
-
-    page += htmlFormatProvider->getFormStart();
-    char parLength[5];
-    // -- Add parameters to the form
-    IotWebConfParameter* current = this->_firstParameter;
-    while (current != NULL)
-    {
-      if (current->getId() == NULL)
-      {
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-        Serial.println("Rendering separator");
-#endif
-        page += "</fieldset><fieldset>";
-        if (current->label != NULL)
-        {
-          page += "<legend>";
-          page += current->label;
-          page += "</legend>";
-        }
-      }
-      else if (current->visible)
-      {
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-        Serial.print("Rendering '");
-        Serial.print(current->getId());
-        Serial.print("' with value: ");
-# ifdef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
-        Serial.println(current->valueBuffer);
-# else
-        if (strcmp("password", current->type) == 0)
-        {
-          Serial.println(F("<hidden>"));
-        }
-        else
-        {
-          Serial.println(current->valueBuffer);
-        }
-# endif
-#endif
-
-        String pitem;
-        if (current->label != NULL)
-        {
-          pitem = htmlFormatProvider->getFormParam(current->type);
-          pitem.replace("{b}", current->label);
-          pitem.replace("{t}", current->type);
-          pitem.replace("{i}", current->getId());
-          pitem.replace("{p}", current->placeholder == NULL ? "" : current->placeholder);
-          snprintf(parLength, 5, "%d", current->getLength());
-          pitem.replace("{l}", parLength);
-          if (strcmp("password", current->type) == 0)
-          {
-            // -- Value of password is not rendered
-            pitem.replace("{v}", "");
-          }
-          else if (this->_server->hasArg(current->getId()))
-          {
-            // -- Value from previous submit
-            pitem.replace("{v}", this->_server->arg(current->getId()));
-          }
-          else
-          {
-            // -- Value from config
-            pitem.replace("{v}", current->valueBuffer);
-          }
-          pitem.replace(
-              "{c}", current->customHtml == NULL ? "" : current->customHtml);
-          pitem.replace(
-              "{e}",
-              current->errorMessage == NULL ? "" : current->errorMessage);
-          pitem.replace(
-              "{s}",
-              current->errorMessage == NULL ? "" : "de"); // Div style class.
-        }
-        else
-        {
-          pitem = current->customHtml;
-        }
-
-        page += pitem;
-      }
-      current = current->_nextParameter;
-    }
-
-    page += htmlFormatProvider->getFormEnd();
-
-    if (this->_updatePath != NULL)
+    if ((this->_loopBudgetUs > 0) && (this->_webServer->args() == 0) &&
+        (_renderOwner == NULL) &&
+        this->_webServer->takeClient(&_renderClient))
     {
-      String pitem = htmlFormatProvider->getUpdate();
-      pitem.replace("{u}", this->_updatePath);
-      page += pitem;
+      // -- Parameters are rendered by continueConfigPage() in the following
+      // doLoop() passes within the loop budget.
+      this->startConfigPage();
+      return;
     }
 
-    // -- Fill config version string;
+    this->writeStreamHeader("text/html; charset=UTF-8");
     {
-      String pitem = htmlFormatProvider->getConfigVer();
-      pitem.replace("{v}", this->_configVersion);
-      page += pitem;
+      IotWebConfPageWriter writer(this->_webServer);
+      this->writeConfigPageHead(&writer);
+      IotWebConfParameter* current = this->_firstParameter;
+      while (current != NULL)
+      {
+        IotWebConfArenaScope arenaScope(&this->_arena);
+        this->writeConfigParameter(&writer, current, true);
+        current = current->_nextParameter;
+      }
+      this->writeConfigPageTail(&writer);
     }
-
-    page += htmlFormatProvider->getEnd();
-
-    this->_server->sendHeader("Content-Length", String(page.length()));
-    this->_server->send(200, "text/html; charset=UTF-8", page);
+    this->_webServer->endStream();
   }
   else
   {
     // -- Save config
     IOTWEBCONF_DEBUG_LINE(F("Updating configuration"));
+    IOTWEBCONF_METRIC_ADD(configSaves, 1);
     char temp[IOTWEBCONF_WORD_LEN];
 
     IotWebConfParameter* current = this->_firstParameter;
@@ -504,428 +595,1788 @@ void ESPWIFI::handleConfig()
           {
             // -- Value was set.
             strncpy(current->valueBuffer, temp, current->getLength());
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-            Serial.print(current->getId());
-            Serial.println(" was set");
-#endif
+            IOTWEBCONF_LOG_DEBUG_TEXT(F("Password was set: "), current->getId());
           }
           else
           {
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-            Serial.print(current->getId());
-            Serial.println(" was not changed");
-#endif
+            IOTWEBCONF_LOG_DEBUG_TEXT(
+                F("Password was not changed: "), current->getId());
           }
         }
         else
         {
           this->readParamValue(
               current->getId(), current->valueBuffer, current->getLength());
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-          Serial.print(current->getId());
-          Serial.print("='");
-# ifdef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
-          Serial.print(current->valueBuffer);
-# else
-          if (strcmp("password", current->type) == 0)
-          {
-            Serial.print(F("<hidden>"));
-          }
-          else
-          {
-            Serial.print(current->valueBuffer);
-          }
-# endif
-          Serial.print(current->valueBuffer);
-          Serial.println("'");
-#endif
         }
       }
       current = current->_nextParameter;
     }
 
-    this->configSave();
-
-    String page = htmlFormatProvider->getHead();
-    page.replace("{v}", "Config ESP");
-    page += htmlFormatProvider->getScript();
-    page += htmlFormatProvider->getStyle();
-//    page += _customHeadElement;
-    page += htmlFormatProvider->getHeadExtension();
-    page += htmlFormatProvider->getHeadEnd();
-    page += "Configuration saved. ";
-    if (this->_apPassword[0] == '\0')
-    {
-      page += F("You must change the default AP password to continue. Return "
-                "to <a href=''>configuration page</a>.");
-    }
-    else if (this->_wifiSsid[0] == '\0')
-    {
-      page += F("You must provide the local wifi settings to continue. Return "
-                "to <a href=''>configuration page</a>.");
-    }
-    else if (this->_state == IOTWEBCONF_STATE_NOT_CONFIGURED)
+    if (this->_loopBudgetUs > 0)
     {
-      page += F("Please disconnect from WiFi AP to continue!");
+      this->startConfigSave();
     }
     else
     {
-      page += F("Return to <a href='/'>home page</a>.");
+      this->configSave();
     }
-    page += htmlFormatProvider->getHeadEnd();
 
-    this->_server->sendHeader("Content-Length", String(page.length()));
-    this->_server->send(200, "text/html; charset=UTF-8", page);
+    this->writeStreamHeader("text/html; charset=UTF-8");
+    {
+      IotWebConfPageWriter writer(this->_webServer);
+      this->writeSavedPage(&writer);
+    }
+    this->_webServer->endStream();
   }
 }
 
-void ESPWIFI::readParamValue(
-    const char* paramName, char* target, unsigned int len)
-{
-  String value = this->_server->arg(paramName);
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-  Serial.print("Value of arg '");
-  Serial.print(paramName);
-  Serial.print("' is:");
-  Serial.println(value);
-#endif
-  value.toCharArray(target, len);
-}
-
-boolean ESPWIFI::validateForm()
+void ESPWIFI::writeSavedPage(IotWebConfPageWriter* writer)
 {
-  // -- Clean previous error messages.
-  IotWebConfParameter* current = this->_firstParameter;
-  while (current != NULL)
+  this->writeHtmlHead(writer);
+  writer->print("Configuration saved. ");
+  if (this->_apPassword[0] == '\0')
   {
-    current->errorMessage = NULL;
-    current = current->_nextParameter;
+    writer->printP(PSTR("You must change the default AP password to continue. "
+                        "Return to <a href=''>configuration page</a>."));
   }
-
-  // -- Call external validator.
-  boolean valid = true;
-  if (this->_formValidator != NULL)
+  else if (this->_wifiSsid[0] == '\0')
   {
-    valid = this->_formValidator();
+    writer->printP(PSTR("You must provide the local wifi settings to continue. "
+                        "Return to <a href=''>configuration page</a>."));
   }
-
-  // -- Internal validation.
-  int l = this->_server->arg(this->_thingNameParameter.getId()).length();
-  if (3 > l)
+  else if (this->_state == IOTWEBCONF_STATE_NOT_CONFIGURED)
   {
-    this->_thingNameParameter.errorMessage =
-        "Give a name with at least 3 characters.";
-    valid = false;
+    writer->printP(PSTR("Please disconnect from WiFi AP to continue!"));
   }
-  l = this->_server->arg(this->_apPasswordParameter.getId()).length();
-  if ((0 < l) && (l < 8))
+  else
   {
-    this->_apPasswordParameter.errorMessage =
-        "Password length must be at least 8 characters.";
-    valid = false;
+    writer->printP(PSTR("Return to <a href='/'>home page</a>."));
   }
-  l = this->_server->arg(this->_wifiPasswordParameter.getId()).length();
-  if ((0 < l) && (l < 8))
+  this->writeHtmlPart(
+      writer, IOTWEBCONF_HTML_END, &IotWebConfHtmlFormatProvider::getEnd);
+}
+
+/**
+ * A valid session cookie is accepted, otherwise Basic credentials are checked,
+ * and on success a new session is issued with the response.
+ */
+boolean ESPWIFI::authenticate(IotWebConfServer* server)
+{
+  this->_issuedSession = NULL;
+  IotWebConfSession* session = this->findSession(server);
+  if (session != NULL)
   {
-    this->_wifiPasswordParameter.errorMessage =
-        "Password length must be at least 8 characters.";
-    valid = false;
+    session->lastUsedMs = millis();
+    return true;
+  }
+  if (!server->authenticate(IOTWEBCONF_ADMIN_USER_NAME, this->_apPassword))
+  {
+    return false;
   }
+  this->createSession();
+  return true;
+}
 
-  return valid;
+/**
+ * Lowest hex digit of the bits.
+ */
+static char hexDigit(uint32_t bits)
+{
+  return "0123456789abcdef"[bits & 0x0F];
 }
 
-void ESPWIFI::handleNotFound()
+IotWebConfSession* ESPWIFI::findSession(IotWebConfServer* server)
 {
-  if (this->handleCaptivePortal())
+  IotWebConfArenaScope arenaScope(&this->_arena);
+  int length = server->readHeader("Cookie", NULL, 0);
+  char* cookies = length < 0 ? NULL : (char*)this->_arena.allocate(length + 1);
+  if (cookies == NULL)
   {
-    // If captive portal redirect instead of displaying the error page.
-    return;
+    return NULL;
+  }
+  server->readHeader("Cookie", cookies, length + 1);
+  const char* token = strstr(cookies, IOTWEBCONF_SESSION_COOKIE "=");
+  if (token == NULL)
+  {
+    return NULL;
+  }
+  token += sizeof(IOTWEBCONF_SESSION_COOKIE);
+  for (byte i = 0; i < IOTWEBCONF_SESSION_TOKEN_LEN; i++)
+  {
+    if (token[i] == '\0')
+    {
+      return NULL;
+    }
   }
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-  Serial.print("Requested non-existing page '");
-  Serial.print(this->_server->uri());
-  Serial.print("' arguments(");
-  Serial.print(this->_server->method() == HTTP_GET ? "GET" : "POST");
-  Serial.print("):");
-  Serial.println(this->_server->args());
-#endif
-  String message = "File Not Found\n\n";
-  message += "URI: ";
-  message += this->_server->uri();
-  message += "\nMethod: ";
-  message += (this->_server->method() == HTTP_GET) ? "GET" : "POST";
-  message += "\nArguments: ";
-  message += this->_server->args();
-  message += "\n";
 
-  for (uint8_t i = 0; i < this->_server->args(); i++)
+  unsigned long now = millis();
+  for (byte i = 0; i < IOTWEBCONF_SESSION_COUNT; i++)
   {
-    message +=
-        " " + this->_server->argName(i) + ": " + this->_server->arg(i) + "\n";
+    IotWebConfSession* session = &this->_sessions[i];
+    if ((session->token[0] == 0) ||
+        (IOTWEBCONF_SESSION_TIMEOUT_MS < now - session->lastUsedMs))
+    {
+      continue;
+    }
+    // -- Every character is compared, so the time taken does not tell, how
+    // much of the token matched.
+    char diff = 0;
+    for (byte j = 0; j < IOTWEBCONF_SESSION_TOKEN_LEN; j++)
+    {
+      diff |= token[j] ^ hexDigit(session->token[j / 8] >> (4 * (j % 8)));
+    }
+    if (diff == 0)
+    {
+      return session;
+    }
   }
-  this->_server->sendHeader(
-      "Cache-Control", "no-cache, no-store, must-revalidate");
-  this->_server->sendHeader("Pragma", "no-cache");
-  this->_server->sendHeader("Expires", "-1");
-  this->_server->sendHeader("Content-Length", String(message.length()));
-  this->_server->send(404, "text/plain", message);
+  return NULL;
 }
 
 /**
- * Redirect to captive portal if we got a request for another domain.
- * Return true in that case so the page handler do not try to handle the request
- * again. (Code from WifiManager project.)
+ * The cookie of the new session is sent with the response of the actual
+ * request. (See sendSessionCookie() and writeStreamHeader().)
  */
-boolean ESPWIFI::handleCaptivePortal()
+void ESPWIFI::createSession()
 {
-  String host = this->_server->hostHeader();
-  String thingName = String(this->_thingName);
-  thingName.toLowerCase();
-  if (!isIp(host) && !host.startsWith(thingName))
+  // -- A free or expired slot is used, or the least recently used one.
+  unsigned long now = millis();
+  IotWebConfSession* session = &this->_sessions[0];
+  for (byte i = 0; i < IOTWEBCONF_SESSION_COUNT; i++)
   {
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-    Serial.print("Request for ");
-    Serial.print(host);
-    Serial.print(" redirected to ");
-    Serial.println(this->_server->client().localIP());
+    IotWebConfSession* candidate = &this->_sessions[i];
+    if ((candidate->token[0] == 0) ||
+        (IOTWEBCONF_SESSION_TIMEOUT_MS < now - candidate->lastUsedMs))
+    {
+      session = candidate;
+      break;
+    }
+    if ((now - candidate->lastUsedMs) > (now - session->lastUsedMs))
+    {
+      session = candidate;
+    }
+  }
+
+  for (byte i = 0; i < IOTWEBCONF_SESSION_TOKEN_LEN / 8; i++)
+  {
+#ifdef ESP8266
+    session->token[i] = ESP.random();
+#elif defined(ESP32)
+    session->token[i] = esp_random();
 #endif
-    this->_server->sendHeader(
-      "Location", String("http://") + toStringIp(this->_server->client().localIP()), true);
-    this->_server->send(302, "text/plain", ""); // Empty content inhibits Content-length header so we have to close the socket ourselves.
-    this->_server->client().stop(); // Stop is needed because we sent no content length
-    return true;
   }
-  return false;
+  if (session->token[0] == 0)
+  {
+    // -- Would mark the session free.
+    session->token[0] = 1;
+  }
+  session->lastUsedMs = now;
+  this->_issuedSession = session;
+  IOTWEBCONF_DEBUG_LINE(F("Session created."));
 }
 
-/** Is this an IP? */
-boolean ESPWIFI::isIp(String str)
+/**
+ * Formats the Set-Cookie value for the session issued in the actual request.
+ * Returns false, if no session was issued. A session is only announced once.
+ */
+boolean ESPWIFI::takeSessionCookie(char* cookie, size_t size)
 {
-  for (size_t i = 0; i < str.length(); i++)
+  if (this->_issuedSession == NULL)
   {
-    int c = str.charAt(i);
-    if (c != '.' && (c < '0' || c > '9'))
-    {
-      return false;
-    }
+    return false;
+  }
+  char token[IOTWEBCONF_SESSION_TOKEN_LEN + 1];
+  for (byte j = 0; j < IOTWEBCONF_SESSION_TOKEN_LEN; j++)
+  {
+    token[j] = hexDigit(this->_issuedSession->token[j / 8] >> (4 * (j % 8)));
   }
+  token[IOTWEBCONF_SESSION_TOKEN_LEN] = '\0';
+  snprintf(
+      cookie, size,
+      IOTWEBCONF_SESSION_COOKIE "=%s; Path=/; HttpOnly; SameSite=Strict",
+      token);
+  this->_issuedSession = NULL;
   return true;
 }
 
-/** IP to String? */
-String ESPWIFI::toStringIp(IPAddress ip)
+void ESPWIFI::sendSessionCookie(IotWebConfServer* server)
 {
-  String res = "";
-  for (int i = 0; i < 3; i++)
+  char cookie[IOTWEBCONF_SESSION_COOKIE_LEN];
+  if (this->takeSessionCookie(cookie, sizeof(cookie)))
   {
-    res += String((ip >> (8 * i)) & 0xFF) + ".";
+    server->sendHeader("Set-Cookie", cookie);
   }
-  res += String(((ip >> 8 * 3)) & 0xFF);
-  return res;
 }
 
-/////////////////////////////////////////////////////////////////////////////////
+/**
+ * Starts a response streamed without Content-Length. The backend decides,
+ * whether the connection is kept alive, the response is ended with
+ * endStream().
+ */
+void ESPWIFI::writeStreamHeader(const char* contentType, int code)
+{
+  static const char noCacheHeaders[] = IOTWEBCONF_HTTP_NO_CACHE_HEADERS;
+  char headers[IOTWEBCONF_SESSION_COOKIE_LEN + sizeof(noCacheHeaders) + 16];
+  size_t length = 0;
+  char cookie[IOTWEBCONF_SESSION_COOKIE_LEN];
+  if (this->takeSessionCookie(cookie, sizeof(cookie)))
+  {
+    length = snprintf(headers, sizeof(headers), "Set-Cookie: %s\r\n", cookie);
+  }
+  memcpy(headers + length, noCacheHeaders, sizeof(noCacheHeaders));
+  this->_webServer->startStream(code, contentType, headers);
+}
+
+/**
+ * Writes the header of a page sent to a client taken over from the request.
+ * The response ends with closing the connection.
+ */
+void ESPWIFI::writeStreamHeader(
+    IotWebConfPageWriter* writer, const char* contentType)
+{
+  static const char headerEnd[] =
+      "\r\n" IOTWEBCONF_HTTP_NO_CACHE_HEADERS "Connection: close\r\n\r\n";
+  writer->print("HTTP/1.1 200 OK\r\nContent-Type: ");
+  writer->print(contentType);
+  char cookie[IOTWEBCONF_SESSION_COOKIE_LEN];
+  if (this->takeSessionCookie(cookie, sizeof(cookie)))
+  {
+    writer->print("\r\nSet-Cookie: ");
+    writer->print(cookie);
+  }
+  writer->write(headerEnd, sizeof(headerEnd) - 1);
+}
+
+void ESPWIFI::dropSessions()
+{
+  for (byte i = 0; i < IOTWEBCONF_SESSION_COUNT; i++)
+  {
+    this->_sessions[i].token[0] = 0;
+  }
+}
+
+/**
+ * Write a part of the page with the {x} placeholders replaced. The default
+ * provider is written from flash, custom providers are asked for their
+ * String.
+ */
+void ESPWIFI::writeHtmlPart(
+    IotWebConfPageWriter* writer, PGM_P text, IotWebConfHtmlPart part,
+    const char* keys, const char* const* values)
+{
+  if (this->htmlFormatProvider == &_defaultHtmlFormatProvider)
+  {
+    writer->printTemplateP(text, keys, values);
+  }
+  else
+  {
+    writer->printTemplate((this->htmlFormatProvider->*part)().c_str(), keys, values);
+  }
+}
+
+void ESPWIFI::writeHtmlHead(IotWebConfPageWriter* writer)
+{
+  const char* values[] = {"Config ESP"};
+  if (this->htmlFormatProvider == &_defaultHtmlFormatProvider)
+  {
+    writer->printTemplateP(IOTWEBCONF_HTML_HEAD, "v", values);
+    writer->print("<script>");
+    writer->printP(IOTWEBCONF_HTML_SCRIPT_INNER);
+    writer->print("</script><style>");
+    writer->printP(IOTWEBCONF_HTML_STYLE_INNER);
+    writer->print("</style>");
+    writer->printP(IOTWEBCONF_HTML_HEAD_END);
+    writer->printP(IOTWEBCONF_HTML_BODY_INNER);
+    return;
+  }
+  writer->printTemplate(htmlFormatProvider->getHead().c_str(), "v", values);
+  writer->print(htmlFormatProvider->getScript().c_str());
+  writer->print(htmlFormatProvider->getStyle().c_str());
+  writer->print(htmlFormatProvider->getHeadExtension().c_str());
+  writer->print(htmlFormatProvider->getHeadEnd().c_str());
+}
+
+void ESPWIFI::writeConfigPageHead(IotWebConfPageWriter* writer)
+{
+  this->writeHtmlHead(writer);
+  this->writeNetworks(writer);
+  this->writeHtmlPart(
+      writer, IOTWEBCONF_HTML_FORM_START,
+      &IotWebConfHtmlFormatProvider::getFormStart);
+}
+
+/**
+ * Write a single item of the config form.
+ *   @useArgs - Use values of the current request for the value of the field.
+ */
+void ESPWIFI::writeConfigParameter(
+    IotWebConfPageWriter* writer, IotWebConfParameter* current,
+    boolean useArgs)
+{
+  if (current->getId() == NULL)
+  {
+    IOTWEBCONF_LOG_DEBUG(F("Rendering separator"));
+    writer->print("</fieldset><fieldset>");
+    if (current->label != NULL)
+    {
+      writer->print("<legend>");
+      writer->print(current->label);
+      writer->print("</legend>");
+    }
+    return;
+  }
+  if (!current->visible)
+  {
+    return;
+  }
+  IOTWEBCONF_LOG_DEBUG_TEXT(F("Rendering "), current->getId());
+  IOTWEBCONF_LOG_DEBUG_TEXT(F("  value: "), loggedValue(current));
+
+  if (current->label == NULL)
+  {
+    if (current->customHtml != NULL)
+    {
+      writer->print(current->customHtml);
+    }
+    return;
+  }
+  char parLength[5];
+  snprintf(parLength, 5, "%d", current->getLength());
+  const char* value;
+  if (strcmp("password", current->type) == 0)
+  {
+    // -- Value of password is not rendered
+    value = "";
+  }
+  else if (useArgs && this->_webServer->hasArg(current->getId()))
+  {
+    // -- Value from previous submit
+    value = this->arenaArg(current->getId());
+  }
+  else
+  {
+    // -- Value from config
+    value = current->valueBuffer;
+  }
+  const char* values[] = {
+      current->label,
+      current->type,
+      current->getId(),
+      current->placeholder,
+      parLength,
+      value,
+      current->customHtml,
+      current->errorMessage,
+      current->errorMessage == NULL ? "" : "de"}; // Div style class.
+  if (this->htmlFormatProvider == &_defaultHtmlFormatProvider)
+  {
+    writer->printTemplateP(IOTWEBCONF_HTML_FORM_PARAM, "btiplvces", values);
+  }
+  else
+  {
+    String pitem = htmlFormatProvider->getFormParam(current->type);
+    writer->printTemplate(pitem.c_str(), "btiplvces", values);
+  }
+}
+
+/**
+ * Value of a request argument copied to the arena.
+ */
+const char* ESPWIFI::arenaArg(const char* name)
+{
+  int length = this->_webServer->readArg(name, NULL, 0);
+  if (length < 0)
+  {
+    return "";
+  }
+  char* value = (char*)this->_arena.allocate(length + 1);
+  if (value == NULL)
+  {
+    return "";
+  }
+  this->_webServer->readArg(name, value, length + 1);
+  return value;
+}
+
+/**
+ * URI of the request copied to the arena.
+ */
+const char* ESPWIFI::arenaUri()
+{
+  int length = this->_webServer->readUri(NULL, 0);
+  char* uri = (char*)this->_arena.allocate(length + 1);
+  if (uri == NULL)
+  {
+    return "";
+  }
+  this->_webServer->readUri(uri, length + 1);
+  return uri;
+}
+
+/**
+ * Host header of the request copied to the arena.
+ */
+const char* ESPWIFI::arenaHostHeader()
+{
+  int length = this->_webServer->readHostHeader(NULL, 0);
+  char* host = (char*)this->_arena.allocate(length + 1);
+  if (host == NULL)
+  {
+    return "";
+  }
+  this->_webServer->readHostHeader(host, length + 1);
+  return host;
+}
+
+void ESPWIFI::writeConfigPageTail(IotWebConfPageWriter* writer)
+{
+  this->writeHtmlPart(
+      writer, IOTWEBCONF_HTML_FORM_END,
+      &IotWebConfHtmlFormatProvider::getFormEnd);
+
+  if (this->hasUpdateServer())
+  {
+    const char* values[] = {this->_updatePath};
+    this->writeHtmlPart(
+        writer, IOTWEBCONF_HTML_UPDATE,
+        &IotWebConfHtmlFormatProvider::getUpdate, "u", values);
+  }
+
+  // -- Fill config version string;
+  const char* values[] = {this->_configVersion};
+  this->writeHtmlPart(
+      writer, IOTWEBCONF_HTML_CONFIG_VER,
+      &IotWebConfHtmlFormatProvider::getConfigVer, "v", values);
+
+  this->writeHtmlPart(
+      writer, IOTWEBCONF_HTML_END, &IotWebConfHtmlFormatProvider::getEnd);
+}
+
+/**
+ * Send the page head to the client taken over from the current request. As
+ * the length of the page is not known in advance, the connection is closed at
+ * the end of the page.
+ */
+void ESPWIFI::startConfigPage()
+{
+  {
+    IotWebConfPageWriter writer(&_renderClient);
+    this->writeStreamHeader(&writer, "text/html; charset=UTF-8");
+    this->writeConfigPageHead(&writer);
+  }
+  this->_renderParameter = this->_firstParameter;
+  this->_renderStep = IOTWEBCONF_RENDER_PARAMETERS;
+  _renderOwner = this;
+}
+
+void ESPWIFI::continueConfigPage()
+{
+  if (!_renderClient.connected())
+  {
+    IOTWEBCONF_DEBUG_LINE(F("Client left, page rendering aborted."));
+    this->stopConfigPage();
+    return;
+  }
+  IotWebConfPageWriter writer(&_renderClient);
+  while ((this->_renderParameter != NULL) && this->hasLoopBudget())
+  {
+    IotWebConfArenaScope arenaScope(&this->_arena);
+    this->writeConfigParameter(&writer, this->_renderParameter, false);
+    this->_renderParameter = this->_renderParameter->_nextParameter;
+  }
+  if (this->_renderParameter == NULL)
+  {
+    this->writeConfigPageTail(&writer);
+    writer.flush();
+    _renderClient.stop();
+    this->stopConfigPage();
+  }
+}
+
+void ESPWIFI::stopConfigPage()
+{
+  _renderClient = WiFiClient();
+  _renderOwner = NULL;
+  this->_renderStep = IOTWEBCONF_RENDER_IDLE;
+}
+
+void ESPWIFI::readParamValue(
+    const char* paramName, char* target, unsigned int len)
+{
+  if (this->_webServer->readArg(paramName, target, len) < 0)
+  {
+    target[0] = '\0';
+  }
+  IOTWEBCONF_LOG_DEBUG_TEXT(F("Arg received: "), paramName);
+}
+
+boolean ESPWIFI::validateForm()
+{
+  // -- Clean previous error messages.
+  IotWebConfParameter* current = this->_firstParameter;
+  while (current != NULL)
+  {
+    current->errorMessage = NULL;
+    current = current->_nextParameter;
+  }
+
+  // -- Call external validator.
+  boolean valid = true;
+  if (this->_formValidator)
+  {
+    valid = this->_formValidator();
+  }
+
+  // -- Internal validation.
+  int l = this->_webServer->argLength(this->_thingNameParameter.getId());
+  if (3 > l)
+  {
+    this->_thingNameParameter.errorMessage =
+        "Give a name with at least 3 characters.";
+    valid = false;
+  }
+  l = this->_webServer->argLength(this->_apPasswordParameter.getId());
+  if ((0 < l) && (l < 8))
+  {
+    this->_apPasswordParameter.errorMessage =
+        "Password length must be at least 8 characters.";
+    valid = false;
+  }
+  l = this->_webServer->argLength(this->_wifiPasswordParameter.getId());
+  if ((0 < l) && (l < 8))
+  {
+    this->_wifiPasswordParameter.errorMessage =
+        "Password length must be at least 8 characters.";
+    valid = false;
+  }
+#ifdef IOTWEBCONF_CONFIG_USE_STATIC_IP
+  IotWebConfParameter* ipParameters[] = {
+      &this->_staticIpParameter, &this->_staticGatewayParameter,
+      &this->_staticNetmaskParameter, &this->_staticDnsParameter};
+  for (byte i = 0; i < 4; i++)
+  {
+    IotWebConfArenaScope arenaScope(&this->_arena);
+    const char* value = this->arenaArg(ipParameters[i]->getId());
+    IPAddress ip;
+    if ((value[0] != '\0') && !ip.fromString(value))
+    {
+      ipParameters[i]->errorMessage = "Not a valid IP address.";
+      valid = false;
+    }
+  }
+  if ((this->_webServer->argLength(this->_staticIpParameter.getId()) > 0) &&
+      (this->_webServer->argLength(this->_staticGatewayParameter.getId()) == 0))
+  {
+    this->_staticGatewayParameter.errorMessage =
+        "Gateway is required for static IP.";
+    valid = false;
+  }
+#endif
+
+  return valid;
+}
+
+void ESPWIFI::handleNotFound()
+{
+  IOTWEBCONF_HEAP_TRACK(IOTWEBCONF_HANDLER_NOT_FOUND);
+  IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_NOT_FOUND);
+  IOTWEBCONF_METRIC_ADD(httpRequests[IOTWEBCONF_HANDLER_NOT_FOUND], 1);
+  if (this->handleCaptivePortal())
+  {
+    // If captive portal redirect instead of displaying the error page.
+    return;
+  }
+  IotWebConfArenaScope arenaScope(&this->_arena);
+  IOTWEBCONF_LOG_INFO_TEXT(
+      F("Requested non-existing page: "), this->arenaUri());
+  this->writeStreamHeader("text/plain", 404);
+#ifndef IOTWEBCONF_NOT_FOUND_DETAILS_MAX_LEN
+  this->_webServer->write((const uint8_t*)"File Not Found\n", 15);
+#else
+  size_t remaining = IOTWEBCONF_NOT_FOUND_DETAILS_MAX_LEN;
+  char number[8];
+  writeCapped(this->_webServer, "File Not Found\n\nURI: ", &remaining);
+  writeCapped(this->_webServer, this->arenaUri(), &remaining);
+  writeCapped(this->_webServer, "\nMethod: ", &remaining);
+  writeCapped(
+      this->_webServer, (this->_webServer->method() == HTTP_GET) ? "GET" : "POST",
+      &remaining);
+  writeCapped(this->_webServer, "\nArguments: ", &remaining);
+  snprintf(number, sizeof(number), "%d\n", this->_webServer->args());
+  writeCapped(this->_webServer, number, &remaining);
+  for (int i = 0; (i < this->_webServer->args()) && (remaining > 0); i++)
+  {
+    writeCapped(this->_webServer, " ", &remaining);
+    writeCapped(this->_webServer, this->_webServer->argName(i).c_str(), &remaining);
+    writeCapped(this->_webServer, ": ", &remaining);
+    writeCapped(this->_webServer, this->_webServer->arg(i).c_str(), &remaining);
+    writeCapped(this->_webServer, "\n", &remaining);
+  }
+#endif
+  this->_webServer->endStream();
+}
+
+/**
+ * Connectivity check URLs of the common operating systems. When we are
+ * online, the expected answer is sent, otherwise the client is redirected to
+ * the portal.
+ */
+typedef struct IotWebConfProbe
+{
+  const char* path;
+  int status;
+  const char* contentType;
+  const char* body;
+} IotWebConfProbe;
+
+static const char IOTWEBCONF_PROBE_APPLE_SUCCESS[] =
+    "<HTML><HEAD><TITLE>Success</TITLE></HEAD><BODY>Success</BODY></HTML>";
+static const IotWebConfProbe IOTWEBCONF_PROBES[] = {
+    {"/generate_204", 204, NULL, NULL},
+    {"/gen_204", 204, NULL, NULL},
+    {"/hotspot-detect.html", 200, "text/html", IOTWEBCONF_PROBE_APPLE_SUCCESS},
+    {"/library/test/success.html", 200, "text/html", IOTWEBCONF_PROBE_APPLE_SUCCESS},
+    {"/connecttest.txt", 200, "text/plain", "Microsoft Connect Test"},
+    {"/ncsi.txt", 200, "text/plain", "Microsoft NCSI"},
+    {"/success.txt", 200, "text/plain", "success\n"},
+};
+#define IOTWEBCONF_PROBE_COUNT \
+  (sizeof(IOTWEBCONF_PROBES) / sizeof(IOTWEBCONF_PROBES[0]))
+
+/**
+ * Returns the index of the probe with the provided path, or -1.
+ */
+static int8_t findProbe(const char* path, size_t length)
+{
+  static IotWebConfPathTable probeTable;
+  if (probeTable.getCount() == 0)
+  {
+    for (byte i = 0; i < IOTWEBCONF_PROBE_COUNT; i++)
+    {
+      probeTable.add(IOTWEBCONF_PROBES[i].path);
+    }
+  }
+  return probeTable.find(path, length);
+}
+
+/**
+ * Redirect to captive portal if we got a request for another domain.
+ * Return true in that case so the page handler do not try to handle the request
+ * again. (Code from WifiManager project.)
+ */
+boolean ESPWIFI::handleCaptivePortal()
+{
+  IOTWEBCONF_HEAP_TRACK(IOTWEBCONF_HANDLER_CAPTIVE);
+  IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_CAPTIVE);
+  IotWebConfArenaScope arenaScope(&this->_arena);
+  const char* uri = this->arenaUri();
+  int8_t probe = findProbe(uri, strlen(uri));
+  if (probe >= 0)
+  {
+    IOTWEBCONF_METRIC_ADD(httpRequests[IOTWEBCONF_HANDLER_CAPTIVE], 1);
+    if (this->_state == IOTWEBCONF_STATE_ONLINE)
+    {
+      this->sendProbeResponse(probe);
+    }
+    else
+    {
+      this->sendPortalRedirect();
+    }
+    return true;
+  }
+
+  const char* host = this->arenaHostHeader();
+  if (!isIp(host) && !this->isThingHost(host))
+  {
+    IOTWEBCONF_LOG_DEBUG_TEXT(F("Redirected request for: "), host);
+    IOTWEBCONF_METRIC_ADD(httpRequests[IOTWEBCONF_HANDLER_CAPTIVE], 1);
+    this->sendPortalRedirect();
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Responses are written directly to the client from a stack buffer, so no
+ * memory is allocated. The connection is closed after the response.
+ */
+void ESPWIFI::sendPortalRedirect()
+{
+  IPAddress ip = this->_webServer->localIP();
+  char response[128];
+  int length = snprintf(
+      response, sizeof(response),
+      "HTTP/1.1 302 Found\r\n"
+      "Location: http://%u.%u.%u.%u/\r\n"
+      "Content-Length: 0\r\n"
+      "Connection: close\r\n\r\n",
+      ip[0], ip[1], ip[2], ip[3]);
+  this->_webServer->write((const uint8_t*)response, length);
+  this->_webServer->close();
+}
+
+void ESPWIFI::sendProbeResponse(int8_t probe)
+{
+  const IotWebConfProbe* entry = &IOTWEBCONF_PROBES[probe];
+  char response[192];
+  int length;
+  if (entry->body == NULL)
+  {
+    length = snprintf(
+        response, sizeof(response),
+        "HTTP/1.1 %d No Content\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n",
+        entry->status);
+  }
+  else
+  {
+    length = snprintf(
+        response, sizeof(response),
+        "HTTP/1.1 %d OK\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %u\r\n"
+        "Connection: close\r\n\r\n%s",
+        entry->status, entry->contentType, (unsigned int)strlen(entry->body),
+        entry->body);
+  }
+  this->_webServer->write((const uint8_t*)response, length);
+  this->_webServer->close();
+}
+
+/** Is this an IP? */
+boolean ESPWIFI::isIp(const char* str)
+{
+  for (; *str != '\0'; str++)
+  {
+    if (*str != '.' && (*str < '0' || *str > '9'))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/** Does the host start with the thing name? (Case insensitive.) */
+boolean ESPWIFI::isThingHost(const char* host)
+{
+  for (const char* name = this->_thingName; *name != '\0'; name++, host++)
+  {
+    if (tolower(*host) != tolower(*name))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
+void ESPWIFI::delay(unsigned long m)
+{
+  unsigned long delayStart = millis();
+  while (m > millis() - delayStart)
+  {
+    this->doLoop();
+    delay(1); // -- Note: 1ms might not be enough to perform a full yield. So
+              // 'yeild' in 'doLoop' is eventually a good idea.
+  }
+}
+
+void ESPWIFI::doLoop(unsigned long budgetUs)
+{
+  this->_loopStartUs = micros();
+  this->_loopBudgetUs = budgetUs;
+  IOTWEBCONF_METRIC_ADD(loopIterations, 1);
+
+  this->loopStep();
+
+  this->_lastLoopDurationUs = micros() - this->_loopStartUs;
+#ifdef IOTWEBCONF_CONFIG_USE_PROFILER
+  this->_profiler.add(IOTWEBCONF_PROFILE_LOOP, this->_lastLoopDurationUs);
+#endif
+  if (this->_maxLoopDurationUs < this->_lastLoopDurationUs)
+  {
+    this->_maxLoopDurationUs = this->_lastLoopDurationUs;
+  }
+}
+
+boolean ESPWIFI::hasLoopBudget()
+{
+  return (this->_loopBudgetUs == 0) ||
+      (micros() - this->_loopStartUs < this->_loopBudgetUs);
+}
+
+void ESPWIFI::loopStep()
+{
+  {
+    IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_TIMERS);
+    this->_timerWheel.process(millis());
+  }
+  yield(); // -- Yield should not be necessary, but cannot hurt eather.
+
+  // -- Continue work split into steps by previous passes.
+  if (this->_saveStep == IOTWEBCONF_SAVE_COMMIT)
+  {
+    // -- Flash commit takes a full pass.
+    this->continueConfigSave();
+    return;
+  }
+  if (this->_saveStep != IOTWEBCONF_SAVE_IDLE)
+  {
+    this->continueConfigSave();
+  }
+  if (this->_renderStep != IOTWEBCONF_RENDER_IDLE)
+  {
+    this->continueConfigPage();
+  }
+  if (!this->hasLoopBudget())
+  {
+    return;
+  }
+#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
+  // -- Log is printed only as long as Serial output does not block.
+  while (IotWebConfLog::hasPending() &&
+         (Serial.availableForWrite() > IOTWEBCONF_LOG_LINE_LEN))
+  {
+    IotWebConfLog::drain(&Serial, 1);
+  }
+#endif
+
+  if (this->_state == IOTWEBCONF_STATE_BOOT)
+  {
+    // -- After boot, fall immediately to AP mode.
+    byte startupState = IOTWEBCONF_STATE_AP_MODE;
+    if (this->_skipApStartup)
+    {
+      if (isWifiModePossible())
+      {
+        IOTWEBCONF_DEBUG_LINE(
+            F("SkipApStartup is requested, but either no WiFi was set up, or "
+              "configButton was pressed."));
+      }
+      else
+      {
+        // -- Startup state can be WiFi, if it is requested and also possible.
+        IOTWEBCONF_DEBUG_LINE(F("SkipApStartup mode was applied"));
+        startupState = IOTWEBCONF_STATE_CONNECTING;
+      }
+    }
+    this->changeState(
+        startupState,
+        this->_forceDefaultPassword ? IOTWEBCONF_REASON_CONFIG_PIN
+                                    : IOTWEBCONF_REASON_BOOT);
+  }
+  else if (
+      (this->_state == IOTWEBCONF_STATE_NOT_CONFIGURED) ||
+      (this->_state == IOTWEBCONF_STATE_AP_MODE))
+  {
+    // -- We must only leave the AP mode, when no slaves are connected.
+    // -- Other than that AP mode has a timeout. E.g. after boot, or when retry
+    // connecting to WiFi
+    checkConnection();
+    checkApProbe();
+    checkNetworkScan();
+    if (this->_state == IOTWEBCONF_STATE_CONNECTING)
+    {
+      // -- Probe found the network.
+      return;
+    }
+    checkApTimeout();
+    this->processDns();
+    if (this->hasLoopBudget())
+    {
+      IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_HTTP);
+      this->_webServer->handleClient();
+    }
+  }
+  else if (this->_state == IOTWEBCONF_STATE_CONNECTING)
+  {
+    if (checkWifiConnection())
+    {
+      this->changeState(IOTWEBCONF_STATE_ONLINE, IOTWEBCONF_REASON_CONNECTED);
+      return;
+    }
+    if (this->_apKept)
+    {
+      // -- Portal is still available on the AP while connecting.
+      this->processDns();
+      if (this->hasLoopBudget())
+      {
+        IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_HTTP);
+        this->_webServer->handleClient();
+      }
+    }
+  }
+  else if (this->_state == IOTWEBCONF_STATE_ONLINE)
+  {
+    // -- In server mode we provide web interface. And check whether it is time
+    // to run the client.
+    if (this->_apKept)
+    {
+      this->processDns();
+    }
+    {
+      IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_HTTP);
+      this->_webServer->handleClient();
+    }
+    if (WiFi.status() != WL_CONNECTED)
+    {
+      IOTWEBCONF_DEBUG_LINE(F("Not connected. Try reconnect..."));
+      this->changeState(
+          IOTWEBCONF_STATE_CONNECTING, IOTWEBCONF_REASON_DISCONNECT);
+      return;
+    }
+    this->checkRoamingScan();
+#ifdef IOTWEBCONF_CONFIG_USE_PULL_UPDATE
+    this->processPullUpdate();
+#endif
+  }
+}
+
+#ifdef IOTWEBCONF_CONFIG_USE_PULL_UPDATE
+void ESPWIFI::processPullUpdate()
+{
+  byte state = this->_pullUpdate.getState();
+  if ((state == IOTWEBCONF_PULL_IDLE) || (state == IOTWEBCONF_PULL_DONE) ||
+      (state == IOTWEBCONF_PULL_FAILED) || !this->hasLoopBudget())
+  {
+    return;
+  }
+  state = this->_pullUpdate.process(IOTWEBCONF_PULL_CHUNK_SIZE);
+  if (state == IOTWEBCONF_PULL_DONE)
+  {
+    IOTWEBCONF_DEBUG_LINE(F("Pull update finished, rebooting."));
+    // -- Not our delay(), that would run doLoop() again.
+    ::delay(100);
+    ESP.restart();
+  }
+  else if (state == IOTWEBCONF_PULL_FAILED)
+  {
+    IOTWEBCONF_DEBUG_LINE(F("Pull update failed."));
+  }
+}
+#endif
+
+/**
+ * What happens, when a state changed...
+ */
+void ESPWIFI::changeState(byte newState, byte reason)
+{
+  switch (newState)
+  {
+    case IOTWEBCONF_STATE_AP_MODE:
+    {
+      // -- In AP mode we must override the default AP password. Otherwise we stay
+      // in STATE_NOT_CONFIGURED.
+      if (isWifiModePossible())
+      {
+        if (this->_forceDefaultPassword)
+        {
+          IOTWEBCONF_LOG_INFO(F("AP mode forced by reset pin"));
+        }
+        else
+        {
+          IOTWEBCONF_LOG_INFO(F("AP password was not set in configuration"));
+        }
+        newState = IOTWEBCONF_STATE_NOT_CONFIGURED;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  IOTWEBCONF_LOG_INFO_VALUE(F("State changing from: "), this->_state);
+  byte oldState = this->_state;
+#ifdef IOTWEBCONF_CONFIG_USE_METRICS
+  unsigned long now = millis();
+  this->_metrics.stateMs[oldState] += now - this->_metrics.stateEnteredMs;
+  this->_metrics.stateEnteredMs = now;
+#endif
+  IotWebConfTrace::record(
+      oldState, newState, reason,
+      WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0);
+  this->_state = newState;
+  this->stateChanged(oldState, newState);
+  IOTWEBCONF_LOG_INFO_VALUE(F("State changed to: "), newState);
+}
+
+/**
+ * What happens, when a state changed...
+ */
+void ESPWIFI::stateChanged(byte oldState, byte newState)
+{
+//  updateOutput();
+  this->stopTimer(&this->_apTimeoutTimer);
+  this->stopTimer(&this->_wifiConnectionTimer);
+  this->stopTimer(&this->_apTeardownTimer);
+  this->stopApProbe();
+  this->stopNetworkScan();
+  this->stopTimer(&this->_roamingTimer);
+  this->stopRoamingScan();
+  switch (newState)
+  {
+    case IOTWEBCONF_STATE_AP_MODE:
+    case IOTWEBCONF_STATE_NOT_CONFIGURED:
+      if (newState == IOTWEBCONF_STATE_AP_MODE)
+      {
+        this->blinkInternal(300, 90);
+      }
+      else
+      {
+        this->blinkInternal(300, 50);
+      }
+      setupAp();
+      if (this->hasUpdateServer())
+      {
+        this->_updateServer->setup(this->_server, this->_updatePath);
+#ifdef ESP32
+        this->_updateServer->setAuthenticator([this]() {
+          if (this->_state != IOTWEBCONF_STATE_ONLINE)
+          {
+            return true;
+          }
+          if (!this->authenticate(&this->_syncServer))
+          {
+            return false;
+          }
+          this->sendSessionCookie(&this->_syncServer);
+          return true;
+        });
+#endif
+      }
+      this->_webServer->begin();
+      this->_apConnectionStatus = IOTWEBCONF_AP_CONNECTION_STATE_NC;
+      this->_apStartTimeMs = millis();
+      this->_apTimedOut = false;
+      this->startTimer(&this->_apTimeoutTimer, this->_apTimeoutMs);
+      this->_apProbeResult = IOTWEBCONF_AP_PROBE_UNKNOWN;
+      this->startNetworkScan();
+      if ((newState == IOTWEBCONF_STATE_AP_MODE) &&
+          (this->_apProbeIntervalMs > 0))
+      {
+        this->startTimer(
+            &this->_apProbeTimer, this->_apProbeIntervalMs,
+            this->_apProbeIntervalMs);
+      }
+      break;
+    case IOTWEBCONF_STATE_CONNECTING:
+      this->_apProbeSkips = 0;
+      if ((oldState == IOTWEBCONF_STATE_AP_MODE) ||
+          (oldState == IOTWEBCONF_STATE_NOT_CONFIGURED))
+      {
+        if (this->_keepApWhileConnecting)
+        {
+          // -- Station is started next to the running AP.
+          WiFi.mode(WIFI_AP_STA);
+          this->_apKept = true;
+        }
+        else
+        {
+          stopAp();
+        }
+      }
+      this->blinkInternal(1000, 50);
+      IOTWEBCONF_LOG_INFO_TEXT(F("Connecting to: "), this->_wifiAuthInfo.ssid);
+      this->_wifiConnectionTimedOut = false;
+      this->startTimer(
+          &this->_wifiConnectionTimer, this->_wifiConnectionTimeoutMs);
+      this->applyIpConfig();
+      this->_connectStartMs = millis();
+      IOTWEBCONF_METRIC_ADD(connectAttempts, 1);
+      // -- A roam connects to the selected access point. (See
+      // getConnectBssid().)
+      _connectBssid = this->_roaming ? this->_roamBssid : NULL;
+      _connectChannel = this->_roaming ? this->_roamChannel : 0;
+      this->_wifiConnectionHandler(
+          this->_wifiAuthInfo.ssid, this->_wifiAuthInfo.password);
+      _connectBssid = NULL;
+      _connectChannel = 0;
+      break;
+    case IOTWEBCONF_STATE_ONLINE:
+      this->blinkInternal(8000, 2);
+      // -- The network list is only shown by the portal.
+      this->dropNetworks();
+      if (this->hasUpdateServer())
+      {
+        this->_updateServer->updateCredentials(
+            IOTWEBCONF_ADMIN_USER_NAME, this->_apPassword);
+      }
+      this->_webServer->begin();
+      if (this->_apKept)
+      {
+        // -- AP is only stopped, when the station link proved to be stable.
+        this->startTimer(
+            &this->_apTeardownTimer, IOTWEBCONF_AP_STA_STABLE_LINK_MS);
+      }
+      this->_roaming = false;
+      if (this->_roamingPolicy.isEnabled())
+      {
+        this->_roamingPolicy.resetAverage();
+        this->startTimer(
+            &this->_roamingTimer, IOTWEBCONF_ROAMING_SAMPLE_MS,
+            IOTWEBCONF_ROAMING_SAMPLE_MS);
+      }
+      IOTWEBCONF_DEBUG_LINE(F("Accepting connection"));
+      if (this->_wifiConnectionCallback)
+      {
+        this->_wifiConnectionCallback();
+      }
+      break;
+    default:
+      break;
+  }
 
-void ESPWIFI::delay(unsigned long m)
+  this->updateReachability(
+      (newState != IOTWEBCONF_STATE_CONNECTING) || this->_apKept);
+}
+
+/**
+ * Measures the time windows, the config portal was not reachable.
+ */
+void ESPWIFI::updateReachability(boolean reachable)
 {
-  unsigned long delayStart = millis();
-  while (m > millis() - delayStart)
+  unsigned long now = millis();
+  if (!reachable && !this->_unreachable)
   {
-    this->doLoop();
-    delay(1); // -- Note: 1ms might not be enough to perform a full yield. So
-              // 'yeild' in 'doLoop' is eventually a good idea.
+    this->_unreachable = true;
+    this->_unreachableStartMs = now;
+  }
+  else if (reachable && this->_unreachable)
+  {
+    this->_unreachable = false;
+    this->_lastUnreachableMs = now - this->_unreachableStartMs;
+    this->_totalUnreachableMs += this->_lastUnreachableMs;
+    if (this->_maxUnreachableMs < this->_lastUnreachableMs)
+    {
+      this->_maxUnreachableMs = this->_lastUnreachableMs;
+    }
   }
 }
 
-void ESPWIFI::doLoop()
+void ESPWIFI::teardownKeptAp()
 {
-  doBlink();
-  yield(); // -- Yield should not be necessary, but cannot hurt eather.
-  if (this->_state == IOTWEBCONF_STATE_BOOT)
+  if ((this->_state == IOTWEBCONF_STATE_ONLINE) &&
+      (WiFi.status() == WL_CONNECTED))
   {
-    // -- After boot, fall immediately to AP mode.
-    byte startupState = IOTWEBCONF_STATE_AP_MODE;
-    if (this->_skipApStartup)
+    IOTWEBCONF_DEBUG_LINE(F("Station link is stable, stopping AP."));
+    this->stopDns();
+    stopAp();
+    this->_apKept = false;
+  }
+}
+
+void ESPWIFI::checkApTimeout()
+{
+  if (this->isApLeavePossible())
+  {
+    // -- Only move on, when we have a valid WifF and AP configured.
+    if (this->_apConnectionStatus == IOTWEBCONF_AP_CONNECTION_STATE_DC)
     {
-      if (isWifiModePossible())
+      this->changeState(
+          IOTWEBCONF_STATE_CONNECTING, IOTWEBCONF_REASON_AP_CLIENT_LEFT);
+    }
+    else if (
+        this->_apTimedOut &&
+        (this->_apConnectionStatus != IOTWEBCONF_AP_CONNECTION_STATE_C))
+    {
+      if ((this->_apProbeResult == IOTWEBCONF_AP_PROBE_NOT_VISIBLE) &&
+          (this->_apProbeSkips < IOTWEBCONF_AP_PROBE_MAX_SKIPS))
       {
-        IOTWEBCONF_DEBUG_LINE(
-            F("SkipApStartup is requested, but either no WiFi was set up, or "
-              "configButton was pressed."));
+        // -- No reason to try a network not seen by the last scan. (Still,
+        // a hidden network is tried after some skips.)
+        IOTWEBCONF_DEBUG_LINE(F("Network not visible, staying in AP mode."));
+        this->_apProbeSkips += 1;
+        this->_apTimedOut = false;
+        this->startTimer(&this->_apTimeoutTimer, this->_apTimeoutMs);
       }
       else
       {
-        // -- Startup state can be WiFi, if it is requested and also possible.
-        IOTWEBCONF_DEBUG_LINE(F("SkipApStartup mode was applied"));
-        startupState = IOTWEBCONF_STATE_CONNECTING;
+        this->changeState(
+            IOTWEBCONF_STATE_CONNECTING, IOTWEBCONF_REASON_AP_TIMEOUT);
       }
     }
-    this->changeState(startupState);
   }
-  else if (
-      (this->_state == IOTWEBCONF_STATE_NOT_CONFIGURED) ||
-      (this->_state == IOTWEBCONF_STATE_AP_MODE))
+}
+
+/**
+ * Called by the probe timer, starts an asynchronous scan for the configured
+ * network, when no one is using our AP.
+ */
+void ESPWIFI::startApProbe()
+{
+  if (this->_apProbeScanning || this->_networkScanning ||
+      (this->_apConnectionStatus == IOTWEBCONF_AP_CONNECTION_STATE_C) ||
+      !this->isApLeavePossible())
   {
-    // -- We must only leave the AP mode, when no slaves are connected.
-    // -- Other than that AP mode has a timeout. E.g. after boot, or when retry
-    // connecting to WiFi
-    checkConnection();
-    checkApTimeout();
-    this->_dnsServer->processNextRequest();
-    this->_server->handleClient();
+    return;
   }
-  else if (this->_state == IOTWEBCONF_STATE_CONNECTING)
+  IOTWEBCONF_DEBUG_LINE(F("Probing for configured network."));
+  WiFi.scanNetworks(true);
+  this->_apProbeScanning = true;
+}
+
+void ESPWIFI::stopApProbe()
+{
+  this->stopTimer(&this->_apProbeTimer);
+  if (this->_apProbeScanning)
   {
-    if (checkWifiConnection())
+    this->_apProbeScanning = false;
+    WiFi.scanDelete();
+  }
+}
+
+/**
+ * Checks the result of a probe scan. When the configured network is visible,
+ * we do not wait for the AP timeout.
+ */
+void ESPWIFI::checkApProbe()
+{
+  if (!this->_apProbeScanning)
+  {
+    return;
+  }
+  int8_t count = WiFi.scanComplete();
+  if (count == WIFI_SCAN_RUNNING)
+  {
+    return;
+  }
+  this->_apProbeScanning = false;
+  if (count < 0)
+  {
+    return;
+  }
+
+  boolean found = false;
+  for (int8_t i = 0; i < count; i++)
+  {
+    if (strcmp(WiFi.SSID(i).c_str(), this->_wifiAuthInfo.ssid) == 0)
     {
-      this->changeState(IOTWEBCONF_STATE_ONLINE);
-      return;
+      found = true;
+      break;
     }
   }
-  else if (this->_state == IOTWEBCONF_STATE_ONLINE)
+  this->cacheNetworks(count);
+  WiFi.scanDelete();
+
+  this->_apProbeResult =
+      found ? IOTWEBCONF_AP_PROBE_VISIBLE : IOTWEBCONF_AP_PROBE_NOT_VISIBLE;
+  if (found &&
+      (this->_apConnectionStatus != IOTWEBCONF_AP_CONNECTION_STATE_C))
   {
-    // -- In server mode we provide web interface. And check whether it is time
-    // to run the client.
-    this->_server->handleClient();
-    if (WiFi.status() != WL_CONNECTED)
+    IOTWEBCONF_DEBUG_LINE(F("Configured network is visible."));
+    this->changeState(
+        IOTWEBCONF_STATE_CONNECTING, IOTWEBCONF_REASON_NETWORK_VISIBLE);
+  }
+}
+
+/**
+ * Background scan for the network list of the config portal. (Probe scans
+ * also refresh the list.)
+ */
+void ESPWIFI::startNetworkScan()
+{
+  if (this->_apProbeScanning || this->_networkScanning ||
+      this->_roamingScanning)
+  {
+    return;
+  }
+  WiFi.scanNetworks(true);
+  this->_networkScanning = true;
+}
+
+void ESPWIFI::checkNetworkScan()
+{
+  if (!this->_networkScanning)
+  {
+    return;
+  }
+  int8_t count = WiFi.scanComplete();
+  if (count == WIFI_SCAN_RUNNING)
+  {
+    return;
+  }
+  this->_networkScanning = false;
+  if (count >= 0)
+  {
+    this->cacheNetworks(count);
+  }
+  WiFi.scanDelete();
+}
+
+void ESPWIFI::stopNetworkScan()
+{
+  if (this->_networkScanning)
+  {
+    this->_networkScanning = false;
+    WiFi.scanDelete();
+  }
+}
+
+/**
+ * Keeps the strongest networks, each SSID once, ordered by RSSI. The list is
+ * allocated with the first scan, things that never open the portal do not
+ * keep it.
+ */
+void ESPWIFI::cacheNetworks(int8_t count)
+{
+  this->_networkCount = 0;
+  if (this->_networks == NULL)
+  {
+    this->_networks = (IotWebConfNetwork*)malloc(
+        sizeof(IotWebConfNetwork) * IOTWEBCONF_NETWORK_CACHE_SIZE);
+    if (this->_networks == NULL)
     {
-      IOTWEBCONF_DEBUG_LINE(F("Not connected. Try reconnect..."));
-      this->changeState(IOTWEBCONF_STATE_CONNECTING);
       return;
     }
   }
+  for (int8_t i = 0; i < count; i++)
+  {
+    String ssid = WiFi.SSID(i);
+    int32_t rssi = WiFi.RSSI(i);
+    if ((ssid.length() == 0) || (ssid.length() >= IOTWEBCONF_WORD_LEN))
+    {
+      continue;
+    }
+
+    // -- A duplicate is only kept with its strongest RSSI.
+    byte pos;
+    for (pos = 0; pos < this->_networkCount; pos++)
+    {
+      if (strcmp(this->_networks[pos].ssid, ssid.c_str()) == 0)
+      {
+        break;
+      }
+    }
+    if (pos < this->_networkCount)
+    {
+      if (this->_networks[pos].rssi >= rssi)
+      {
+        continue;
+      }
+    }
+    else if (this->_networkCount < IOTWEBCONF_NETWORK_CACHE_SIZE)
+    {
+      pos = this->_networkCount++;
+    }
+    else if (this->_networks[pos - 1].rssi < rssi)
+    {
+      pos = this->_networkCount - 1;
+    }
+    else
+    {
+      continue;
+    }
+
+    // -- Move the entry up to its place.
+    while ((pos > 0) && (this->_networks[pos - 1].rssi < rssi))
+    {
+      this->_networks[pos] = this->_networks[pos - 1];
+      pos--;
+    }
+    IotWebConfNetwork* network = &this->_networks[pos];
+    strncpy(network->ssid, ssid.c_str(), IOTWEBCONF_WORD_LEN);
+    network->rssi = rssi;
+#ifdef ESP8266
+    network->secure = WiFi.encryptionType(i) != ENC_TYPE_NONE;
+#elif defined(ESP32)
+    network->secure = WiFi.encryptionType(i) != WIFI_AUTH_OPEN;
+#endif
+  }
+  this->_networksUpdatedMs = millis();
+}
+
+/**
+ * Copy of the text HTML or JSON escaped, allocated from the arena.
+ */
+static const char* escapeText(
+    IotWebConfArena* arena, const char* text, boolean json)
+{
+  // -- First pass measures, second pass writes.
+  char* target = NULL;
+  size_t length = 0;
+  for (byte pass = 0; pass < 2; pass++)
+  {
+    length = 0;
+    for (const char* c = text; *c != '\0'; c++)
+    {
+      const char* escaped = NULL;
+      if (json && ((*c == '"') || (*c == '\\')))
+      {
+        escaped = *c == '"' ? "\\\"" : "\\\\";
+      }
+      else if (json && ((unsigned char)*c < 0x20))
+      {
+        escaped = " ";
+      }
+      else if (!json && (*c == '<'))
+      {
+        escaped = "&lt;";
+      }
+      else if (!json && (*c == '>'))
+      {
+        escaped = "&gt;";
+      }
+      else if (!json && (*c == '&'))
+      {
+        escaped = "&amp;";
+      }
+      else if (!json && (*c == '"'))
+      {
+        escaped = "&quot;";
+      }
+      else if (!json && (*c == '\''))
+      {
+        escaped = "&#39;";
+      }
+      size_t count = escaped == NULL ? 1 : strlen(escaped);
+      if (target != NULL)
+      {
+        memcpy(target + length, escaped == NULL ? c : escaped, count);
+      }
+      length += count;
+    }
+    if (target == NULL)
+    {
+      target = (char*)arena->allocate(length + 1);
+      if (target == NULL)
+      {
+        return "";
+      }
+    }
+  }
+  target[length] = '\0';
+  return target;
+}
+
+/**
+ * Write the cached network list. A new scan is started in the background,
+ * when the list is old, so the page is never delayed with scanning.
+ */
+void ESPWIFI::writeNetworks(IotWebConfPageWriter* writer)
+{
+  if ((this->_state != IOTWEBCONF_STATE_AP_MODE) &&
+      (this->_state != IOTWEBCONF_STATE_NOT_CONFIGURED))
+  {
+    return;
+  }
+  if ((this->_networksUpdatedMs == 0) ||
+      (IOTWEBCONF_NETWORK_MAX_AGE_MS < millis() - this->_networksUpdatedMs))
+  {
+    this->startNetworkScan();
+  }
+  for (byte i = 0; i < this->_networkCount; i++)
+  {
+    IotWebConfArenaScope arenaScope(&this->_arena);
+    IotWebConfNetwork* network = &this->_networks[i];
+    int quality = 2 * (network->rssi + 100);
+    quality = quality < 0 ? 0 : quality > 100 ? 100 : quality;
+    char qualityText[4];
+    snprintf(qualityText, sizeof(qualityText), "%d", quality);
+    const char* values[] = {
+        escapeText(&this->_arena, network->ssid, false), qualityText,
+        network->secure ? " &#128274;" : ""};
+    this->writeHtmlPart(
+        writer, IOTWEBCONF_HTML_NETWORK,
+        &IotWebConfHtmlFormatProvider::getNetwork, "sql", values);
+  }
+}
+
+void ESPWIFI::handleLog()
+{
+  IOTWEBCONF_HEAP_TRACK(IOTWEBCONF_HANDLER_LOG);
+  IOTWEBCONF_METRIC_ADD(httpRequests[IOTWEBCONF_HANDLER_LOG], 1);
+  if (this->handleCaptivePortal())
+  {
+    return;
+  }
+  if ((this->_state == IOTWEBCONF_STATE_ONLINE) &&
+      !this->authenticate(this->_webServer))
+  {
+    this->_webServer->requestAuthentication();
+    return;
+  }
+  this->writeStreamHeader("text/plain");
+  char line[IOTWEBCONF_LOG_LINE_LEN + 1];
+  for (unsigned long sequence = IotWebConfLog::getFirstSequence();
+       sequence < IotWebConfLog::getNextSequence(); sequence++)
+  {
+    if (IotWebConfLog::format(sequence, line, sizeof(line) - 1))
+    {
+      size_t length = strlen(line);
+      line[length++] = '\n';
+      this->_webServer->write((const uint8_t*)line, length);
+    }
+  }
+  this->_webServer->endStream();
+}
+
+void ESPWIFI::handleTrace()
+{
+  IOTWEBCONF_HEAP_TRACK(IOTWEBCONF_HANDLER_TRACE);
+  IOTWEBCONF_METRIC_ADD(httpRequests[IOTWEBCONF_HANDLER_TRACE], 1);
+  if (this->handleCaptivePortal())
+  {
+    return;
+  }
+  if ((this->_state == IOTWEBCONF_STATE_ONLINE) &&
+      !this->authenticate(this->_webServer))
+  {
+    this->_webServer->requestAuthentication();
+    return;
+  }
+  this->writeStreamHeader("text/plain");
+  char line[80];
+  int length = snprintf(line, sizeof(line), "boot,ms,from,to,reason,rssi,heap\n");
+  this->_webServer->write((const uint8_t*)line, length);
+  for (byte i = 0; i < IotWebConfTrace::getCount(); i++)
+  {
+    const IotWebConfTraceRecord* record = IotWebConfTrace::get(i);
+    char reason[24];
+    strncpy_P(
+        reason, (PGM_P)IotWebConfTrace::reasonName(record->reason),
+        sizeof(reason));
+    reason[sizeof(reason) - 1] = '\0';
+    length = snprintf(
+        line, sizeof(line), "%u,%lu,%u,%u,%s,%d,%lu\n", record->boot,
+        (unsigned long)record->timeMs, record->oldState, record->newState,
+        reason, record->rssi, (unsigned long)record->freeHeap);
+    this->_webServer->write((const uint8_t*)line, length);
+  }
+  this->_webServer->endStream();
+}
+
+void ESPWIFI::dropNetworks()
+{
+  free(this->_networks);
+  this->_networks = NULL;
+  this->_networkCount = 0;
+  this->_networksUpdatedMs = 0;
+}
+
+void ESPWIFI::handleNetworks()
+{
+  IOTWEBCONF_HEAP_TRACK(IOTWEBCONF_HANDLER_NETWORKS);
+  IOTWEBCONF_METRIC_ADD(httpRequests[IOTWEBCONF_HANDLER_NETWORKS], 1);
+  if (this->handleCaptivePortal())
+  {
+    return;
+  }
+  // -- Scan results are only processed by the portal, in other states the
+  // list is not refreshed. (It is dropped, when going online.)
+  if (((this->_state == IOTWEBCONF_STATE_AP_MODE) ||
+       (this->_state == IOTWEBCONF_STATE_NOT_CONFIGURED)) &&
+      ((this->_networksUpdatedMs == 0) ||
+       (IOTWEBCONF_NETWORK_MAX_AGE_MS < millis() - this->_networksUpdatedMs)))
+  {
+    this->startNetworkScan();
+  }
+  this->writeStreamHeader("application/json");
+  char line[IOTWEBCONF_WORD_LEN * 2 + 48];
+  int length = snprintf(
+      line, sizeof(line), "{\"ageMs\":%ld,\"scanning\":%s,\"networks\":[",
+      this->_networksUpdatedMs == 0
+          ? -1
+          : (long)(millis() - this->_networksUpdatedMs),
+      this->_networkScanning ? "true" : "false");
+  this->_webServer->write((const uint8_t*)line, length);
+  for (byte i = 0; i < this->_networkCount; i++)
+  {
+    IotWebConfArenaScope arenaScope(&this->_arena);
+    IotWebConfNetwork* network = &this->_networks[i];
+    length = snprintf(
+        line, sizeof(line), "%s{\"ssid\":\"%s\",\"rssi\":%d,\"secure\":%s}",
+        i == 0 ? "" : ",", escapeText(&this->_arena, network->ssid, true),
+        network->rssi, network->secure ? "true" : "false");
+    this->_webServer->write((const uint8_t*)line, length);
+  }
+  this->_webServer->write((const uint8_t*)"]}", 2);
+  this->_webServer->endStream();
 }
 
+#ifdef IOTWEBCONF_CONFIG_USE_METRICS
 /**
- * What happens, when a state changed...
+ * Metrics are written line by line as they are formatted, so the response
+ * does not need a buffer. The response ends with closing the connection.
  */
-void ESPWIFI::changeState(byte newState)
+void ESPWIFI::handleMetrics()
 {
-  switch (newState)
+  IOTWEBCONF_HEAP_TRACK(IOTWEBCONF_HANDLER_METRICS);
+  IOTWEBCONF_METRIC_ADD(httpRequests[IOTWEBCONF_HANDLER_METRICS], 1);
+  if (this->handleCaptivePortal())
   {
-    case IOTWEBCONF_STATE_AP_MODE:
+    return;
+  }
+  if ((this->_state == IOTWEBCONF_STATE_ONLINE) &&
+      !this->authenticate(this->_webServer))
+  {
+    this->_webServer->requestAuthentication();
+    return;
+  }
+  IotWebConfServer* server = this->_webServer;
+  IotWebConfMetrics* metrics = &this->_metrics;
+  this->writeStreamHeader("text/plain; version=0.0.4");
+
+  writeMetric(
+      server, "# TYPE iwc_connect_attempts_total counter\n"
+      "iwc_connect_attempts_total %lu\n",
+      (unsigned long)metrics->connectAttempts);
+  writeMetric(
+      server, "# TYPE iwc_connect_successes_total counter\n"
+      "iwc_connect_successes_total %lu\n",
+      (unsigned long)metrics->connectSuccesses);
+  writeMetric(
+      server, "# TYPE iwc_connect_duration_seconds summary\n"
+      "iwc_connect_duration_seconds_sum %lu.%03u\n"
+      "iwc_connect_duration_seconds_count %lu\n",
+      (unsigned long)(metrics->connectMs / 1000),
+      (unsigned int)(metrics->connectMs % 1000),
+      (unsigned long)metrics->connectSuccesses);
+
+  writeMetric(server, "# TYPE iwc_state gauge\n");
+  for (byte i = 0; i <= IOTWEBCONF_STATE_ONLINE; i++)
+  {
+    writeMetric(
+        server, "iwc_state{state=\"%s\"} %d\n", IOTWEBCONF_METRICS_STATES[i],
+        this->_state == i ? 1 : 0);
+  }
+  writeMetric(server, "# TYPE iwc_state_seconds_total counter\n");
+  for (byte i = 0; i <= IOTWEBCONF_STATE_ONLINE; i++)
+  {
+    uint64_t ms = metrics->stateMs[i];
+    if (this->_state == i)
     {
-      // -- In AP mode we must override the default AP password. Otherwise we stay
-      // in STATE_NOT_CONFIGURED.
-      if (isWifiModePossible())
-      {
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-        if (this->_forceDefaultPassword)
-        {
-          Serial.println("AP mode forced by reset pin");
-        }
-        else
-        {
-          Serial.println("AP password was not set in configuration");
-        }
-#endif
-        newState = IOTWEBCONF_STATE_NOT_CONFIGURED;
-      }
-      break;
+      ms += millis() - metrics->stateEnteredMs;
     }
-    default:
-      break;
+    writeMetric(
+        server, "iwc_state_seconds_total{state=\"%s\"} %lu.%03u\n",
+        IOTWEBCONF_METRICS_STATES[i], (unsigned long)(ms / 1000),
+        (unsigned int)(ms % 1000));
   }
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-  Serial.print("State changing from: ");
-  Serial.print(this->_state);
-  Serial.print(" to ");
-  Serial.println(newState);
-#endif
-  byte oldState = this->_state;
-  this->_state = newState;
-  this->stateChanged(oldState, newState);
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-  Serial.print("State changed from: ");
-  Serial.print(oldState);
-  Serial.print(" to ");
-  Serial.println(newState);
-#endif
-}
 
-/**
- * What happens, when a state changed...
- */
-void ESPWIFI::stateChanged(byte oldState, byte newState)
-{
-//  updateOutput();
-  switch (newState)
+  boolean apActive = (this->_state == IOTWEBCONF_STATE_AP_MODE) ||
+      (this->_state == IOTWEBCONF_STATE_NOT_CONFIGURED) || this->_apKept;
+  writeMetric(
+      server, "# TYPE iwc_ap_clients gauge\n"
+      "iwc_ap_clients %d\n"
+      "# TYPE iwc_ap_client_connections_total counter\n"
+      "iwc_ap_client_connections_total %lu\n",
+      apActive ? WiFi.softAPgetStationNum() : 0,
+      (unsigned long)metrics->apClientConnections);
+  writeMetric(
+      server, "# TYPE iwc_config_saves_total counter\n"
+      "iwc_config_saves_total %lu\n"
+      "# TYPE iwc_flash_commits_total counter\n"
+      "iwc_flash_commits_total %lu\n",
+      (unsigned long)metrics->configSaves,
+      (unsigned long)metrics->flashCommits);
+
+  writeMetric(server, "# TYPE iwc_http_requests_total counter\n");
+  for (byte i = 0; i < IOTWEBCONF_HANDLER_COUNT; i++)
   {
-    case IOTWEBCONF_STATE_AP_MODE:
-    case IOTWEBCONF_STATE_NOT_CONFIGURED:
-      if (newState == IOTWEBCONF_STATE_AP_MODE)
-      {
-        this->blinkInternal(300, 90);
-      }
-      else
-      {
-        this->blinkInternal(300, 50);
-      }
-      setupAp();
-      if (this->_updateServer != NULL)
-      {
-        this->_updateServer->setup(this->_server, this->_updatePath);
-      }
-      this->_server->begin();
-      this->_apConnectionStatus = IOTWEBCONF_AP_CONNECTION_STATE_NC;
-      this->_apStartTimeMs = millis();
-      break;
-    case IOTWEBCONF_STATE_CONNECTING:
-      if ((oldState == IOTWEBCONF_STATE_AP_MODE) ||
-          (oldState == IOTWEBCONF_STATE_NOT_CONFIGURED))
-      {
-        stopAp();
-      }
-      this->blinkInternal(1000, 50);
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-      Serial.print("Connecting to [");
-      Serial.print(this->_wifiAuthInfo.ssid);
-# ifdef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
-      Serial.print("] with password [");
-      Serial.print(this->_wifiAuthInfo.password);
-      Serial.println("]");
-# else
-      Serial.println(F("] (password is hidden)"));
-# endif
-#endif
-      this->_wifiConnectionStart = millis();
-      this->_wifiConnectionHandler(
-          this->_wifiAuthInfo.ssid, this->_wifiAuthInfo.password);
-      break;
-    case IOTWEBCONF_STATE_ONLINE:
-      this->blinkInternal(8000, 2);
-      if (this->_updateServer != NULL)
-      {
-        this->_updateServer->updateCredentials(
-            IOTWEBCONF_ADMIN_USER_NAME, this->_apPassword);
-      }
-      this->_server->begin();
-      IOTWEBCONF_DEBUG_LINE(F("Accepting connection"));
-      if (this->_wifiConnectionCallback != NULL)
-      {
-        this->_wifiConnectionCallback();
-      }
-      break;
-    default:
-      break;
+    writeMetric(
+        server, "iwc_http_requests_total{handler=\"%s\"} %lu\n",
+        IOTWEBCONF_METRICS_HANDLERS[i],
+        (unsigned long)metrics->httpRequests[i]);
+  }
+
+  uint32_t freeHeap;
+  uint32_t largestBlock;
+  IotWebConfHeapTracker::sample(&freeHeap, &largestBlock);
+  writeMetric(
+      server, "# TYPE iwc_heap_free_bytes gauge\n"
+      "iwc_heap_free_bytes %lu\n"
+      "# TYPE iwc_heap_largest_block_bytes gauge\n"
+      "iwc_heap_largest_block_bytes %lu\n",
+      (unsigned long)freeHeap, (unsigned long)largestBlock);
+#ifdef IOTWEBCONF_CONFIG_USE_HEAP_TRACKER
+  IotWebConfHeapTracker* tracker = &this->_heapTracker;
+  writeMetric(
+      server, "# TYPE iwc_heap_min_free_bytes gauge\n"
+      "iwc_heap_min_free_bytes %lu\n"
+      "# TYPE iwc_heap_min_largest_block_bytes gauge\n"
+      "iwc_heap_min_largest_block_bytes %lu\n"
+      "# TYPE iwc_heap_max_fragmentation_percent gauge\n"
+      "iwc_heap_max_fragmentation_percent %u\n",
+      (unsigned long)tracker->getMinFreeHeap(),
+      (unsigned long)tracker->getMinLargestBlock(),
+      tracker->getMaxFragmentation());
+  writeMetric(server, "# TYPE iwc_http_heap_retained_bytes_total counter\n");
+  for (byte i = 0; i < IOTWEBCONF_HANDLER_COUNT; i++)
+  {
+    writeMetric(
+        server, "iwc_http_heap_retained_bytes_total{handler=\"%s\"} %lu\n",
+        IOTWEBCONF_METRICS_HANDLERS[i],
+        (unsigned long)tracker->getUsage(i)->retainedBytes);
   }
+#endif
+  writeMetric(
+      server, "# TYPE iwc_arena_peak_bytes gauge\n"
+      "iwc_arena_peak_bytes %lu\n"
+      "# TYPE iwc_arena_overflows_total counter\n"
+      "iwc_arena_overflows_total %lu\n",
+      (unsigned long)this->_arena.getPeak(),
+      (unsigned long)this->_arena.getOverflowCount());
+  writeMetric(
+      server, "# TYPE iwc_loop_iterations_total counter\n"
+      "iwc_loop_iterations_total %lu\n"
+      "# TYPE iwc_loop_duration_max_seconds gauge\n"
+      "iwc_loop_duration_max_seconds %lu.%06lu\n",
+      (unsigned long)metrics->loopIterations,
+      this->_maxLoopDurationUs / 1000000, this->_maxLoopDurationUs % 1000000);
+  server->endStream();
 }
+#endif
 
-void ESPWIFI::checkApTimeout()
+#ifdef IOTWEBCONF_CONFIG_USE_PROFILER
+void ESPWIFI::handleProfile()
 {
-  if ((this->_wifiSsid[0] != '\0') && (this->_apPassword[0] != '\0') &&
-      (!this->_forceDefaultPassword))
+  if (this->handleCaptivePortal())
   {
-    // -- Only move on, when we have a valid WifF and AP configured.
-    if ((this->_apConnectionStatus == IOTWEBCONF_AP_CONNECTION_STATE_DC) ||
-        ((this->_apTimeoutMs < millis() - this->_apStartTimeMs) &&
-         (this->_apConnectionStatus != IOTWEBCONF_AP_CONNECTION_STATE_C)))
+    return;
+  }
+  if ((this->_state == IOTWEBCONF_STATE_ONLINE) &&
+      !this->authenticate(this->_webServer))
+  {
+    this->_webServer->requestAuthentication();
+    return;
+  }
+  IotWebConfServer* server = this->_webServer;
+  this->writeStreamHeader("text/plain");
+
+  // -- A line is formatted at a time, bucket columns are named by their upper
+  // limits.
+  char line[IOTWEBCONF_PROFILE_BUCKETS * 11 + 64];
+  size_t length = snprintf(line, sizeof(line), "phase,count,sum_s,max_us");
+  for (byte i = 0; i < IOTWEBCONF_PROFILE_BUCKETS - 1; i++)
+  {
+    length += snprintf(
+        line + length, sizeof(line) - length, ",<%lu",
+        IotWebConfProfiler::bucketLimitUs(i));
+  }
+  length += snprintf(line + length, sizeof(line) - length, ",more\n");
+  server->write((const uint8_t*)line, length);
+  for (byte phase = 0; phase < IOTWEBCONF_PROFILE_COUNT; phase++)
+  {
+    const IotWebConfHistogram* histogram = this->_profiler.getHistogram(phase);
+    length = snprintf(
+        line, sizeof(line), "%s,%lu,%lu.%06lu,%lu",
+        IotWebConfProfiler::phaseName(phase), (unsigned long)histogram->count,
+        (unsigned long)(histogram->sumUs / 1000000),
+        (unsigned long)(histogram->sumUs % 1000000),
+        (unsigned long)histogram->maxUs);
+    for (byte i = 0; i < IOTWEBCONF_PROFILE_BUCKETS; i++)
     {
-      this->changeState(IOTWEBCONF_STATE_CONNECTING);
+      length += snprintf(
+          line + length, sizeof(line) - length, ",%lu",
+          (unsigned long)histogram->buckets[i]);
     }
+    length += snprintf(line + length, sizeof(line) - length, "\n");
+    server->write((const uint8_t*)line, length);
   }
+  server->endStream();
 }
+#endif
 
 /**
  * Checks whether we have anyone joined to our AP.
@@ -938,6 +2389,7 @@ void ESPWIFI::checkConnection()
       (WiFi.softAPgetStationNum() > 0))
   {
     this->_apConnectionStatus = IOTWEBCONF_AP_CONNECTION_STATE_C;
+    IOTWEBCONF_METRIC_ADD(apClientConnections, 1);
     IOTWEBCONF_DEBUG_LINE(F("Connection to AP."));
   }
   else if (
@@ -958,81 +2410,367 @@ boolean ESPWIFI::checkWifiConnection()
 {
   if (WiFi.status() != WL_CONNECTED)
   {
-    if (this->_wifiConnectionTimeoutMs < millis() - this->_wifiConnectionStart)
+    if (this->_wifiConnectionTimedOut)
     {
       // -- WiFi not available, fall back to AP mode.
       IOTWEBCONF_DEBUG_LINE(F("Giving up."));
       WiFi.disconnect(true);
+      if (this->_roaming)
+      {
+        // -- Selected access point is not available, connect the usual way.
+        this->_roaming = false;
+        this->changeState(
+            IOTWEBCONF_STATE_CONNECTING, IOTWEBCONF_REASON_CONNECT_TIMEOUT);
+        return false;
+      }
+      if (this->_ipPath == IOTWEBCONF_IP_PATH_LEASE)
+      {
+        // -- Remembered lease might be the reason, do not use it again.
+        this->leaseDrop();
+      }
       IotWebConfWifiAuthInfo* newWifiAuthInfo = _wifiConnectionFailureHandler();
       if (newWifiAuthInfo != NULL)
       {
         // -- Try connecting with another connection info.
         this->_wifiAuthInfo.ssid = newWifiAuthInfo->ssid;
         this->_wifiAuthInfo.password = newWifiAuthInfo->password;
-        this->changeState(IOTWEBCONF_STATE_CONNECTING);
+        this->changeState(
+            IOTWEBCONF_STATE_CONNECTING, IOTWEBCONF_REASON_RETRY);
       }
       else
       {
-        this->changeState(IOTWEBCONF_STATE_AP_MODE);
+        this->changeState(
+            IOTWEBCONF_STATE_AP_MODE, IOTWEBCONF_REASON_CONNECT_TIMEOUT);
       }
     }
     return false;
   }
 
   // -- Connected
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-  Serial.println("WiFi connected");
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
-#endif
+  if ((this->_ipPath == IOTWEBCONF_IP_PATH_LEASE) &&
+      (memcmp(WiFi.BSSID(), this->_lease.bssid, sizeof(this->_lease.bssid)) != 0))
+  {
+    // -- Lease is only valid for the access point it was received from.
+    IOTWEBCONF_DEBUG_LINE(F("Connected to another AP, falling back to DHCP."));
+    this->leaseDrop();
+    WiFi.disconnect();
+    this->changeState(IOTWEBCONF_STATE_CONNECTING, IOTWEBCONF_REASON_WRONG_AP);
+    return false;
+  }
+  this->_connectDurationMs[this->_ipPath] = millis() - this->_connectStartMs;
+  IOTWEBCONF_METRIC_ADD(connectSuccesses, 1);
+  IOTWEBCONF_METRIC_ADD(connectMs, this->_connectDurationMs[this->_ipPath]);
+  IOTWEBCONF_LOG_INFO_TEXT(
+      F("WiFi connected, IP address: "), WiFi.localIP().toString().c_str());
+  IOTWEBCONF_LOG_INFO_VALUE(
+      F("Connected in (ms): "), this->_connectDurationMs[this->_ipPath]);
+  if (this->_rememberLease && (this->_ipPath == IOTWEBCONF_IP_PATH_DHCP))
+  {
+    this->leaseSave();
+  }
+
+  return true;
+}
+
+/**
+ * Select the way of acquiring the IP address before connecting: static
+ * settings have priority over a remembered lease, DHCP is the fallback.
+ */
+void ESPWIFI::applyIpConfig()
+{
+  if (this->applyStaticIpConfig())
+  {
+    this->_ipPath = IOTWEBCONF_IP_PATH_STATIC;
+  }
+  else if (
+      this->_rememberLease && isLeaseSane(&this->_lease) &&
+      (!this->_roaming ||
+       (memcmp(this->_roamBssid, this->_lease.bssid, sizeof(this->_roamBssid)) == 0)))
+  {
+    IOTWEBCONF_DEBUG_LINE(F("Using remembered lease."));
+    WiFi.config(
+        IPAddress(this->_lease.ip[0], this->_lease.ip[1], this->_lease.ip[2], this->_lease.ip[3]),
+        IPAddress(this->_lease.gateway[0], this->_lease.gateway[1], this->_lease.gateway[2], this->_lease.gateway[3]),
+        IPAddress(this->_lease.mask[0], this->_lease.mask[1], this->_lease.mask[2], this->_lease.mask[3]),
+        IPAddress(this->_lease.dns[0], this->_lease.dns[1], this->_lease.dns[2], this->_lease.dns[3]));
+    this->_ipConfigured = true;
+    this->_ipPath = IOTWEBCONF_IP_PATH_LEASE;
+  }
+  else
+  {
+    if (this->_ipConfigured)
+    {
+      // -- Zero addresses turn DHCP back on.
+      WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+      this->_ipConfigured = false;
+    }
+    this->_ipPath = IOTWEBCONF_IP_PATH_DHCP;
+  }
+}
 
+boolean ESPWIFI::applyStaticIpConfig()
+{
+#ifdef IOTWEBCONF_CONFIG_USE_STATIC_IP
+  IPAddress ip;
+  IPAddress gateway;
+  IPAddress mask;
+  IPAddress dns;
+  if ((this->_staticIp[0] == '\0') || !ip.fromString(this->_staticIp) ||
+      !gateway.fromString(this->_staticGateway) ||
+      !mask.fromString(this->_staticNetmask))
+  {
+    return false;
+  }
+  if (!dns.fromString(this->_staticDns))
+  {
+    dns = gateway;
+  }
+  IOTWEBCONF_DEBUG_LINE(F("Using static IP."));
+  WiFi.config(ip, gateway, mask, dns);
+  this->_ipConfigured = true;
   return true;
+#else
+  return false;
+#endif
+}
+
+void ESPWIFI::leaseLoad()
+{
+  this->readEepromValue(
+      this->_leaseStart, (char*)&this->_lease, sizeof(IotWebConfLease));
+  if (!isLeaseSane(&this->_lease))
+  {
+    this->_lease.marker = 0;
+  }
+}
+
+void ESPWIFI::leaseSave()
+{
+  IotWebConfLease lease;
+  lease.marker = IOTWEBCONF_LEASE_MARKER;
+  memcpy(lease.bssid, WiFi.BSSID(), sizeof(lease.bssid));
+  IPAddress ip = WiFi.localIP();
+  IPAddress gateway = WiFi.gatewayIP();
+  IPAddress mask = WiFi.subnetMask();
+  IPAddress dns = WiFi.dnsIP();
+  for (byte i = 0; i < 4; i++)
+  {
+    lease.ip[i] = ip[i];
+    lease.gateway[i] = gateway[i];
+    lease.mask[i] = mask[i];
+    lease.dns[i] = dns[i];
+  }
+  if (!isLeaseSane(&lease) ||
+      (memcmp(&lease, &this->_lease, sizeof(IotWebConfLease)) == 0))
+  {
+    // -- Nothing to do, spare the flash.
+    return;
+  }
+  IOTWEBCONF_DEBUG_LINE(F("Remembering lease."));
+  this->_lease = lease;
+  this->writeEepromValue(
+      this->_leaseStart, (char*)&this->_lease, sizeof(IotWebConfLease));
+  EEPROM.commit();
+  IOTWEBCONF_METRIC_ADD(flashCommits, 1);
+}
+
+void ESPWIFI::leaseDrop()
+{
+  if (this->_lease.marker == 0)
+  {
+    return;
+  }
+  IOTWEBCONF_DEBUG_LINE(F("Dropping remembered lease."));
+  this->_lease.marker = 0;
+  EEPROM.write(this->_leaseStart, 0);
+  EEPROM.commit();
+  IOTWEBCONF_METRIC_ADD(flashCommits, 1);
+}
+
+/**
+ * A lease is usable, if it has an address, a contiguous netmask, and the
+ * gateway is on the same subnet.
+ */
+boolean ESPWIFI::isLeaseSane(IotWebConfLease* lease)
+{
+  if (lease->marker != IOTWEBCONF_LEASE_MARKER)
+  {
+    return false;
+  }
+  uint32_t ip = 0;
+  uint32_t gateway = 0;
+  uint32_t mask = 0;
+  for (byte i = 0; i < 4; i++)
+  {
+    ip = (ip << 8) | lease->ip[i];
+    gateway = (gateway << 8) | lease->gateway[i];
+    mask = (mask << 8) | lease->mask[i];
+  }
+  if ((ip == 0) || (mask == 0) || (((~mask + 1) & ~mask) != 0))
+  {
+    return false;
+  }
+  return (ip & mask) == (gateway & mask);
+}
+
+/**
+ * Called by the roaming timer while online. Updates the smoothed RSSI, and
+ * starts a background scan, when the signal is weak.
+ */
+void ESPWIFI::sampleRssi()
+{
+  this->_roamingPolicy.addSample(WiFi.RSSI());
+  unsigned long now = millis();
+  // -- A scan already running for the network list is not interrupted.
+  if (!this->_roamingScanning && !this->_networkScanning &&
+      this->_roamingPolicy.isScanDue(now))
+  {
+    IOTWEBCONF_DEBUG_LINE(F("Weak signal, looking for a better AP."));
+    WiFi.scanNetworks(true);
+    this->_roamingScanning = true;
+    this->_roamingPolicy.scanStarted(now);
+  }
+}
+
+void ESPWIFI::stopRoamingScan()
+{
+  if (this->_roamingScanning)
+  {
+    this->_roamingScanning = false;
+    WiFi.scanDelete();
+  }
+}
+
+/**
+ * Checks the result of the roaming scan, and switches to a clearly better
+ * access point of the same network, if there is any.
+ */
+void ESPWIFI::checkRoamingScan()
+{
+  if (!this->_roamingScanning)
+  {
+    return;
+  }
+  int8_t count = WiFi.scanComplete();
+  if (count == WIFI_SCAN_RUNNING)
+  {
+    return;
+  }
+  this->_roamingScanning = false;
+  if (count < 0)
+  {
+    return;
+  }
+
+  uint8_t currentBssid[6];
+  memcpy(currentBssid, WiFi.BSSID(), sizeof(currentBssid));
+  int32_t bestRssi = 0;
+  int8_t best = -1;
+  for (int8_t i = 0; i < count; i++)
+  {
+    int32_t rssi = WiFi.RSSI(i);
+    if (this->_roamingPolicy.isBetter(rssi) &&
+        ((best < 0) || (rssi > bestRssi)) &&
+        (strcmp(WiFi.SSID(i).c_str(), this->_wifiAuthInfo.ssid) == 0) &&
+        (memcmp(WiFi.BSSID(i), currentBssid, sizeof(currentBssid)) != 0))
+    {
+      best = i;
+      bestRssi = rssi;
+    }
+  }
+  if (best >= 0)
+  {
+    memcpy(this->_roamBssid, WiFi.BSSID(best), sizeof(this->_roamBssid));
+    this->_roamChannel = WiFi.channel(best);
+  }
+  WiFi.scanDelete();
+
+  if (best >= 0)
+  {
+    IOTWEBCONF_LOG_INFO_VALUE(F("Roaming to a better AP with RSSI "), bestRssi);
+    this->_roaming = true;
+    this->_roamingPolicy.roamed(millis());
+    this->changeState(IOTWEBCONF_STATE_CONNECTING, IOTWEBCONF_REASON_ROAMING);
+  }
 }
 
 void ESPWIFI::setupAp()
 {
+  IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_SETUP_AP);
   WiFi.mode(WIFI_AP);
+  this->_apKept = false;
 
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-  Serial.print("Setting up AP: ");
-  Serial.println(this->_thingName);
-#endif
+  IOTWEBCONF_LOG_INFO_TEXT(F("Setting up AP: "), this->_thingName);
   if (this->_state == IOTWEBCONF_STATE_NOT_CONFIGURED)
   {
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-    Serial.print("With default password: ");
-# ifdef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
-    Serial.println(this->_initialApPassword);
-# else
-    Serial.println(F("<hidden>"));
-# endif
+#ifdef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
+    IOTWEBCONF_LOG_DEBUG_TEXT(
+        F("With default password: "), this->_initialApPassword);
+#else
+    IOTWEBCONF_LOG_DEBUG(F("With default password"));
 #endif
     this->_apConnectionHandler(this->_thingName, this->_initialApPassword);
   }
   else
   {
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-    Serial.print("Use password: ");
-# ifdef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
-    Serial.println(this->_apPassword);
-# else
-    Serial.println(F("<hidden>"));
-# endif
+#ifdef IOTWEBCONF_DEBUG_PWD_TO_SERIAL
+    IOTWEBCONF_LOG_DEBUG_TEXT(F("Use password: "), this->_apPassword);
 #endif
     this->_apConnectionHandler(this->_thingName, this->_apPassword);
   }
 
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-  Serial.print(F("AP IP address: "));
-  Serial.println(WiFi.softAPIP());
-#endif
+  IOTWEBCONF_LOG_INFO_TEXT(
+      F("AP IP address: "), WiFi.softAPIP().toString().c_str());
   //  delay(500); // Without delay I've seen the IP address blank
   //  Serial.print(F("AP IP address: "));
   //  Serial.println(WiFi.softAPIP());
 
-  /* Setup the DNS server redirecting all the domains to the apIP */
+  this->startDns();
+}
+
+/**
+ * Setup the DNS server redirecting all the domains to the apIP
+ */
+void ESPWIFI::startDns()
+{
+#ifdef IOTWEBCONF_CONFIG_USE_DNS_RESPONDER
+  this->_dnsResponder.start(IOTWEBCONF_DNS_PORT, WiFi.softAPIP());
+#else
   this->_dnsServer->setErrorReplyCode(DNSReplyCode::NoError);
   this->_dnsServer->start(IOTWEBCONF_DNS_PORT, "*", WiFi.softAPIP());
+#endif
+}
+
+void ESPWIFI::stopDns()
+{
+#ifdef IOTWEBCONF_CONFIG_USE_DNS_RESPONDER
+  this->_dnsResponder.stop();
+#else
+  this->_dnsServer->stop();
+#endif
+}
+
+/**
+ * Queries arriving in a burst (e.g. when a phone joins) are all answered in
+ * one pass, so they are not queued behind page requests.
+ */
+void ESPWIFI::processDns()
+{
+  IOTWEBCONF_PROFILE(IOTWEBCONF_PROFILE_DNS);
+#ifdef IOTWEBCONF_CONFIG_USE_DNS_RESPONDER
+  byte count = 0;
+  while ((count < IOTWEBCONF_DNS_BATCH_SIZE) &&
+         this->_dnsResponder.processNextRequest())
+  {
+    count += 1;
+    if (!this->hasLoopBudget())
+    {
+      break;
+    }
+  }
+#else
+  this->_dnsServer->processNextRequest();
+#endif
 }
 
 void ESPWIFI::stopAp()
@@ -1075,20 +2813,17 @@ void ESPWIFI::blinkInternal(unsigned long repeatMs, byte dutyCyclePercent)
   this->_internalBlinkOffMs = this->_blinkOffMs;
 }
 
+/**
+ * Called by the blink timer, toggles the status LED and schedules the next
+ * toggle.
+ */
 void ESPWIFI::doBlink()
 {
-  if (IOTWEBCONF_STATUS_ENABLED)
-  {
-    unsigned long now = millis();
-    unsigned long delayMs =
-        this->_blinkState == LOW ? this->_blinkOnMs : this->_blinkOffMs;
-    if (delayMs < now - this->_lastBlinkTime)
-    {
-      this->_blinkState = 1 - this->_blinkState;
-      this->_lastBlinkTime = now;
-      digitalWrite(this->_statusPin, this->_blinkState);
-    }
-  }
+  this->_blinkState = 1 - this->_blinkState;
+  digitalWrite(this->_statusPin, this->_blinkState);
+  unsigned long delayMs =
+      this->_blinkState == LOW ? this->_blinkOnMs : this->_blinkOffMs;
+  this->startTimer(&this->_blinkTimer, delayMs);
 }
 
 boolean ESPWIFI::connectAp(const char* apName, const char* password)
@@ -1097,7 +2832,14 @@ boolean ESPWIFI::connectAp(const char* apName, const char* password)
 }
 void ESPWIFI::connectWifi(const char* ssid, const char* password)
 {
-  WiFi.begin(ssid, password);
+  if (_connectBssid != NULL)
+  {
+    WiFi.begin(ssid, password, _connectChannel, _connectBssid);
+  }
+  else
+  {
+    WiFi.begin(ssid, password);
+  }
 }
 IotWebConfWifiAuthInfo* ESPWIFI::handleConnectWifiFailure()
 {
@@ -3,6 +3,19 @@
 #define IotWebConf_h
 
 #include <IotWebConfCompatibility.h>
+#include <IotWebConfTimer.h>
+#include <IotWebConfLog.h>
+#include <IotWebConfTrace.h>
+#include <IotWebConfProfiler.h>
+#include <IotWebConfHeap.h>
+#include <IotWebConfArena.h>
+#include <IotWebConfDns.h>
+#include <IotWebConfPathTable.h>
+#include <IotWebConfPageWriter.h>
+#include <IotWebConfServer.h>
+#include <IotWebConfAsyncServer.h>
+#include <IotWebConfPullUpdate.h>
+#include <IotWebConfRoaming.h>
 
 #ifdef ESP8266
 # include <ESP8266WiFi.h>
@@ -29,33 +42,98 @@
 // to connect to a WiFi network.
 #define IOTWEBCONF_DEFAULT_AP_MODE_TIMEOUT_MS 30000
 
+// -- When AP is kept while connecting (see keepApWhileConnecting()), the AP
+// is only stopped after the station link was online for this amount of time.
+#define IOTWEBCONF_AP_STA_STABLE_LINK_MS 5000
+
+// -- When AP probing is enabled (see setApProbeIntervalMs()), AP timeout is
+// ignored this many times in a row, while the configured network is not visible.
+#define IOTWEBCONF_AP_PROBE_MAX_SKIPS 3
+
+// -- After a successful login a session cookie is issued, so later requests
+// are authenticated by a token lookup. This many sessions are kept in parallel.
+#define IOTWEBCONF_SESSION_COUNT 4
+// -- Sessions expire after this amount of inactivity.
+#define IOTWEBCONF_SESSION_TIMEOUT_MS 600000
+
+// -- Networks found by scans in AP mode are listed on the config page. At most
+// this many networks are kept, the strongest ones.
+#define IOTWEBCONF_NETWORK_CACHE_SIZE 8
+// -- A page view starts a new background scan, when the list is older.
+#define IOTWEBCONF_NETWORK_MAX_AGE_MS 30000
+
+// -- Firmware can be downloaded in the background (see startPullUpdate()) if
+// enabled. Needs the download buffers in the ESPWIFI object.
+//#define IOTWEBCONF_CONFIG_USE_PULL_UPDATE
+
+// -- Pull update receives at most this many bytes in one doLoop() pass.
+#define IOTWEBCONF_PULL_CHUNK_SIZE 1024
+
 // -- mDNS should allow you to connect to this device with a hostname provided
 // by the device. E.g. mything.local
 #define IOTWEBCONF_CONFIG_USE_MDNS
 
-// -- Logs progress information to Serial if enabled.
+// -- Captive portal DNS queries are answered by the built-in
+// IotWebConfDnsResponder if enabled, otherwise by the provided DNSServer.
+#define IOTWEBCONF_CONFIG_USE_DNS_RESPONDER
+
+// -- Maximal number of DNS queries answered in one doLoop() pass.
+#define IOTWEBCONF_DNS_BATCH_SIZE 16
+
+// -- Static IP settings (IP, gateway, netmask, DNS) will appear on the config
+// portal if enabled. Note, that this changes the layout of the stored
+// configuration, so the configVersion should also be changed.
+//#define IOTWEBCONF_CONFIG_USE_STATIC_IP
+
+// -- Progress information is logged to a RAM buffer (see IotWebConfLog.h,
+// level is selected with IOTWEBCONF_LOG_LEVEL), and the buffer is printed to
+// Serial from doLoop() if enabled, only as much as fits the Serial output
+// buffer.
 #define IOTWEBCONF_DEBUG_TO_SERIAL
 
-// -- Logs passwords to Serial if enabled.
+// -- Connectivity and resource health counters are kept, and can be served in
+// Prometheus text format by handleMetrics() if enabled.
+//#define IOTWEBCONF_CONFIG_USE_METRICS
+
+// -- Durations of the doLoop() phases and the request handlers are collected
+// in histograms (see IotWebConfProfiler.h), and can be served by handleProfile()
+// if enabled.
+//#define IOTWEBCONF_CONFIG_USE_PROFILER
+
+// -- Heap is sampled before and after the requests served by the handlers,
+// so memory kept by requests and the fragmentation of the heap can be followed
+// (see IotWebConfHeap.h) if enabled.
+//#define IOTWEBCONF_CONFIG_USE_HEAP_TRACKER
+
+// -- Not found (404) responses contain the URI and the arguments of the
+// request if enabled, limited to this amount of bytes. Otherwise a short static
+// response is sent.
+//#define IOTWEBCONF_NOT_FOUND_DETAILS_MAX_LEN 512
+
+// -- Logs passwords if enabled.
 //#define IOTWEBCONF_DEBUG_PWD_TO_SERIAL
 
-// -- Helper define for serial debug
-#ifdef IOTWEBCONF_DEBUG_TO_SERIAL
-# define IOTWEBCONF_DEBUG_LINE(MSG) Serial.println(MSG)
-#else
-# define IOTWEBCONF_DEBUG_LINE(MSG)
-#endif
+// -- Helper define for progress information.
+#define IOTWEBCONF_DEBUG_LINE(MSG) IOTWEBCONF_LOG_INFO(MSG)
 
 // -- EEPROM config starts with a special prefix of length defined here.
 #define IOTWEBCONF_CONFIG_VESION_LENGTH 4
+
+// -- Maximal length of an IP address in dotted notation.
+#define IOTWEBCONF_IP_LEN 16
+
+// -- A remembered lease is stored after the configuration, and starts with
+// this marker.
+#define IOTWEBCONF_LEASE_MARKER 0xA5
 #define IOTWEBCONF_DNS_PORT 53
 
 // -- HTML page fragments
 const char IOTWEBCONF_HTML_HEAD[] PROGMEM         = "<!DOCTYPE html><html lang=\"en\"><head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1, user-scalable=no\"/><title>{v}</title>";
 const char IOTWEBCONF_HTML_STYLE_INNER[] PROGMEM  = ".de{background-color:#ffaaaa;} .em{font-size:0.8em;color:#bb0000;padding-bottom:0px;} .c{text-align: center;} div,input{padding:5px;font-size:1em;} input{width:95%;} body{text-align: center;font-family:verdana;} button{border:0;border-radius:0.3rem;background-color:#16A1E7;color:#fff;line-height:2.4rem;font-size:1.2rem;width:100%;} fieldset{border-radius:0.3rem;margin: 0px;}";
-const char IOTWEBCONF_HTML_SCRIPT_INNER[] PROGMEM = "function c(l){document.getElementById('s').value=l.innerText||l.textContent;document.getElementById('p').focus();}";
+const char IOTWEBCONF_HTML_SCRIPT_INNER[] PROGMEM = "function c(l){document.getElementById('iwcWifiSsid').value=l.innerText||l.textContent;document.getElementById('iwcWifiPassword').focus();}";
 const char IOTWEBCONF_HTML_HEAD_END[] PROGMEM     = "</head><body>";
 const char IOTWEBCONF_HTML_BODY_INNER[] PROGMEM   = "<div style='text-align:left;display:inline-block;min-width:260px;'>";
+const char IOTWEBCONF_HTML_NETWORK[] PROGMEM     = "<div><a href='#' onclick='c(this);return false;'>{s}</a> <span style='float:right'>{q}%{l}</span></div>";
 const char IOTWEBCONF_HTML_FORM_START[] PROGMEM   = "<form action='' method='post'><fieldset><input type='hidden' name='iotSave' value='true'>";
 const char IOTWEBCONF_HTML_FORM_PARAM[] PROGMEM   = "<div class='{s}'><label for='{i}'>{b}</label><input type='{t}' id='{i}' name='{i}' maxlength={l} placeholder='{p}' value='{v}' {c}/><div class='em'>{e}</div></div>";
 const char IOTWEBCONF_HTML_FORM_END[] PROGMEM     = "</fieldset><button type='submit'>Apply</button></form>";
@@ -79,6 +157,36 @@ const char IOTWEBCONF_HTML_CONFIG_VER[] PROGMEM   = "<div style='font-size: .6em
 // -- All previous connection on AP was disconnected.
 #define IOTWEBCONF_AP_CONNECTION_STATE_DC 2
 
+// -- Result of the last background scan in AP mode.
+#define IOTWEBCONF_AP_PROBE_UNKNOWN 0
+#define IOTWEBCONF_AP_PROBE_VISIBLE 1
+#define IOTWEBCONF_AP_PROBE_NOT_VISIBLE 2
+
+// -- Steps of a config save performed over multiple doLoop() passes.
+#define IOTWEBCONF_SAVE_IDLE 0
+#define IOTWEBCONF_SAVE_WRITE 1
+#define IOTWEBCONF_SAVE_COMMIT 2
+
+// -- Steps of a config page rendered over multiple doLoop() passes.
+#define IOTWEBCONF_RENDER_IDLE 0
+#define IOTWEBCONF_RENDER_PARAMETERS 1
+
+// -- The way the IP address was acquired on the last connection.
+#define IOTWEBCONF_IP_PATH_DHCP 0
+#define IOTWEBCONF_IP_PATH_STATIC 1
+#define IOTWEBCONF_IP_PATH_LEASE 2
+#define IOTWEBCONF_IP_PATH_COUNT 3
+
+// -- Request handlers counted by metrics and the heap tracker.
+#define IOTWEBCONF_HANDLER_CONFIG 0
+#define IOTWEBCONF_HANDLER_NOT_FOUND 1
+#define IOTWEBCONF_HANDLER_CAPTIVE 2
+#define IOTWEBCONF_HANDLER_LOG 3
+#define IOTWEBCONF_HANDLER_TRACE 4
+#define IOTWEBCONF_HANDLER_NETWORKS 5
+#define IOTWEBCONF_HANDLER_METRICS 6
+#define IOTWEBCONF_HANDLER_COUNT 7
+
 // -- Status indicator output logical levels.
 #define IOTWEBCONF_STATUS_ON LOW
 #define IOTWEBCONF_STATUS_OFF HIGH
@@ -86,12 +194,70 @@ const char IOTWEBCONF_HTML_CONFIG_VER[] PROGMEM   = "<div style='font-size: .6em
 // -- User name on login.
 #define IOTWEBCONF_ADMIN_USER_NAME "admin"
 
+// -- Name of the session cookie, and the length of the session token.
+#define IOTWEBCONF_SESSION_COOKIE "IWCSESSION"
+#define IOTWEBCONF_SESSION_TOKEN_LEN 32
+// -- Buffer size for the Set-Cookie value of a session.
+#define IOTWEBCONF_SESSION_COOKIE_LEN 96
+
 typedef struct IotWebConfWifiAuthInfo
 {
   const char* ssid;
   const char* password;
 } IotWebConfWifiAuthInfo;
 
+/**
+ * For internal use only.
+ */
+typedef struct IotWebConfSession
+{
+  // -- Every word of the token is 8 hex digits of the cookie, lowest digit
+  // first. Session is free, when the first word is zero.
+  uint32_t token[IOTWEBCONF_SESSION_TOKEN_LEN / 8];
+  unsigned long lastUsedMs;
+} IotWebConfSession;
+
+/**
+ * A network found by scanning.
+ */
+typedef struct IotWebConfNetwork
+{
+  char ssid[IOTWEBCONF_WORD_LEN];
+  int8_t rssi;
+  boolean secure;
+} IotWebConfNetwork;
+
+/**
+ * Counters kept with IOTWEBCONF_CONFIG_USE_METRICS. Time of the actual state
+ * is only added to stateMs, when the state is left.
+ */
+typedef struct IotWebConfMetrics
+{
+  uint32_t connectAttempts;
+  uint32_t connectSuccesses;
+  uint64_t connectMs;
+  uint64_t stateMs[IOTWEBCONF_STATE_ONLINE + 1];
+  unsigned long stateEnteredMs;
+  uint32_t apClientConnections;
+  uint32_t configSaves;
+  uint32_t flashCommits;
+  uint32_t httpRequests[IOTWEBCONF_HANDLER_COUNT];
+  uint32_t loopIterations;
+} IotWebConfMetrics;
+
+/**
+ * Last DHCP lease as stored in the EEPROM. Addresses are in network byte order.
+ */
+typedef struct IotWebConfLease
+{
+  byte marker;
+  uint8_t bssid[6];
+  uint8_t ip[4];
+  uint8_t gateway[4];
+  uint8_t mask[4];
+  uint8_t dns[4];
+} IotWebConfLease;
+
 /**
  *   IotWebConfParameters is a configuration item of the config portal.
  *   The parameter will have its input field on the configuration page,
@@ -170,7 +336,9 @@ public:
 };
 
 /**
- * Class for providing HTML format segments.
+ * Class for providing HTML format segments. Pages of the default provider are
+ * written from flash, the Strings of these methods are only built, when a
+ * custom provider is set.
  */
 class IotWebConfHtmlFormatProvider
 {
@@ -180,6 +348,7 @@ public:
   virtual String getScript() { return "<script>" + getScriptInner() + "</script>"; }
   virtual String getHeadExtension() { return ""; }
   virtual String getHeadEnd() { return String(FPSTR(IOTWEBCONF_HTML_HEAD_END)) + getBodyInner(); }
+  virtual String getNetwork() { return FPSTR(IOTWEBCONF_HTML_NETWORK); }
   virtual String getFormStart() { return FPSTR(IOTWEBCONF_HTML_FORM_START); }
   virtual String getFormParam(const char* type) { return FPSTR(IOTWEBCONF_HTML_FORM_PARAM); }
   virtual String getFormEnd() { return FPSTR(IOTWEBCONF_HTML_FORM_END); }
@@ -193,6 +362,11 @@ protected:
   virtual String getBodyInner() { return FPSTR(IOTWEBCONF_HTML_BODY_INNER); }
 };
 
+/**
+ * A part of the page provided by IotWebConfHtmlFormatProvider.
+ */
+typedef String (IotWebConfHtmlFormatProvider::*IotWebConfHtmlPart)();
+
 /**
  * Main class of the module.
  */
@@ -238,6 +412,8 @@ public:
    * The UpdateServer will be added to the WebServer with the path provided here (or with "firmware",
    * if none was provided).
    * Login user will be IOTWEBCONF_ADMIN_USER_NAME, password is the password provided in the config portal.
+   * The UpdateServer is only available, when the WebServer is the backend of the portal. (See
+   * setServerBackend().)
    * Should be called before init()!
    *   @updateServer - An uninitialized UpdateServer instance.
    *   @updatePath - (Optional) The path to set up the UpdateServer with. Will be also used in the config portal.
@@ -245,6 +421,34 @@ public:
   void setupUpdateServer(
       HTTPUpdateServer* updateServer, const char* updatePath = "/firmware");
 
+  /**
+   * Serve requests with an other web server backend instead of the WebServer
+   * provided in the constructor. (E.g. an IotWebConfAsyncServer.)
+   * The request handlers still need to be registered to the backend by the
+   * caller. Note, that the WebServer is not started then, as two servers
+   * cannot both listen on port 80. So the UpdateServer, that needs the
+   * WebServer, is not set up, and the firmware link is not shown.
+   * Should be called before init()!
+   *   @server - The backend serving the requests.
+   */
+  void setServerBackend(IotWebConfServer* server)
+  {
+    this->_webServer = server;
+  }
+
+  /**
+   * Make a request header available by the WebServer. The WebServer only keeps
+   * the headers listed in its last collectHeaders() call, and ESPWIFI
+   * registers the headers it needs itself. So headers needed by the sketch
+   * must be added here, instead of calling collectHeaders() on the WebServer.
+   * Returns false, when there is no more space (see IOTWEBCONF_SYNC_MAX_HEADERS).
+   *   @name - Name of the header. Not copied, must outlive ESPWIFI.
+   */
+  boolean collectHeader(const char* name)
+  {
+    return this->_syncServer.collectHeader(name);
+  }
+
   /**
    * Start up the ESPWIFI module.
    * Loads all configuration from the EEPROM, and initialize the system.
@@ -256,8 +460,45 @@ public:
    * ESPWIFI is a non-blocking, state controlled system. Therefor it should be
    * regularly triggered from the user code.
    * So call this method any time you can.
+   *   @budgetUs - (Optional) Time budget of one pass in microseconds. When provided,
+   *     rendering of the config page and saving the configuration are split into
+   *     steps, and are continued in the following passes. Work not fitting into the
+   *     budget is postponed to the next pass. Note, that a single step (e.g. a flash
+   *     commit or serving one request) can still exceed the budget.
+   */
+  void doLoop(unsigned long budgetUs = 0);
+
+  /**
+   * Returns the duration of the last doLoop() pass in microseconds.
+   */
+  unsigned long getLastLoopDurationUs() { return this->_lastLoopDurationUs; }
+
+  /**
+   * Returns the longest doLoop() pass measured in microseconds since startup, or
+   * since the last call of resetMaxLoopDuration().
    */
-  void doLoop();
+  unsigned long getMaxLoopDurationUs() { return this->_maxLoopDurationUs; }
+  void resetMaxLoopDuration() { this->_maxLoopDurationUs = 0; }
+
+  /**
+   * Schedule a timer, that will be triggered from doLoop() when due. No memory is
+   * allocated, the timer instance is owned by the caller.
+   * Calling this method with an already scheduled timer will reschedule it.
+   *   @timer - The timer to be scheduled.
+   *   @delayMs - Milliseconds until the first call of the timer callback.
+   *   @periodMs - (Optional) If provided, the timer callback will be called repeatedly
+   *     with this period, until stopTimer() is called.
+   */
+  void startTimer(
+      IotWebConfTimer* timer, unsigned long delayMs, unsigned long periodMs = 0)
+  {
+    this->_timerWheel.start(timer, delayMs, periodMs);
+  }
+
+  /**
+   * Cancel a scheduled timer.
+   */
+  void stopTimer(IotWebConfTimer* timer) { this->_timerWheel.stop(timer); }
 
   /**
    * Each WebServer URL handler method should start with calling this method.
@@ -275,41 +516,105 @@ public:
    */
   void handleNotFound();
 
+  /**
+   * Log web request handler. Responds the log records kept in the log buffer
+   * as plain text.
+   */
+  void handleLog();
+
+  /**
+   * Trace web request handler. Responds the last state transitions (see
+   * IotWebConfTrace.h) as CSV, one transition per line.
+   */
+  void handleTrace();
+
+  /**
+   * Networks web request handler. Responds the networks found by the last scan
+   * as JSON. Never waits for a scan, but starts a new background scan, when the
+   * results are old.
+   */
+  void handleNetworks();
+
+#ifdef IOTWEBCONF_CONFIG_USE_METRICS
+  /**
+   * Metrics web request handler. Streams the counters in Prometheus text
+   * exposition format.
+   */
+  void handleMetrics();
+
+  /**
+   * Returns the counters kept.
+   */
+  const IotWebConfMetrics* getMetrics() { return &this->_metrics; }
+#endif
+
+#ifdef IOTWEBCONF_CONFIG_USE_PROFILER
+  /**
+   * Profile web request handler. Responds the duration histograms as CSV, one
+   * phase per line, with the count, the sum and the maximum in microseconds,
+   * and the counts of the buckets.
+   */
+  void handleProfile();
+
+  /**
+   * Returns the profiler collecting the durations. Note, that phases are
+   * nested: e.g. handler durations are also part of the http phase.
+   */
+  IotWebConfProfiler* getProfiler() { return &this->_profiler; }
+#endif
+
+  /**
+   * Returns the scratch arena used while serving requests. It is shared by
+   * all instances, as requests are served one at a time. Its peak usage and
+   * overflow count help choosing IOTWEBCONF_ARENA_SIZE.
+   */
+  IotWebConfArena* getArena() { return &this->_arena; }
+
+#ifdef IOTWEBCONF_CONFIG_USE_HEAP_TRACKER
+  /**
+   * Returns the heap tracker. Usage is kept per request handler, indexed with
+   * the IOTWEBCONF_HANDLER_* constants.
+   */
+  IotWebConfHeapTracker* getHeapTracker() { return &this->_heapTracker; }
+#endif
+
   /**
    * Specify a callback method, that will be called upon WiFi connection success.
    * Should be called before init()!
    */
-  void setWifiConnectionCallback(std::function<void()> func);
+  void setWifiConnectionCallback(IotWebConfFunction<void()> func);
 
   /**
    * Specify a callback method, that will be called when settings have been changed.
    * Should be called before init()!
    */
-  void setConfigSavedCallback(std::function<void()> func);
+  void setConfigSavedCallback(IotWebConfFunction<void()> func);
 
   /**
    * Specify a callback method, that will be called when form validation is required.
    * If the method will return false, the configuration will not be saved.
    * Should be called before init()!
    */
-  void setFormValidator(std::function<boolean()> func);
+  void setFormValidator(IotWebConfFunction<boolean()> func);
 
   /**
    * Specify your custom Access Point connection handler. Please use ESPWIFI::connectAp() as
    * reference when implementing your custom solution.
    */
   void setApConnectionHandler(
-      std::function<boolean(const char* apName, const char* password)> func)
+      IotWebConfFunction<boolean(const char* apName, const char* password)> func)
   {
     _apConnectionHandler = func;
   }
 
   /**
    * Specify your custom WiFi connection handler. Please use ESPWIFI::connectWifi() as
-   * reference when implementing your custom solution.
+   * reference when implementing your custom solution. When roaming, the handler
+   * should connect to the access point provided by getConnectBssid() and
+   * getConnectChannel().
    */
   void setWifiConnectionHandler(
-      std::function<void(const char* ssid, const char* password)> func)
+      IotWebConfFunction<void(const char* ssid, const char* password)> func)
   {
     _wifiConnectionHandler = func;
   }
@@ -323,7 +628,7 @@ public:
    * Note, that this feature is provided because of a possible future option of providing multiply
    * WiFi settings.
    */
-  void setWifiConnectionFailedHandler( std::function<IotWebConfWifiAuthInfo*()> func )
+  void setWifiConnectionFailedHandler( IotWebConfFunction<IotWebConfWifiAuthInfo*()> func )
   {
     _wifiConnectionFailureHandler = func;
   }
@@ -388,10 +693,7 @@ public:
    * This method can be used to set the AP timeout directly without modifying the apTimeoutParameter.
    * Note, that apTimeoutMs value will be reset to the value of apTimeoutParameter on init and on config save.
    */
-  void setApTimeoutMs(unsigned long apTimeoutMs)
-  {
-    this->_apTimeoutMs = apTimeoutMs;
-  };
+  void setApTimeoutMs(unsigned long apTimeoutMs);
 
   /**
    * Returns the actual value of the AP timeout in use.
@@ -416,6 +718,123 @@ public:
    */
   void skipApStartup() { this->_skipApStartup = true; }
 
+  /**
+   * By default the AP is stopped, when ESPWIFI starts connecting to the configured
+   * WiFi network, and so the config portal is not reachable until the connection
+   * succeeds or times out. Calling this method with true will keep the AP, the DNS
+   * and the config portal running in WIFI_AP_STA mode while connecting, and the AP
+   * will be stopped only after the station link was stable for
+   * IOTWEBCONF_AP_STA_STABLE_LINK_MS.
+   * Note, that in WIFI_AP_STA mode the AP must follow the channel of the station, so
+   * clients of the AP might need to reconnect.
+   * Should be called before init()!
+   */
+  void keepApWhileConnecting(boolean keepAp)
+  {
+    this->_keepApWhileConnecting = keepAp;
+  }
+
+  /**
+   * With remembered lease mode the IP settings received by DHCP are stored in the
+   * EEPROM after the configuration, and are applied as static settings on the next
+   * connection, so the DHCP exchange can be skipped. The lease is dropped (and
+   * DHCP is used again), when the connection is made to another access point
+   * (BSSID) than the lease was received from, or when a connection with the lease
+   * fails.
+   * Must be called before init()!
+   */
+  void rememberLease(boolean remember) { this->_rememberLease = remember; }
+
+  /**
+   * Returns the way the IP address was acquired on the last connection. Value is
+   * one of the IOTWEBCONF_IP_PATH_* constants.
+   */
+  byte getIpPath() { return this->_ipPath; }
+
+  /**
+   * Returns the time in milliseconds from starting the connection until having an
+   * IP address on the last connection made with the provided path.
+   *   @ipPath - One of the IOTWEBCONF_IP_PATH_* constants.
+   */
+  unsigned long getConnectDurationMs(byte ipPath)
+  {
+    return ipPath < IOTWEBCONF_IP_PATH_COUNT ? this->_connectDurationMs[ipPath] : 0;
+  }
+
+  /**
+   * Enables scanning for the configured WiFi network in the background while
+   * waiting in AP mode with no one connected to the AP. As soon as the network
+   * is seen, ESPWIFI moves on connecting without waiting for the AP timeout. And
+   * when the network was not seen, connecting on AP timeout is postponed (at most
+   * IOTWEBCONF_AP_PROBE_MAX_SKIPS times).
+   *   @intervalMs - Time between two scans. Zero disables probing (default).
+   */
+  void setApProbeIntervalMs(unsigned long intervalMs)
+  {
+    this->_apProbeIntervalMs = intervalMs;
+  }
+
+  /**
+   * Enables roaming to a stronger access point of the same network while online.
+   * RSSI is sampled and smoothed, and when it is below the threshold, the network
+   * is scanned in the background (at most once in IOTWEBCONF_ROAMING_SCAN_INTERVAL_MS).
+   * If an access point with the same SSID is found with an RSSI better with at least
+   * IOTWEBCONF_ROAMING_HYSTERESIS_DB, the connection is switched to that BSSID
+   * (at most once in IOTWEBCONF_ROAMING_MIN_INTERVAL_MS). The switch is made by
+   * the handler provided by setWifiConnectionHandler().
+   *   @rssiThreshold - Threshold in dBm (e.g. -75). Zero disables roaming (default).
+   */
+  void setRoamingRssiThreshold(int rssiThreshold)
+  {
+    this->_roamingPolicy.setRssiThreshold(rssiThreshold);
+  }
+
+  /**
+   * Returns the smoothed RSSI in dBm sampled by roaming. Zero if not available.
+   */
+  int getSmoothedRssi() { return this->_roamingPolicy.getSmoothedRssi(); }
+
+  /**
+   * Returns the number of roaming attempts made.
+   */
+  unsigned long getRoamCount() { return this->_roamingPolicy.getRoamCount(); }
+
+  /**
+   * While the WiFi connection handler is called for roaming, these return
+   * the BSSID and the channel of the access point selected. Otherwise the
+   * BSSID is NULL, and any access point of the network can be used.
+   */
+  static const uint8_t* getConnectBssid() { return _connectBssid; }
+  static int32_t getConnectChannel() { return _connectChannel; }
+
+#ifdef IOTWEBCONF_CONFIG_USE_PULL_UPDATE
+  /**
+   * Download and install a firmware image in the background, while we are
+   * online. The download is throttled to IOTWEBCONF_PULL_CHUNK_SIZE bytes per
+   * doLoop() pass, continued with Range requests after connection breaks, and
+   * the device is restarted, when the new image is installed. The image is
+   * only installed, when its SHA-256 digest matches.
+   * Returns false, if the URL or the digest is not supported (see
+   * IotWebConfPullUpdate).
+   *   @url - URL of the image, like "http://example.com/firmware.bin".
+   *   @sha256 - SHA-256 digest of the image as 64 hex digits.
+   */
+  boolean startPullUpdate(const char* url, const char* sha256)
+  {
+    return this->_pullUpdate.begin(url, sha256);
+  }
+  void stopPullUpdate() { this->_pullUpdate.stop(); }
+  IotWebConfPullUpdate* getPullUpdate() { return &this->_pullUpdate; }
+#endif
+
+  /**
+   * Metrics of the time windows, while config portal was not reachable. (That is
+   * CONNECTING state without AP.) Values are in milliseconds.
+   */
+  unsigned long getLastUnreachableMs() { return this->_lastUnreachableMs; }
+  unsigned long getMaxUnreachableMs() { return this->_maxUnreachableMs; }
+  unsigned long getTotalUnreachableMs() { return this->_totalUnreachableMs; }
+
   /**
    * Get internal parameters, for manual handling.
    * Normally you don't need to access these parameters directly.
@@ -441,6 +860,24 @@ public:
   {
     return &this->_apTimeoutParameter;
   };
+#ifdef IOTWEBCONF_CONFIG_USE_STATIC_IP
+  IotWebConfParameter* getStaticIpParameter()
+  {
+    return &this->_staticIpParameter;
+  };
+  IotWebConfParameter* getStaticGatewayParameter()
+  {
+    return &this->_staticGatewayParameter;
+  };
+  IotWebConfParameter* getStaticNetmaskParameter()
+  {
+    return &this->_staticNetmaskParameter;
+  };
+  IotWebConfParameter* getStaticDnsParameter()
+  {
+    return &this->_staticDnsParameter;
+  };
+#endif
 
   /**
    * If config parameters are modified directly, the new values can be saved by this method.
@@ -468,13 +905,16 @@ private:
   const char* _initialApPassword = NULL;
   const char* _configVersion;
   DNSServer* _dnsServer;
+#ifdef IOTWEBCONF_CONFIG_USE_DNS_RESPONDER
+  IotWebConfDnsResponder _dnsResponder;
+#endif
   WebServer* _server;
+  IotWebConfSyncServer _syncServer;
+  IotWebConfServer* _webServer = &this->_syncServer;
   HTTPUpdateServer* _updateServer = NULL;
   int _configPin = -1;
   int _statusPin = -1;
   const char* _updatePath = NULL;
-  boolean _forceDefaultPassword = false;
-  boolean _skipApStartup = false;
   IotWebConfParameter* _firstParameter = NULL;
   IotWebConfParameter _thingNameParameter;
   IotWebConfParameter _apPasswordParameter;
@@ -486,57 +926,208 @@ private:
   char _wifiSsid[IOTWEBCONF_WORD_LEN];
   char _wifiPassword[IOTWEBCONF_WORD_LEN];
   char _apTimeoutStr[IOTWEBCONF_WORD_LEN];
+#ifdef IOTWEBCONF_CONFIG_USE_STATIC_IP
+  IotWebConfParameter _staticIpParameter;
+  IotWebConfParameter _staticGatewayParameter;
+  IotWebConfParameter _staticNetmaskParameter;
+  IotWebConfParameter _staticDnsParameter;
+  char _staticIp[IOTWEBCONF_IP_LEN];
+  char _staticGateway[IOTWEBCONF_IP_LEN];
+  char _staticNetmask[IOTWEBCONF_IP_LEN];
+  char _staticDns[IOTWEBCONF_IP_LEN];
+#endif
   unsigned long _apTimeoutMs = IOTWEBCONF_DEFAULT_AP_MODE_TIMEOUT_MS;
   unsigned long _wifiConnectionTimeoutMs =
       IOTWEBCONF_DEFAULT_WIFI_CONNECTION_TIMEOUT_MS;
-  byte _state = IOTWEBCONF_STATE_BOOT;
   unsigned long _apStartTimeMs = 0;
-  byte _apConnectionStatus = IOTWEBCONF_AP_CONNECTION_STATE_NC;
-  std::function<void()> _wifiConnectionCallback = NULL;
-  std::function<void()> _configSavedCallback = NULL;
-  std::function<boolean()> _formValidator = NULL;
-  std::function<void(const char*, const char*)> _apConnectionHandler =
+  IotWebConfFunction<void()> _wifiConnectionCallback;
+  IotWebConfFunction<void()> _configSavedCallback;
+  IotWebConfFunction<boolean()> _formValidator;
+  IotWebConfFunction<boolean(const char*, const char*)> _apConnectionHandler =
       &(ESPWIFI::connectAp);
-  std::function<void(const char*, const char*)> _wifiConnectionHandler =
+  IotWebConfFunction<void(const char*, const char*)> _wifiConnectionHandler =
       &(ESPWIFI::connectWifi);
-  std::function<IotWebConfWifiAuthInfo*()> _wifiConnectionFailureHandler =
+  IotWebConfFunction<IotWebConfWifiAuthInfo*()> _wifiConnectionFailureHandler =
       &(ESPWIFI::handleConnectWifiFailure);
   unsigned long _internalBlinkOnMs = 500;
   unsigned long _internalBlinkOffMs = 500;
   unsigned long _blinkOnMs = 500;
   unsigned long _blinkOffMs = 500;
-  byte _blinkState = IOTWEBCONF_STATUS_ON;
-  unsigned long _lastBlinkTime = 0;
-  unsigned long _wifiConnectionStart = 0;
+  IotWebConfTimerWheel _timerWheel;
+  IotWebConfTimer _blinkTimer;
+  IotWebConfTimer _apTimeoutTimer;
+  IotWebConfTimer _wifiConnectionTimer;
+  unsigned long _loopStartUs = 0;
+  unsigned long _loopBudgetUs = 0;
+  unsigned long _lastLoopDurationUs = 0;
+  unsigned long _maxLoopDurationUs = 0;
+  IotWebConfParameter* _saveParameter = NULL;
+  int _saveOffset = 0;
+  IotWebConfParameter* _renderParameter = NULL;
+  // -- One page is rendered in steps at a time, by any of the instances.
+  static WiFiClient _renderClient;
+  static ESPWIFI* _renderOwner;
+  IotWebConfTimer _apTeardownTimer;
+  unsigned long _unreachableStartMs = 0;
+  unsigned long _lastUnreachableMs = 0;
+  unsigned long _maxUnreachableMs = 0;
+  unsigned long _totalUnreachableMs = 0;
+  unsigned long _apProbeIntervalMs = 0;
+  IotWebConfTimer _apProbeTimer;
+  IotWebConfLease _lease;
+  int _leaseStart = 0;
+  unsigned long _connectStartMs = 0;
+  unsigned long _connectDurationMs[IOTWEBCONF_IP_PATH_COUNT] = {0, 0, 0};
+  IotWebConfRoamingPolicy _roamingPolicy;
+  IotWebConfTimer _roamingTimer;
+  uint8_t _roamBssid[6];
+  int32_t _roamChannel = 0;
+  static const uint8_t* _connectBssid;
+  static int32_t _connectChannel;
   IotWebConfWifiAuthInfo _wifiAuthInfo = {_wifiSsid, _wifiPassword};
-  IotWebConfHtmlFormatProvider htmlFormatProviderInstance;
-  IotWebConfHtmlFormatProvider* htmlFormatProvider = &htmlFormatProviderInstance;
+  IotWebConfSession _sessions[IOTWEBCONF_SESSION_COUNT];
+  IotWebConfSession* _issuedSession = NULL;
+#ifdef IOTWEBCONF_CONFIG_USE_PULL_UPDATE
+  IotWebConfPullUpdate _pullUpdate;
+#endif
+  IotWebConfNetwork* _networks = NULL;
+  static IotWebConfArena _arena;
+#ifdef IOTWEBCONF_CONFIG_USE_METRICS
+  IotWebConfMetrics _metrics = {};
+#endif
+#ifdef IOTWEBCONF_CONFIG_USE_PROFILER
+  IotWebConfProfiler _profiler;
+#endif
+#ifdef IOTWEBCONF_CONFIG_USE_HEAP_TRACKER
+  IotWebConfHeapTracker _heapTracker;
+#endif
+  unsigned long _networksUpdatedMs = 0;
+  byte _state = IOTWEBCONF_STATE_BOOT;
+  byte _apConnectionStatus = IOTWEBCONF_AP_CONNECTION_STATE_NC;
+  byte _blinkState = IOTWEBCONF_STATUS_ON;
+  byte _saveStep = IOTWEBCONF_SAVE_IDLE;
+  byte _renderStep = IOTWEBCONF_RENDER_IDLE;
+  byte _apProbeResult = IOTWEBCONF_AP_PROBE_UNKNOWN;
+  byte _apProbeSkips = 0;
+  byte _ipPath = IOTWEBCONF_IP_PATH_DHCP;
+  byte _networkCount = 0;
+  // -- Flags are packed into bits, and cleared by the constructor.
+  boolean _forceDefaultPassword : 1;
+  boolean _skipApStartup : 1;
+  boolean _apTimedOut : 1;
+  boolean _wifiConnectionTimedOut : 1;
+  boolean _keepApWhileConnecting : 1;
+  boolean _apKept : 1;
+  boolean _unreachable : 1;
+  boolean _apProbeScanning : 1;
+  boolean _rememberLease : 1;
+  boolean _ipConfigured : 1;
+  boolean _roamingScanning : 1;
+  boolean _roaming : 1;
+  boolean _networkScanning : 1;
+  static IotWebConfHtmlFormatProvider _defaultHtmlFormatProvider;
+  IotWebConfHtmlFormatProvider* htmlFormatProvider = &_defaultHtmlFormatProvider;
 
   void configInit();
   boolean configLoad();
   boolean configTestVersion();
   void configSaveConfigVersion();
+  int configSaveParameter(IotWebConfParameter* current, int start);
+  void configCommit();
+  void startConfigSave();
+  void continueConfigSave();
   void readEepromValue(int start, char* valueBuffer, int length);
   void writeEepromValue(int start, char* valueBuffer, int length);
 
+  void writeHtmlPart(
+      IotWebConfPageWriter* writer, PGM_P text, IotWebConfHtmlPart part,
+      const char* keys = "", const char* const* values = NULL);
+  void writeHtmlHead(IotWebConfPageWriter* writer);
+  void writeConfigPageHead(IotWebConfPageWriter* writer);
+  void writeConfigParameter(
+      IotWebConfPageWriter* writer, IotWebConfParameter* current,
+      boolean useArgs);
+  void writeConfigPageTail(IotWebConfPageWriter* writer);
+  void writeSavedPage(IotWebConfPageWriter* writer);
+  const char* arenaArg(const char* name);
+  const char* arenaUri();
+  const char* arenaHostHeader();
+  void startConfigPage();
+  void continueConfigPage();
+  void stopConfigPage();
   void readParamValue(const char* paramName, char* target, unsigned int len);
   boolean validateForm();
-
-  void changeState(byte newState);
+  boolean authenticate(IotWebConfServer* server);
+  IotWebConfSession* findSession(IotWebConfServer* server);
+  void createSession();
+  boolean takeSessionCookie(char* cookie, size_t size);
+  void sendSessionCookie(IotWebConfServer* server);
+  void writeStreamHeader(const char* contentType, int code = 200);
+  void writeStreamHeader(
+      IotWebConfPageWriter* writer, const char* contentType);
+  void dropSessions();
+
+  void loopStep();
+  boolean hasLoopBudget();
+  void changeState(byte newState, byte reason);
   void stateChanged(byte oldState, byte newState);
+  void updateReachability(boolean reachable);
+  void teardownKeptAp();
   boolean isWifiModePossible()
   {
     return this->_forceDefaultPassword || (this->_apPassword[0] == '\0');
   }
-  boolean isIp(String str);
-  String toStringIp(IPAddress ip);
+  boolean isApLeavePossible()
+  {
+    return (this->_wifiSsid[0] != '\0') && (this->_apPassword[0] != '\0') &&
+        (!this->_forceDefaultPassword);
+  }
+  boolean isIp(const char* str);
+  boolean isThingHost(const char* host);
+  void sendPortalRedirect();
+  void sendProbeResponse(int8_t probe);
   void doBlink();
+  void apTimedOut() { this->_apTimedOut = true; }
+  void wifiConnectionTimedOut() { this->_wifiConnectionTimedOut = true; }
+  /**
+   * The UpdateServer is served by the WebServer, that only runs, when it is
+   * also the backend of the portal.
+   */
+  boolean hasUpdateServer()
+  {
+    return (this->_updateServer != NULL) && (this->_server != NULL) &&
+        (this->_webServer == &this->_syncServer);
+  }
   void blinkInternal(unsigned long repeatMs, byte dutyCyclePercent);
 
   void checkApTimeout();
+  void startApProbe();
+  void stopApProbe();
+  void checkApProbe();
+  void startNetworkScan();
+  void checkNetworkScan();
+  void stopNetworkScan();
+  void cacheNetworks(int8_t count);
+  void dropNetworks();
+  void writeNetworks(IotWebConfPageWriter* writer);
   void checkConnection();
   boolean checkWifiConnection();
+  void applyIpConfig();
+  void sampleRssi();
+  void checkRoamingScan();
+  void stopRoamingScan();
+#ifdef IOTWEBCONF_CONFIG_USE_PULL_UPDATE
+  void processPullUpdate();
+#endif
+  boolean applyStaticIpConfig();
+  void leaseLoad();
+  void leaseSave();
+  void leaseDrop();
+  static boolean isLeaseSane(IotWebConfLease* lease);
   void setupAp();
+  void startDns();
+  void stopDns();
+  void processDns();
   void stopAp();
 
   static boolean connectAp(const char* apName, const char* password);
@@ -0,0 +1,56 @@
+#include "IotWebConfArena.h"
+
+void* IotWebConfArena::allocate(size_t size)
+{
+  size = (size + 3) & ~(size_t)3;
+  if (size <= sizeof(this->_buffer) - this->_used)
+  {
+    void* memory = (uint8_t*)this->_buffer + this->_used;
+    this->_used += size;
+    if (this->_peak < this->_used)
+    {
+      this->_peak = this->_used;
+    }
+    return memory;
+  }
+
+  // -- Overflow blocks are chained, so they can be freed together.
+  this->_overflowCount += 1;
+  IotWebConfArenaBlock* block =
+      (IotWebConfArenaBlock*)malloc(sizeof(IotWebConfArenaBlock) + size);
+  if (block == NULL)
+  {
+    return NULL;
+  }
+  block->next = this->_overflowBlocks;
+  this->_overflowBlocks = block;
+  return block + 1;
+}
+
+char* IotWebConfArena::copy(const char* text, size_t length)
+{
+  char* target = (char*)this->allocate(length + 1);
+  if (target != NULL)
+  {
+    memcpy(target, text, length);
+    target[length] = '\0';
+  }
+  return target;
+}
+
+void IotWebConfArena::release(size_t mark)
+{
+  if (mark < this->_used)
+  {
+    this->_used = mark;
+  }
+  if (mark == 0)
+  {
+    while (this->_overflowBlocks != NULL)
+    {
+      IotWebConfArenaBlock* next = this->_overflowBlocks->next;
+      free(this->_overflowBlocks);
+      this->_overflowBlocks = next;
+    }
+  }
+}
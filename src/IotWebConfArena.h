@@ -0,0 +1,87 @@
+
+#ifndef IotWebConfArena_h
+#define IotWebConfArena_h
+
+#include <Arduino.h>
+
+// -- Size of the scratch buffer used while serving a request.
+#ifndef IOTWEBCONF_ARENA_SIZE
+# define IOTWEBCONF_ARENA_SIZE 1024
+#endif
+
+/**
+ * For internal use only.
+ */
+typedef struct IotWebConfArenaBlock
+{
+  struct IotWebConfArenaBlock* next;
+} IotWebConfArenaBlock;
+
+/**
+ * Bump allocator over a fixed buffer for short lived data of a request.
+ * Allocation only moves a pointer, and memory is given back in bulk by
+ * rewinding to a mark taken earlier (see IotWebConfArenaScope).
+ * When the buffer is full, memory is allocated from the heap instead. These
+ * blocks are counted, and freed, when the arena is rewound to empty.
+ */
+class IotWebConfArena
+{
+public:
+  ~IotWebConfArena() { this->release(0); }
+
+  /**
+   * Returns memory for size bytes (aligned to 4 bytes), or NULL if even the
+   * heap is exhausted.
+   */
+  void* allocate(size_t size);
+
+  /**
+   * Copy of the text (of length bytes) with a terminating zero.
+   */
+  char* copy(const char* text, size_t length);
+
+  size_t getUsed() { return this->_used; }
+
+  /**
+   * Free memory allocated after the mark was taken with getUsed().
+   */
+  void release(size_t mark);
+
+  /**
+   * Highest usage of the buffer in bytes.
+   */
+  size_t getPeak() { return this->_peak; }
+
+  /**
+   * Number of allocations not fitting the buffer.
+   */
+  uint32_t getOverflowCount() { return this->_overflowCount; }
+
+private:
+  uint32_t _buffer[(IOTWEBCONF_ARENA_SIZE + 3) / 4];
+  size_t _used = 0;
+  size_t _peak = 0;
+  uint32_t _overflowCount = 0;
+  IotWebConfArenaBlock* _overflowBlocks = NULL;
+};
+
+/**
+ * Memory allocated from the arena while the scope exists is freed, when the
+ * scope is left.
+ */
+class IotWebConfArenaScope
+{
+public:
+  IotWebConfArenaScope(IotWebConfArena* arena)
+  {
+    this->_arena = arena;
+    this->_mark = arena->getUsed();
+  }
+  ~IotWebConfArenaScope() { this->_arena->release(this->_mark); }
+
+private:
+  IotWebConfArena* _arena;
+  size_t _mark;
+};
+
+#endif
@@ -0,0 +1,922 @@
+#include "IotWebConfAsyncServer.h"
+
+IotWebConfAsyncServer::IotWebConfAsyncServer(uint16_t port) : _listener(port)
+{
+  for (byte i = 0; i < IOTWEBCONF_ASYNC_MAX_CONNECTIONS; i++)
+  {
+    this->_connections[i].state = IOTWEBCONF_CONNECTION_FREE;
+    this->_connections[i].output = NULL;
+  }
+  for (byte i = 0; i < IOTWEBCONF_ASYNC_OUTPUT_BLOCKS; i++)
+  {
+    this->_blocks[i].next = this->_freeBlocks;
+    this->_freeBlocks = &this->_blocks[i];
+  }
+}
+
+boolean IotWebConfAsyncServer::on(
+    const char* uri, IotWebConfFunction<void()> handler)
+{
+  if (this->_routeCount >= IOTWEBCONF_ASYNC_MAX_ROUTES)
+  {
+    return false;
+  }
+  this->_routeUris[this->_routeCount] = uri;
+  this->_routeHandlers[this->_routeCount] = handler;
+  this->_routeCount += 1;
+  return true;
+}
+
+void IotWebConfAsyncServer::onNotFound(IotWebConfFunction<void()> handler)
+{
+  this->_notFoundHandler = handler;
+}
+
+void IotWebConfAsyncServer::begin()
+{
+  this->_listener.begin();
+  this->_listener.setNoDelay(true);
+}
+
+void IotWebConfAsyncServer::handleClient()
+{
+  this->accept();
+
+  for (byte i = 0; i < IOTWEBCONF_ASYNC_MAX_CONNECTIONS; i++)
+  {
+    IotWebConfConnection* connection = &this->_connections[i];
+    if (connection->state == IOTWEBCONF_CONNECTION_READING)
+    {
+      this->receive(connection);
+    }
+    if (connection->state == IOTWEBCONF_CONNECTION_WRITING)
+    {
+      this->transmit(connection);
+    }
+    // -- Idle time is measured after the connection was served, as serving it
+    // updates the time of the last activity.
+    // Between kept-alive requests the shorter idle timeout applies.
+    unsigned long timeoutMs = (connection->requestCount > 0) &&
+            (connection->state == IOTWEBCONF_CONNECTION_READING) &&
+            (connection->received == 0)
+        ? IOTWEBCONF_ASYNC_KEEP_ALIVE_TIMEOUT_MS
+        : IOTWEBCONF_ASYNC_TIMEOUT_MS;
+    if ((connection->state != IOTWEBCONF_CONNECTION_FREE) &&
+        (timeoutMs < millis() - connection->lastActivityMs))
+    {
+      connection->client.stop();
+      this->release(connection);
+    }
+  }
+}
+
+void IotWebConfAsyncServer::accept()
+{
+  while (this->_listener.hasClient())
+  {
+    WiFiClient client = this->_listener.available();
+    if (!client)
+    {
+      break;
+    }
+    IotWebConfConnection* connection = NULL;
+    for (byte i = 0; i < IOTWEBCONF_ASYNC_MAX_CONNECTIONS; i++)
+    {
+      if (this->_connections[i].state == IOTWEBCONF_CONNECTION_FREE)
+      {
+        connection = &this->_connections[i];
+        break;
+      }
+    }
+    if (connection == NULL)
+    {
+      // -- No free slot, client should retry.
+      client.stop();
+      continue;
+    }
+    connection->client = client;
+    connection->client.setNoDelay(true);
+    connection->state = IOTWEBCONF_CONNECTION_READING;
+    connection->lastActivityMs = millis();
+    connection->received = 0;
+    connection->headerParsed = false;
+    connection->requestCount = 0;
+    connection->request[0] = '\0';
+    this->_connectionCount += 1;
+  }
+}
+
+/**
+ * Reads the bytes already arrived.
+ */
+void IotWebConfAsyncServer::receive(IotWebConfConnection* connection)
+{
+  int available = connection->client.available();
+  if (available <= 0)
+  {
+    if (!connection->client.connected())
+    {
+      this->release(connection);
+    }
+    return;
+  }
+
+  size_t space = IOTWEBCONF_ASYNC_REQUEST_SIZE - connection->received;
+  if (space == 0)
+  {
+    this->reject(connection, 413);
+    return;
+  }
+  size_t count = (size_t)available < space ? available : space;
+  count = connection->client.read(
+      (uint8_t*)connection->request + connection->received, count);
+  connection->received += count;
+  connection->request[connection->received] = '\0';
+  connection->lastActivityMs = millis();
+
+  this->process(connection);
+}
+
+/**
+ * Dispatches the request, when it is complete in the buffer.
+ */
+void IotWebConfAsyncServer::process(IotWebConfConnection* connection)
+{
+  if (!connection->headerParsed)
+  {
+    char* headerEnd = strstr(connection->request, "\r\n\r\n");
+    if (headerEnd == NULL)
+    {
+      return;
+    }
+    if (!this->parseHeader(connection, headerEnd))
+    {
+      this->reject(connection, 400);
+      return;
+    }
+  }
+
+  size_t requestLength = connection->headerLength + connection->contentLength;
+  if (requestLength > IOTWEBCONF_ASYNC_REQUEST_SIZE)
+  {
+    this->reject(connection, 413);
+  }
+  else if (connection->received >= requestLength)
+  {
+    // -- A pipelined request might follow, its first byte is saved.
+    connection->nextRequestStart = connection->request[requestLength];
+    connection->request[requestLength] = '\0';
+    this->dispatch(connection);
+  }
+}
+
+/**
+ * Parses the request line and headers in place.
+ */
+boolean IotWebConfAsyncServer::parseHeader(
+    IotWebConfConnection* connection, char* headerEnd)
+{
+  connection->headerLength = headerEnd + 4 - connection->request;
+  connection->contentLength = 0;
+  connection->host = NULL;
+  connection->authorization = NULL;
+  connection->cookie = NULL;
+  *headerEnd = '\0';
+
+  // -- Request line.
+  char* line = connection->request;
+  char* uri = strchr(line, ' ');
+  if (uri == NULL)
+  {
+    return false;
+  }
+  *uri++ = '\0';
+  char* version = strchr(uri, ' ');
+  char* lineEnd = strstr(uri, "\r\n");
+  if ((version == NULL) || ((lineEnd != NULL) && (lineEnd < version)))
+  {
+    return false;
+  }
+  *version++ = '\0';
+  // -- HTTP/1.1 connections are persistent by default.
+  connection->http11 = (strncmp(version, "HTTP/1.1", 8) == 0);
+  connection->keepAlive = connection->http11;
+  if (strcmp(line, "GET") == 0)
+  {
+    connection->method = HTTP_GET;
+  }
+  else if (strcmp(line, "POST") == 0)
+  {
+    connection->method = HTTP_POST;
+  }
+  else
+  {
+    return false;
+  }
+  connection->uri = uri;
+
+  // -- Headers.
+  while (lineEnd != NULL)
+  {
+    line = lineEnd + 2;
+    *lineEnd = '\0';
+    lineEnd = strstr(line, "\r\n");
+    if (lineEnd != NULL)
+    {
+      *lineEnd = '\0';
+    }
+    char* value = strchr(line, ':');
+    if (value == NULL)
+    {
+      continue;
+    }
+    *value++ = '\0';
+    while (*value == ' ')
+    {
+      value++;
+    }
+    if (strcasecmp(line, "Host") == 0)
+    {
+      connection->host = value;
+    }
+    else if (strcasecmp(line, "Authorization") == 0)
+    {
+      connection->authorization = value;
+    }
+    else if (strcasecmp(line, "Cookie") == 0)
+    {
+      connection->cookie = value;
+    }
+    else if (strcasecmp(line, "Content-Length") == 0)
+    {
+      connection->contentLength = atoi(value);
+    }
+    else if (strcasecmp(line, "Connection") == 0)
+    {
+      connection->keepAlive = (strcasecmp(value, "keep-alive") == 0);
+    }
+  }
+  connection->headerParsed = true;
+  return true;
+}
+
+void IotWebConfAsyncServer::dispatch(IotWebConfConnection* connection)
+{
+  this->_current = connection;
+  this->_headersLength = 0;
+  this->_argCount = 0;
+  connection->requestCount += 1;
+  this->_requestCount += 1;
+  if (connection->requestCount >= IOTWEBCONF_ASYNC_KEEP_ALIVE_MAX_REQUESTS)
+  {
+    connection->keepAlive = false;
+  }
+
+  char* query = strchr(connection->uri, '?');
+  if (query != NULL)
+  {
+    *query++ = '\0';
+    this->parseArgs(query);
+  }
+  if ((connection->method == HTTP_POST) && (connection->contentLength > 0))
+  {
+    this->parseArgs(connection->request + connection->headerLength);
+  }
+  urlDecode(connection->uri);
+
+  IotWebConfFunction<void()> handler = this->_notFoundHandler;
+  for (byte i = 0; i < this->_routeCount; i++)
+  {
+    if (strcmp(this->_routeUris[i], connection->uri) == 0)
+    {
+      handler = this->_routeHandlers[i];
+      break;
+    }
+  }
+  connection->sent = 0;
+  connection->chunked = false;
+  if (handler)
+  {
+    handler();
+  }
+  else
+  {
+    this->send(404, "text/plain", "Not found");
+  }
+  if (connection->chunked)
+  {
+    // -- Handler did not end its stream.
+    this->endStream();
+  }
+  this->_current = NULL;
+
+  if (connection->output == NULL)
+  {
+    // -- Handler did not respond.
+    connection->keepAlive = false;
+    this->finish(connection);
+  }
+  else
+  {
+    connection->state = IOTWEBCONF_CONNECTION_WRITING;
+    this->transmit(connection);
+  }
+}
+
+/**
+ * Writes the next chunk of the response, when the connection can take it.
+ */
+void IotWebConfAsyncServer::transmit(IotWebConfConnection* connection)
+{
+  if (!connection->client.connected())
+  {
+    this->release(connection);
+    return;
+  }
+  size_t remaining = IOTWEBCONF_ASYNC_WRITE_CHUNK;
+  while ((connection->output != NULL) && (remaining > 0))
+  {
+    IotWebConfOutputBlock* block = connection->output;
+    size_t count = block->length - connection->sent;
+    count = count < remaining ? count : remaining;
+    size_t written = connection->client.write(
+        (const uint8_t*)block->data + connection->sent, count);
+    if (written == 0)
+    {
+      break;
+    }
+    connection->sent += written;
+    connection->lastActivityMs = millis();
+    remaining -= written;
+    if (connection->sent >= block->length)
+    {
+      connection->output = block->next;
+      connection->sent = 0;
+      this->releaseBlock(block);
+    }
+  }
+  if (connection->output == NULL)
+  {
+    this->finish(connection);
+  }
+}
+
+/**
+ * Response is sent: either wait for the next request, or close.
+ */
+void IotWebConfAsyncServer::finish(IotWebConfConnection* connection)
+{
+  if (!connection->keepAlive)
+  {
+    connection->client.stop();
+    this->release(connection);
+    return;
+  }
+
+  // -- Bytes of a pipelined request are moved to the start of the buffer.
+  size_t requestLength = connection->headerLength + connection->contentLength;
+  size_t pending = connection->received - requestLength;
+  connection->request[requestLength] = connection->nextRequestStart;
+  memmove(
+      connection->request, connection->request + requestLength, pending);
+  connection->request[pending] = '\0';
+  connection->received = pending;
+  connection->headerParsed = false;
+  this->dropOutput(connection);
+  connection->state = IOTWEBCONF_CONNECTION_READING;
+  connection->lastActivityMs = millis();
+  if (pending > 0)
+  {
+    this->process(connection);
+  }
+}
+
+void IotWebConfAsyncServer::release(IotWebConfConnection* connection)
+{
+  connection->client = WiFiClient();
+  this->dropOutput(connection);
+  connection->state = IOTWEBCONF_CONNECTION_FREE;
+}
+
+void IotWebConfAsyncServer::reject(IotWebConfConnection* connection, int code)
+{
+  this->_current = connection;
+  this->_headersLength = 0;
+  this->dropOutput(connection);
+  connection->keepAlive = false;
+  connection->chunked = false;
+  this->send(code, "text/plain", statusText(code));
+  this->_current = NULL;
+  connection->state = IOTWEBCONF_CONNECTION_WRITING;
+}
+
+/**
+ * Splits "name=value&name=value" into arguments in place.
+ */
+void IotWebConfAsyncServer::parseArgs(char* data)
+{
+  while ((data != NULL) && (*data != '\0') &&
+         (this->_argCount < IOTWEBCONF_ASYNC_MAX_ARGS))
+  {
+    char* next = strchr(data, '&');
+    if (next != NULL)
+    {
+      *next++ = '\0';
+    }
+    char* value = strchr(data, '=');
+    if (value != NULL)
+    {
+      *value++ = '\0';
+    }
+    else
+    {
+      value = data + strlen(data);
+    }
+    urlDecode(data);
+    urlDecode(value);
+    this->_argNames[this->_argCount] = data;
+    this->_argValues[this->_argCount] = value;
+    this->_argCount += 1;
+    data = next;
+  }
+}
+
+String IotWebConfAsyncServer::uri()
+{
+  return this->_current == NULL ? String() : String(this->_current->uri);
+}
+
+HTTPMethod IotWebConfAsyncServer::method()
+{
+  return this->_current == NULL ? HTTP_GET : this->_current->method;
+}
+
+String IotWebConfAsyncServer::hostHeader()
+{
+  return (this->_current == NULL) || (this->_current->host == NULL)
+      ? String()
+      : String(this->_current->host);
+}
+
+String IotWebConfAsyncServer::header(const char* name)
+{
+  const char* value = this->findHeader(name);
+  return value == NULL ? String() : String(value);
+}
+
+/**
+ * Only Host, Authorization and Cookie headers are kept.
+ */
+const char* IotWebConfAsyncServer::findHeader(const char* name)
+{
+  if (this->_current == NULL)
+  {
+    return NULL;
+  }
+  else if (strcasecmp(name, "Host") == 0)
+  {
+    return this->_current->host;
+  }
+  else if (strcasecmp(name, "Authorization") == 0)
+  {
+    return this->_current->authorization;
+  }
+  else if (strcasecmp(name, "Cookie") == 0)
+  {
+    return this->_current->cookie;
+  }
+  return NULL;
+}
+
+int IotWebConfAsyncServer::args() { return this->_argCount; }
+
+String IotWebConfAsyncServer::arg(int i)
+{
+  return i < this->_argCount ? String(this->_argValues[i]) : String();
+}
+
+String IotWebConfAsyncServer::argName(int i)
+{
+  return i < this->_argCount ? String(this->_argNames[i]) : String();
+}
+
+String IotWebConfAsyncServer::arg(const char* name)
+{
+  for (byte i = 0; i < this->_argCount; i++)
+  {
+    if (strcmp(this->_argNames[i], name) == 0)
+    {
+      return String(this->_argValues[i]);
+    }
+  }
+  return String();
+}
+
+boolean IotWebConfAsyncServer::hasArg(const char* name)
+{
+  for (byte i = 0; i < this->_argCount; i++)
+  {
+    if (strcmp(this->_argNames[i], name) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Requests are parsed in place, so values are copied without a String.
+ */
+int IotWebConfAsyncServer::readArg(const char* name, char* target, size_t size)
+{
+  for (byte i = 0; i < this->_argCount; i++)
+  {
+    if (strcmp(this->_argNames[i], name) == 0)
+    {
+      return copyText(this->_argValues[i], target, size);
+    }
+  }
+  return -1;
+}
+
+int IotWebConfAsyncServer::readUri(char* target, size_t size)
+{
+  return copyText(
+      this->_current == NULL ? "" : this->_current->uri, target, size);
+}
+
+int IotWebConfAsyncServer::readHostHeader(char* target, size_t size)
+{
+  const char* host = this->findHeader("Host");
+  return copyText(host == NULL ? "" : host, target, size);
+}
+
+int IotWebConfAsyncServer::readHeader(
+    const char* name, char* target, size_t size)
+{
+  const char* value = this->findHeader(name);
+  return value == NULL ? -1 : copyText(value, target, size);
+}
+
+int IotWebConfAsyncServer::copyText(const char* text, char* target, size_t size)
+{
+  size_t length = strlen(text);
+  if (size > 0)
+  {
+    size_t count = length < size - 1 ? length : size - 1;
+    memcpy(target, text, count);
+    target[count] = '\0';
+  }
+  return length;
+}
+
+/**
+ * Basic authentication.
+ */
+boolean IotWebConfAsyncServer::authenticate(
+    const char* username, const char* password)
+{
+  if ((this->_current == NULL) || (this->_current->authorization == NULL) ||
+      (strncmp(this->_current->authorization, "Basic ", 6) != 0))
+  {
+    return false;
+  }
+  char decoded[80];
+  int length = base64Decode(
+      this->_current->authorization + 6, decoded, sizeof(decoded));
+  size_t userLength = strlen(username);
+  return (length > 0) && ((size_t)length == userLength + 1 + strlen(password)) &&
+      (strncmp(decoded, username, userLength) == 0) &&
+      (decoded[userLength] == ':') &&
+      (strcmp(decoded + userLength + 1, password) == 0);
+}
+
+void IotWebConfAsyncServer::requestAuthentication()
+{
+  this->sendHeader("WWW-Authenticate", "Basic realm=\"Login Required\"");
+  this->send(401, "text/plain", statusText(401));
+}
+
+IPAddress IotWebConfAsyncServer::localIP()
+{
+  return this->_current == NULL ? IPAddress() : this->_current->client.localIP();
+}
+
+void IotWebConfAsyncServer::sendHeader(const String& name, const String& value)
+{
+  if (name.equalsIgnoreCase("Content-Length"))
+  {
+    // -- Always provided by send().
+    return;
+  }
+  // -- A header, that does not fit, is dropped.
+  size_t length = name.length() + 2 + value.length() + 2;
+  if (this->_headersLength + length > sizeof(this->_headers))
+  {
+    return;
+  }
+  char* target = this->_headers + this->_headersLength;
+  memcpy(target, name.c_str(), name.length());
+  target += name.length();
+  memcpy(target, ": ", 2);
+  memcpy(target + 2, value.c_str(), value.length());
+  memcpy(target + 2 + value.length(), "\r\n", 2);
+  this->_headersLength += length;
+}
+
+void IotWebConfAsyncServer::send(
+    int code, const char* contentType, const String& content)
+{
+  char head[160];
+  int length = snprintf(
+      head, sizeof(head),
+      "HTTP/1.1 %d %s\r\n"
+      "Content-Type: %s\r\n"
+      "Content-Length: %u\r\n"
+      "Connection: %s\r\n",
+      code, statusText(code), contentType, content.length(),
+      (this->_current != NULL) && this->_current->keepAlive
+          ? "keep-alive"
+          : "close");
+  this->queue(head, length);
+  this->queue(this->_headers, this->_headersLength);
+  this->queue("\r\n", 2);
+  this->queue(content.c_str(), content.length());
+  this->_headersLength = 0;
+}
+
+/**
+ * Pre-serialized responses come with their own Connection header, so the
+ * connection is closed after these. Within a stream, the data is queued as a
+ * chunk.
+ */
+void IotWebConfAsyncServer::write(const uint8_t* data, size_t length)
+{
+  if ((this->_current == NULL) || !this->_current->chunked)
+  {
+    this->close();
+    this->queue((const char*)data, length);
+    return;
+  }
+  if (length == 0)
+  {
+    // -- An empty chunk would end the response.
+    return;
+  }
+  char size[12];
+  int sizeLength = snprintf(size, sizeof(size), "%x\r\n", (unsigned int)length);
+  this->queue(size, sizeLength);
+  this->queue((const char*)data, length);
+  this->queue("\r\n", 2);
+}
+
+void IotWebConfAsyncServer::close()
+{
+  if (this->_current != NULL)
+  {
+    this->_current->keepAlive = false;
+  }
+}
+
+/**
+ * The body is sent in chunks, when the connection is kept alive. HTTP/1.0
+ * clients do not know chunks, their connection is closed after the body
+ * instead.
+ */
+void IotWebConfAsyncServer::startStream(
+    int code, const char* contentType, const char* headers)
+{
+  if (this->_current == NULL)
+  {
+    return;
+  }
+  IotWebConfConnection* connection = this->_current;
+  if (!connection->http11)
+  {
+    connection->keepAlive = false;
+  }
+  char head[160];
+  int length = snprintf(
+      head, sizeof(head),
+      "HTTP/1.1 %d %s\r\n"
+      "Content-Type: %s\r\n"
+      "%s",
+      code, statusText(code), contentType,
+      connection->keepAlive
+          ? "Transfer-Encoding: chunked\r\nConnection: keep-alive\r\n"
+          : "Connection: close\r\n");
+  this->queue(head, length);
+  this->queue(this->_headers, this->_headersLength);
+  if (headers != NULL)
+  {
+    this->queue(headers, strlen(headers));
+  }
+  this->queue("\r\n", 2);
+  this->_headersLength = 0;
+  connection->chunked = connection->keepAlive;
+}
+
+void IotWebConfAsyncServer::endStream()
+{
+  if ((this->_current == NULL) || !this->_current->chunked)
+  {
+    this->close();
+    return;
+  }
+  this->queue("0\r\n\r\n", 5);
+  this->_current->chunked = false;
+}
+
+/**
+ * Responses are collected in blocks, and sent from handleClient() in chunks.
+ * When no block can be had, the rest of the response is dropped, and the
+ * connection is closed after the part collected.
+ */
+void IotWebConfAsyncServer::queue(const char* data, size_t length)
+{
+  if (this->_current == NULL)
+  {
+    return;
+  }
+  IotWebConfConnection* connection = this->_current;
+  while (length > 0)
+  {
+    IotWebConfOutputBlock* block = connection->output == NULL
+        ? NULL
+        : connection->outputLast;
+    if ((block == NULL) || (block->length == IOTWEBCONF_ASYNC_OUTPUT_BLOCK_SIZE))
+    {
+      IotWebConfOutputBlock* next = this->takeBlock();
+      if (next == NULL)
+      {
+        connection->keepAlive = false;
+        return;
+      }
+      if (block == NULL)
+      {
+        connection->output = next;
+      }
+      else
+      {
+        block->next = next;
+      }
+      connection->outputLast = next;
+      block = next;
+    }
+    size_t count = IOTWEBCONF_ASYNC_OUTPUT_BLOCK_SIZE - block->length;
+    count = count < length ? count : length;
+    memcpy(block->data + block->length, data, count);
+    block->length += count;
+    data += count;
+    length -= count;
+  }
+}
+
+void IotWebConfAsyncServer::dropOutput(IotWebConfConnection* connection)
+{
+  while (connection->output != NULL)
+  {
+    IotWebConfOutputBlock* block = connection->output;
+    connection->output = block->next;
+    this->releaseBlock(block);
+  }
+  connection->sent = 0;
+}
+
+IotWebConfOutputBlock* IotWebConfAsyncServer::takeBlock()
+{
+  IotWebConfOutputBlock* block = this->_freeBlocks;
+  if (block != NULL)
+  {
+    this->_freeBlocks = block->next;
+  }
+  else
+  {
+    block = (IotWebConfOutputBlock*)malloc(sizeof(IotWebConfOutputBlock));
+    if (block == NULL)
+    {
+      return NULL;
+    }
+    this->_overflowCount += 1;
+  }
+  block->next = NULL;
+  block->length = 0;
+  return block;
+}
+
+/**
+ * Blocks of the pool are put back, others are freed.
+ */
+void IotWebConfAsyncServer::releaseBlock(IotWebConfOutputBlock* block)
+{
+  if ((block >= this->_blocks) &&
+      (block < this->_blocks + IOTWEBCONF_ASYNC_OUTPUT_BLOCKS))
+  {
+    block->next = this->_freeBlocks;
+    this->_freeBlocks = block;
+  }
+  else
+  {
+    free(block);
+  }
+}
+
+void IotWebConfAsyncServer::urlDecode(char* text)
+{
+  char* target = text;
+  while (*text != '\0')
+  {
+    if (*text == '+')
+    {
+      *target++ = ' ';
+      text++;
+    }
+    else if ((*text == '%') && isxdigit(text[1]) && isxdigit(text[2]))
+    {
+      char hex[3] = {text[1], text[2], '\0'};
+      *target++ = (char)strtol(hex, NULL, 16);
+      text += 3;
+    }
+    else
+    {
+      *target++ = *text++;
+    }
+  }
+  *target = '\0';
+}
+
+/**
+ * Returns the length of the decoded text, or -1 if it does not fit.
+ */
+int IotWebConfAsyncServer::base64Decode(
+    const char* in, char* out, size_t outSize)
+{
+  size_t length = 0;
+  unsigned long bits = 0;
+  byte bitCount = 0;
+  for (; (*in != '\0') && (*in != '='); in++)
+  {
+    char c = *in;
+    int value;
+    if ((c >= 'A') && (c <= 'Z'))
+    {
+      value = c - 'A';
+    }
+    else if ((c >= 'a') && (c <= 'z'))
+    {
+      value = c - 'a' + 26;
+    }
+    else if ((c >= '0') && (c <= '9'))
+    {
+      value = c - '0' + 52;
+    }
+    else if (c == '+')
+    {
+      value = 62;
+    }
+    else if (c == '/')
+    {
+      value = 63;
+    }
+    else
+    {
+      break;
+    }
+    bits = (bits << 6) | value;
+    bitCount += 6;
+    if (bitCount >= 8)
+    {
+      bitCount -= 8;
+      if (length + 1 >= outSize)
+      {
+        return -1;
+      }
+      out[length++] = (char)((bits >> bitCount) & 0xFF);
+    }
+  }
+  out[length] = '\0';
+  return length;
+}
+
+const char* IotWebConfAsyncServer::statusText(int code)
+{
+  switch (code)
+  {
+    case 200:
+      return "OK";
+    case 204:
+      return "No Content";
+    case 302:
+      return "Found";
+    case 400:
+      return "Bad Request";
+    case 401:
+      return "Unauthorized";
+    case 404:
+      return "Not Found";
+    case 413:
+      return "Payload Too Large";
+    default:
+      return "Error";
+  }
+}
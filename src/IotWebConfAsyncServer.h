@@ -0,0 +1,189 @@
+
+#ifndef IotWebConfAsyncServer_h
+#define IotWebConfAsyncServer_h
+
+#include <IotWebConfServer.h>
+#include <IotWebConfCallback.h>
+
+// -- Number of clients served in parallel.
+#define IOTWEBCONF_ASYNC_MAX_CONNECTIONS 4
+
+// -- Maximal size of a request (request line, headers and form body).
+#define IOTWEBCONF_ASYNC_REQUEST_SIZE 1024
+
+// -- Maximal number of URL handlers, that can be registered.
+#define IOTWEBCONF_ASYNC_MAX_ROUTES 8
+
+// -- Maximal number of arguments parsed from a request.
+#define IOTWEBCONF_ASYNC_MAX_ARGS 16
+
+// -- Idle connections are closed after this amount of time.
+#define IOTWEBCONF_ASYNC_TIMEOUT_MS 5000
+
+// -- A connection is kept open for further requests (HTTP keep-alive) for this
+// amount of idle time, and for this many requests at most.
+#define IOTWEBCONF_ASYNC_KEEP_ALIVE_TIMEOUT_MS 2000
+#define IOTWEBCONF_ASYNC_KEEP_ALIVE_MAX_REQUESTS 16
+
+// -- Maximal amount of bytes written to a connection in one pass.
+#define IOTWEBCONF_ASYNC_WRITE_CHUNK 536
+
+// -- Responses are queued in blocks, taken from a pool shared by the
+// connections. When the pool is used up, blocks are allocated from the heap.
+#define IOTWEBCONF_ASYNC_OUTPUT_BLOCK_SIZE 512
+#define IOTWEBCONF_ASYNC_OUTPUT_BLOCKS 8
+
+// -- Space for the headers added to a response with sendHeader().
+#define IOTWEBCONF_ASYNC_HEADERS_SIZE 256
+
+// -- States of a connection.
+#define IOTWEBCONF_CONNECTION_FREE 0
+#define IOTWEBCONF_CONNECTION_READING 1
+#define IOTWEBCONF_CONNECTION_WRITING 2
+
+/**
+ * For internal use only.
+ */
+typedef struct IotWebConfOutputBlock
+{
+  IotWebConfOutputBlock* next;
+  size_t length;
+  char data[IOTWEBCONF_ASYNC_OUTPUT_BLOCK_SIZE];
+} IotWebConfOutputBlock;
+
+/**
+ * For internal use only.
+ */
+typedef struct IotWebConfConnection
+{
+  WiFiClient client;
+  byte state;
+  unsigned long lastActivityMs;
+  size_t received;
+  boolean headerParsed;
+  size_t headerLength;
+  size_t contentLength;
+  char nextRequestStart;
+  boolean http11;
+  boolean keepAlive;
+  boolean chunked;
+  byte requestCount;
+  HTTPMethod method;
+  char* uri;
+  char* host;
+  char* authorization;
+  char* cookie;
+  IotWebConfOutputBlock* output;
+  IotWebConfOutputBlock* outputLast;
+  size_t sent;
+  char request[IOTWEBCONF_ASYNC_REQUEST_SIZE + 1];
+} IotWebConfConnection;
+
+/**
+ * Event driven, non-blocking web server backend. Connections are served in
+ * parallel, every handleClient() call only reads and writes the data that is
+ * available without waiting. Requests are parsed in place in a fixed buffer
+ * per connection, responses are queued in pooled blocks. Connections are kept
+ * alive between requests, unless the client or the handler (see close()) asks
+ * otherwise. Responses of unknown length are sent in chunks for this. (See
+ * startStream().)
+ * Note, that file upload is not supported. The update server needs the
+ * synchronous WebServer, that is not started with this backend, as both
+ * cannot listen on port 80. (See ESPWIFI::setServerBackend().)
+ */
+class IotWebConfAsyncServer : public IotWebConfServer
+{
+public:
+  IotWebConfAsyncServer(uint16_t port = 80);
+
+  /**
+   * Register a handler for an URL path. Will return false, if there is no
+   * more space for handlers. (See IOTWEBCONF_ASYNC_MAX_ROUTES.)
+   */
+  boolean on(const char* uri, IotWebConfFunction<void()> handler);
+  void onNotFound(IotWebConfFunction<void()> handler);
+
+  void begin();
+  void handleClient();
+
+  String uri();
+  HTTPMethod method();
+  String hostHeader();
+  String header(const char* name);
+  int args();
+  String arg(int i);
+  String argName(int i);
+  String arg(const char* name);
+  boolean hasArg(const char* name);
+  int readArg(const char* name, char* target, size_t size);
+  int readUri(char* target, size_t size);
+  int readHostHeader(char* target, size_t size);
+  int readHeader(const char* name, char* target, size_t size);
+  boolean authenticate(const char* username, const char* password);
+  void requestAuthentication();
+  IPAddress localIP();
+
+  void sendHeader(const String& name, const String& value);
+  void send(int code, const char* contentType, const String& content);
+  void write(const uint8_t* data, size_t length);
+  void close();
+  void startStream(
+      int code, const char* contentType, const char* headers = NULL);
+  void endStream();
+
+  /**
+   * Number of TCP connections accepted, and number of requests served.
+   * With keep-alive, a connection serves multiple requests.
+   */
+  unsigned long getConnectionCount() { return this->_connectionCount; }
+  unsigned long getRequestCount() { return this->_requestCount; }
+
+  /**
+   * Number of output blocks allocated from the heap, as the pool was used up.
+   * (See IOTWEBCONF_ASYNC_OUTPUT_BLOCKS.)
+   */
+  unsigned long getOverflowCount() { return this->_overflowCount; }
+
+private:
+  WiFiServer _listener;
+  IotWebConfConnection _connections[IOTWEBCONF_ASYNC_MAX_CONNECTIONS];
+  const char* _routeUris[IOTWEBCONF_ASYNC_MAX_ROUTES];
+  IotWebConfFunction<void()> _routeHandlers[IOTWEBCONF_ASYNC_MAX_ROUTES];
+  byte _routeCount = 0;
+  IotWebConfFunction<void()> _notFoundHandler;
+
+  IotWebConfConnection* _current = NULL;
+  char _headers[IOTWEBCONF_ASYNC_HEADERS_SIZE];
+  size_t _headersLength = 0;
+  byte _argCount = 0;
+  unsigned long _connectionCount = 0;
+  unsigned long _requestCount = 0;
+  IotWebConfOutputBlock _blocks[IOTWEBCONF_ASYNC_OUTPUT_BLOCKS];
+  IotWebConfOutputBlock* _freeBlocks = NULL;
+  unsigned long _overflowCount = 0;
+  char* _argNames[IOTWEBCONF_ASYNC_MAX_ARGS];
+  char* _argValues[IOTWEBCONF_ASYNC_MAX_ARGS];
+
+  void accept();
+  void receive(IotWebConfConnection* connection);
+  void process(IotWebConfConnection* connection);
+  void finish(IotWebConfConnection* connection);
+  void transmit(IotWebConfConnection* connection);
+  void release(IotWebConfConnection* connection);
+  boolean parseHeader(IotWebConfConnection* connection, char* headerEnd);
+  void dispatch(IotWebConfConnection* connection);
+  void parseArgs(char* data);
+  void queue(const char* data, size_t length);
+  void dropOutput(IotWebConfConnection* connection);
+  IotWebConfOutputBlock* takeBlock();
+  void releaseBlock(IotWebConfOutputBlock* block);
+  void reject(IotWebConfConnection* connection, int code);
+
+  const char* findHeader(const char* name);
+  static int copyText(const char* text, char* target, size_t size);
+  static void urlDecode(char* text);
+  static int base64Decode(const char* in, char* out, size_t outSize);
+  static const char* statusText(int code);
+};
+
+#endif
@@ -0,0 +1,90 @@
+
+#ifndef IotWebConfCallback_h
+#define IotWebConfCallback_h
+
+#include <Arduino.h>
+#include <functional>
+#include <type_traits>
+
+// -- Callbacks are stored as a function pointer and a context pointer instead
+// of std::function if enabled. This halves the size of every callback, but
+// only plain functions and lambdas without captures can be used. (Use the
+// constructor with a context for calling methods of objects.)
+//#define IOTWEBCONF_CONFIG_LEAN_CALLBACKS
+
+template <typename Signature> class IotWebConfCallback;
+
+/**
+ * A function pointer, called with a context pointer as its first argument.
+ */
+template <typename R, typename... Args> class IotWebConfCallback<R(Args...)>
+{
+public:
+  IotWebConfCallback() {}
+  IotWebConfCallback(decltype(nullptr)) {}
+
+  /**
+   * Callback of a plain function (or a lambda without captures).
+   */
+  template <
+      typename F,
+      typename = typename std::enable_if<
+          std::is_convertible<F, R (*)(Args...)>::value>::type>
+  IotWebConfCallback(F function)
+  {
+    R (*plain)(Args...) = function;
+    this->_function = &IotWebConfCallback::callPlain;
+    this->_context = (void*)plain;
+  }
+
+  /**
+   * Callback of a function to be called with the context.
+   */
+  IotWebConfCallback(R (*function)(void*, Args...), void* context)
+  {
+    this->_function = function;
+    this->_context = context;
+  }
+
+  R operator()(Args... args) const
+  {
+    return this->_function(this->_context, args...);
+  }
+  explicit operator bool() const { return this->_function != NULL; }
+
+private:
+  R (*_function)(void*, Args...) = NULL;
+  void* _context = NULL;
+
+  static R callPlain(void* context, Args... args)
+  {
+    return ((R (*)(Args...))context)(args...);
+  }
+};
+
+/**
+ * Type of the callbacks stored by the library.
+ */
+#ifdef IOTWEBCONF_CONFIG_LEAN_CALLBACKS
+template <typename Signature>
+using IotWebConfFunction = IotWebConfCallback<Signature>;
+#else
+template <typename Signature>
+using IotWebConfFunction = std::function<Signature>;
+#endif
+
+/**
+ * Callback calling a method of the object, works with both callback types.
+ */
+template <typename T, void (T::*Method)()>
+IotWebConfFunction<void()> iotWebConfMethod(T* object)
+{
+#ifdef IOTWEBCONF_CONFIG_LEAN_CALLBACKS
+  return IotWebConfCallback<void()>(
+      [](void* context) { (((T*)context)->*Method)(); }, object);
+#else
+  return [object]() { (object->*Method)(); };
+#endif
+}
+
+#endif
@@ -13,13 +13,28 @@ static const char serverIndex[] PROGMEM =
 static const char successResponse[] PROGMEM = 
   "<META http-equiv=\"refresh\" content=\"15;URL=/\">Update Success! Rebooting...\n";
 
+IotWebConfUpdateTarget HTTPUpdateServer::_defaultTarget;
+
 HTTPUpdateServer::HTTPUpdateServer(bool serial_debug)
 {
   _serial_output = serial_debug;
   _server = NULL;
+  _target = &_defaultTarget;
   _username = emptyString;
   _password = emptyString;
   _authenticated = false;
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+  _block = NULL;
+  _blockLength = 0;
+#endif
+  _writeFailed = false;
+  _verifyDigest = false;
+  memset(&_stats, 0, sizeof(_stats));
+#ifdef IOTWEBCONF_UPDATE_GZIP
+  _gzipState = IOTWEBCONF_GZIP_DETECT;
+  _inflator = NULL;
+  _window = NULL;
+#endif
 }
 
 void HTTPUpdateServer::setup(WebServer *server, const String& path, const String& username, const String& password)
@@ -28,9 +43,16 @@ void HTTPUpdateServer::setup(WebServer *server, const String& path, const String
     _username = username;
     _password = password;
 
+    // handler for the upload progress
+    _server->on(path + "/status", HTTP_GET, [&](){
+      if(!_isAuthenticated())
+        return _server->requestAuthentication();
+      _sendStatus();
+    });
+
     // handler for the /update form page
     _server->on(path.c_str(), HTTP_GET, [&](){
-      if(_username != emptyString && _password != emptyString && !_server->authenticate(_username.c_str(), _password.c_str()))
+      if(!_isAuthenticated())
         return _server->requestAuthentication();
       _server->send_P(200, PSTR("text/html"), serverIndex);
     });
@@ -39,14 +61,14 @@ void HTTPUpdateServer::setup(WebServer *server, const String& path, const String
     _server->on(path.c_str(), HTTP_POST, [&](){
       if(!_authenticated)
         return _server->requestAuthentication();
-      if (Update.hasError()) {
+      if (_target->hasError() || _updaterError.length()) {
         _server->send(200, F("text/html"), String(F("Update error: ")) + _updaterError);
       } else {
         _server->client().setNoDelay(true);
         _server->send_P(200, PSTR("text/html"), successResponse);
         delay(100);
         _server->client().stop();
-        ESP.restart();
+        _target->activate();
       }
     },[&](){
       // handler for the file upload, get's the sketch bytes, and writes
@@ -58,7 +80,7 @@ void HTTPUpdateServer::setup(WebServer *server, const String& path, const String
         if (_serial_output)
           Serial.setDebugOutput(true);
 
-        _authenticated = (_username == emptyString || _password == emptyString || _server->authenticate(_username.c_str(), _password.c_str()));
+        _authenticated = _isAuthenticated();
         if(!_authenticated){
           if (_serial_output)
             Serial.printf("Unauthenticated Update\n");
@@ -68,36 +90,537 @@ void HTTPUpdateServer::setup(WebServer *server, const String& path, const String
 ///        WiFiUDP::stopAll();
         if (_serial_output)
           Serial.printf("Update: %s\n", upload.filename.c_str());
+        _startStats();
 ///        uint32_t maxSketchSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
 ///        if(!Update.begin(maxSketchSpace)){//start with max available size
-        if(!Update.begin(UPDATE_SIZE_UNKNOWN)){//start with max available size
+        if(!_startDigest()){
+          _updaterError = F("Invalid SHA-256 digest");
+        } else if(!_target->begin()){//start with max available size
           _setUpdaterError();
+          _stopUpload();
+        } else if(!_startWrite()){
+          _updaterError = F("Not enough memory");
+          _stopUpload();
         }
+#ifdef IOTWEBCONF_UPDATE_GZIP
+        _gzipState = IOTWEBCONF_GZIP_DETECT;
+#endif
       } else if(_authenticated && upload.status == UPLOAD_FILE_WRITE && !_updaterError.length()){
         if (_serial_output) Serial.printf(".");
-        if(Update.write(upload.buf, upload.currentSize) != upload.currentSize){
+        _stats.networkWaitUs += micros() - _chunkDoneUs;
+        if (_verifyDigest)
+          mbedtls_sha256_update(&_digest, upload.buf, upload.currentSize);
+        _writeUpload(upload.buf, upload.currentSize);
+#ifdef IOTWEBCONF_UPDATE_GZIP
+        if(_gzipState == IOTWEBCONF_GZIP_FAILED){
+          _updaterError = F("Invalid compressed image");
+          _stopUpload();
+        } else
+#endif
+        if(_writeFailed){
+          // -- Later chunks and the end of the upload are skipped after an
+          // error, so everything is released here.
           _setUpdaterError();
+          _stopUpload();
         }
+        _updateStats(upload.currentSize);
       } else if(_authenticated && upload.status == UPLOAD_FILE_END && !_updaterError.length()){
-        if(Update.end(true)){ //true to set the size to the current progress
-          if (_serial_output) Serial.printf("Update Success: %u\nRebooting...\n", upload.totalSize);
+        bool complete = true;
+#ifdef IOTWEBCONF_UPDATE_GZIP
+        complete = (_gzipState == IOTWEBCONF_GZIP_PLAIN) || (_gzipState == IOTWEBCONF_GZIP_DONE);
+        _stopInflate();
+#endif
+        if(!_checkDigest()){
+          // -- The last block is not written, and the image is dropped.
+          _updaterError = F("SHA-256 digest mismatch");
+          _stopUpload();
+        } else if(!complete){
+          _updaterError = F("Incomplete compressed image");
+          _stopUpload();
         } else {
-          _setUpdaterError();
+          _stopWrite(true);
+          if(_writeFailed){
+            _setUpdaterError();
+            _stopUpload();
+          } else if(_target->end()){ //sets the size to the current progress
+            if (_serial_output) Serial.printf("Update Success: %u\nRebooting...\n", upload.totalSize);
+          } else {
+            _setUpdaterError();
+          }
         }
+        if (_serial_output && _updaterError.length()) Serial.println(_updaterError);
         if (_serial_output) Serial.setDebugOutput(false);
       } else if(_authenticated && upload.status == UPLOAD_FILE_ABORTED){
-        Update.end();
+        _updaterError = F("Upload aborted");
+        _stopUpload();
         if (_serial_output) Serial.println("Update was aborted");
       }
+      if((upload.status == UPLOAD_FILE_END) || (upload.status == UPLOAD_FILE_ABORTED) ||
+         ((_stats.state == IOTWEBCONF_UPDATE_RUNNING) && _updaterError.length())){
+        _finishStats(!_updaterError.length() && !_target->hasError());
+      }
+      _chunkDoneUs = micros();
       delay(0);
     });
 }
 
+bool HTTPUpdateServer::_isAuthenticated()
+{
+  if (_authenticator)
+    return _authenticator();
+  return (_username == emptyString || _password == emptyString || _server->authenticate(_username.c_str(), _password.c_str()));
+}
+
+/**
+ * Uploaded data arrives in chunks of any size. Update collects these in its
+ * own sector buffer, so chunks are passed on without copying. With the double
+ * buffer, chunks are collected in blocks instead, that are written to flash by
+ * a separate task while the next block is received.
+ */
+bool HTTPUpdateServer::_startWrite()
+{
+  _writeFailed = false;
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+  _blockLength = 0;
+  _blocks[0] = (uint8_t*)malloc(IOTWEBCONF_UPDATE_BLOCK_SIZE);
+  _blocks[1] = (uint8_t*)malloc(IOTWEBCONF_UPDATE_BLOCK_SIZE);
+  _fullBlocks = xQueueCreate(2, sizeof(IotWebConfUpdateBlock));
+  _freeBlocks = xQueueCreate(2, sizeof(IotWebConfUpdateBlock));
+  if ((_blocks[0] == NULL) || (_blocks[1] == NULL) ||
+      (_fullBlocks == NULL) || (_freeBlocks == NULL) ||
+      (xTaskCreate(_writerTask, "iwcUpdate", 4096, this, 1, NULL) != pdPASS))
+  {
+    free(_blocks[0]);
+    free(_blocks[1]);
+    if (_fullBlocks != NULL) vQueueDelete(_fullBlocks);
+    if (_freeBlocks != NULL) vQueueDelete(_freeBlocks);
+    return false;
+  }
+  IotWebConfUpdateBlock spare = { _blocks[1], 0, 0 };
+  xQueueSend(_freeBlocks, &spare, portMAX_DELAY);
+  _block = _blocks[0];
+#endif
+  return true;
+}
+
+void HTTPUpdateServer::_write(const uint8_t* data, size_t length)
+{
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+  while ((length > 0) && !_writeFailed)
+  {
+    size_t count = IOTWEBCONF_UPDATE_BLOCK_SIZE - _blockLength;
+    if (count > length) count = length;
+    memcpy(_block + _blockLength, data, count);
+    _blockLength += count;
+    data += count;
+    length -= count;
+    if (_blockLength == IOTWEBCONF_UPDATE_BLOCK_SIZE)
+    {
+      _writeBlock();
+    }
+  }
+#else
+  if ((length == 0) || _writeFailed)
+  {
+    return;
+  }
+  unsigned long startUs = micros();
+  if (_target->write((uint8_t*)data, length) != length)
+  {
+    _writeFailed = true;
+  }
+  _stats.flashWriteUs += micros() - startUs;
+  _stats.writtenBytes += length;
+#endif
+}
+
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+/**
+ * Block is passed to the writer task, and receiving continues in the other
+ * one.
+ */
+void HTTPUpdateServer::_writeBlock()
+{
+  IotWebConfUpdateBlock block = { _block, _blockLength, 0 };
+  xQueueSend(_fullBlocks, &block, portMAX_DELAY);
+  xQueueReceive(_freeBlocks, &block, portMAX_DELAY);
+  _countBlock(block);
+  _block = block.data;
+  _blockLength = 0;
+}
+
+/**
+ * Statistics of a written block are added, when the writer task returned it.
+ * So only the receiving task updates the statistics.
+ */
+void HTTPUpdateServer::_countBlock(const IotWebConfUpdateBlock& block)
+{
+  _stats.flashWriteUs += block.writeUs;
+  _stats.writtenBytes += block.length;
+}
+#endif
+
+/**
+ * Gzip compressed uploads are recognized by their first bytes (firmware
+ * images start with 0xE9), and are inflated on the fly.
+ */
+void HTTPUpdateServer::_writeUpload(const uint8_t* data, size_t length)
+{
+#ifdef IOTWEBCONF_UPDATE_GZIP
+  if (_gzipState == IOTWEBCONF_GZIP_DETECT)
+  {
+    _gzipState = IOTWEBCONF_GZIP_PLAIN;
+    if ((length >= 2) && (data[0] == 0x1F) && (data[1] == 0x8B))
+    {
+      _inflator = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+      _window = (uint8_t*)malloc(TINFL_LZ_DICT_SIZE);
+      if ((_inflator == NULL) || (_window == NULL))
+      {
+        _stopInflate();
+        _gzipState = IOTWEBCONF_GZIP_FAILED;
+        return;
+      }
+      tinfl_init(_inflator);
+      _windowOffset = 0;
+      _gzipState = IOTWEBCONF_GZIP_HEADER;
+      _gzipCount = 0;
+    }
+  }
+  if (_gzipState != IOTWEBCONF_GZIP_PLAIN)
+  {
+    _inflate(data, length);
+    return;
+  }
+#endif
+  _write(data, length);
+}
+
+#ifdef IOTWEBCONF_UPDATE_GZIP
+void HTTPUpdateServer::_inflate(const uint8_t* data, size_t length)
+{
+  // -- Gzip header is processed byte by byte, as it might span chunks.
+  while ((length > 0) && (_gzipState < IOTWEBCONF_GZIP_DATA))
+  {
+    uint8_t c = *data++;
+    length--;
+    switch (_gzipState)
+    {
+      case IOTWEBCONF_GZIP_HEADER:
+        if ((_gzipCount == 2) && (c != 8))
+        {
+          // -- Only deflate method is supported.
+          _gzipState = IOTWEBCONF_GZIP_FAILED;
+          return;
+        }
+        if (_gzipCount == 3)
+        {
+          _gzipFlags = c;
+        }
+        if (++_gzipCount == 10)
+        {
+          _nextGzipField();
+        }
+        break;
+      case IOTWEBCONF_GZIP_EXTRA_LENGTH:
+        _gzipSkip |= c << (8 * _gzipCount);
+        if (++_gzipCount == 2)
+        {
+          _gzipState = IOTWEBCONF_GZIP_EXTRA;
+          if (_gzipSkip == 0)
+          {
+            _nextGzipField();
+          }
+        }
+        break;
+      case IOTWEBCONF_GZIP_EXTRA:
+        if (--_gzipSkip == 0)
+        {
+          _nextGzipField();
+        }
+        break;
+      case IOTWEBCONF_GZIP_NAME:
+      case IOTWEBCONF_GZIP_COMMENT:
+        if (c == 0)
+        {
+          _nextGzipField();
+        }
+        break;
+      case IOTWEBCONF_GZIP_HEADER_CRC:
+        if (++_gzipCount == 2)
+        {
+          _nextGzipField();
+        }
+        break;
+    }
+  }
+
+  // -- The window is used as a circular output buffer, inflated data is
+  // written from there.
+  while ((_gzipState == IOTWEBCONF_GZIP_DATA) && !_writeFailed)
+  {
+    size_t inSize = length;
+    size_t outSize = TINFL_LZ_DICT_SIZE - _windowOffset;
+    tinfl_status status = tinfl_decompress(
+        _inflator, data, &inSize, _window, _window + _windowOffset, &outSize,
+        TINFL_FLAG_HAS_MORE_INPUT);
+    data += inSize;
+    length -= inSize;
+    if (outSize > 0)
+    {
+      _write(_window + _windowOffset, outSize);
+      _windowOffset = (_windowOffset + outSize) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+    if (status == TINFL_STATUS_DONE)
+    {
+      // -- Remaining data is the gzip trailer.
+      _gzipState = IOTWEBCONF_GZIP_DONE;
+    }
+    else if (status < TINFL_STATUS_DONE)
+    {
+      _gzipState = IOTWEBCONF_GZIP_FAILED;
+    }
+    else if ((status == TINFL_STATUS_NEEDS_MORE_INPUT) && (length == 0))
+    {
+      break;
+    }
+  }
+}
+
+/**
+ * Optional header fields follow each other in a fixed order.
+ */
+void HTTPUpdateServer::_nextGzipField()
+{
+  static const byte fields[][2] = {
+    { 0x04, IOTWEBCONF_GZIP_EXTRA_LENGTH },
+    { 0x08, IOTWEBCONF_GZIP_NAME },
+    { 0x10, IOTWEBCONF_GZIP_COMMENT },
+    { 0x02, IOTWEBCONF_GZIP_HEADER_CRC } };
+  _gzipCount = 0;
+  _gzipSkip = 0;
+  for (byte i = 0; i < 4; i++)
+  {
+    if (_gzipFlags & fields[i][0])
+    {
+      _gzipFlags &= ~fields[i][0];
+      _gzipState = fields[i][1];
+      return;
+    }
+  }
+  _gzipState = IOTWEBCONF_GZIP_DATA;
+}
+
+void HTTPUpdateServer::_stopInflate()
+{
+  free(_inflator);
+  free(_window);
+  _inflator = NULL;
+  _window = NULL;
+}
+#endif
+
+/**
+ * Writes the partial last block if flush is requested, and releases buffers.
+ * (Nothing to do without the double buffer, the target writes the rest on
+ * end().)
+ */
+void HTTPUpdateServer::_stopWrite(bool flush)
+{
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+  if (_block == NULL)
+  {
+    return;
+  }
+  if (flush && (_blockLength > 0) && !_writeFailed)
+  {
+    _writeBlock();
+  }
+  // -- An empty block stops the writer task, that is returned when all
+  // previous blocks are written.
+  IotWebConfUpdateBlock block = { NULL, 0, 0 };
+  xQueueSend(_fullBlocks, &block, portMAX_DELAY);
+  do
+  {
+    xQueueReceive(_freeBlocks, &block, portMAX_DELAY);
+    _countBlock(block);
+  } while (block.data != NULL);
+  vQueueDelete(_fullBlocks);
+  vQueueDelete(_freeBlocks);
+  free(_blocks[0]);
+  free(_blocks[1]);
+  _block = NULL;
+  _blockLength = 0;
+#endif
+}
+
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+void HTTPUpdateServer::_writerTask(void* updateServer)
+{
+  HTTPUpdateServer* self = (HTTPUpdateServer*)updateServer;
+  IotWebConfUpdateBlock block;
+  while (true)
+  {
+    xQueueReceive(self->_fullBlocks, &block, portMAX_DELAY);
+    unsigned long startUs = micros();
+    if ((block.data != NULL) && !self->_writeFailed &&
+        (self->_target->write(block.data, block.length) != block.length))
+    {
+      self->_writeFailed = true;
+    }
+    block.writeUs = micros() - startUs;
+    xQueueSend(self->_freeBlocks, &block, portMAX_DELAY);
+    if (block.data == NULL)
+    {
+      break;
+    }
+  }
+  vTaskDelete(NULL);
+}
+#endif
+
+/**
+ * Drops the upload on every failed outcome: releases the block buffers, the
+ * inflate buffers and the digest, and aborts the update. Nothing is left
+ * allocated, as later chunks of a failed upload are skipped.
+ */
+void HTTPUpdateServer::_stopUpload()
+{
+  _stopWrite(false);
+#ifdef IOTWEBCONF_UPDATE_GZIP
+  _stopInflate();
+#endif
+  if (_verifyDigest)
+  {
+    mbedtls_sha256_free(&_digest);
+    _verifyDigest = false;
+  }
+  _target->abort();
+}
+
+/**
+ * The digest is calculated chunk by chunk during the upload, so the image is
+ * not read back from flash.
+ */
+bool HTTPUpdateServer::_startDigest()
+{
+  if (_verifyDigest)
+  {
+    mbedtls_sha256_free(&_digest);
+    _verifyDigest = false;
+  }
+  String expected = _server->arg(IOTWEBCONF_UPDATE_SHA256_ARG);
+  if (expected.length() == 0)
+  {
+    expected = _server->header(IOTWEBCONF_UPDATE_SHA256_HEADER);
+  }
+  if (expected.length() == 0)
+  {
+    return true;
+  }
+  if (expected.length() != 64)
+  {
+    return false;
+  }
+  for (byte i = 0; i < 64; i++)
+  {
+    char c = tolower(expected[i]);
+    byte value;
+    if ((c >= '0') && (c <= '9')) value = c - '0';
+    else if ((c >= 'a') && (c <= 'f')) value = c - 'a' + 10;
+    else return false;
+    if ((i & 1) == 0) _expectedDigest[i / 2] = value << 4;
+    else _expectedDigest[i / 2] |= value;
+  }
+
+  mbedtls_sha256_init(&_digest);
+  mbedtls_sha256_starts(&_digest, 0);
+  _verifyDigest = true;
+  return true;
+}
+
+bool HTTPUpdateServer::_checkDigest()
+{
+  if (!_verifyDigest)
+  {
+    return true;
+  }
+  uint8_t actual[32];
+  mbedtls_sha256_finish(&_digest, actual);
+  mbedtls_sha256_free(&_digest);
+  _verifyDigest = false;
+  return memcmp(actual, _expectedDigest, sizeof(actual)) == 0;
+}
+
+void HTTPUpdateServer::_startStats()
+{
+  memset(&_stats, 0, sizeof(_stats));
+  _stats.state = IOTWEBCONF_UPDATE_RUNNING;
+  // -- Request body also contains the multipart framing, so this is an upper
+  // estimate only.
+  _stats.expectedBytes = _server->header("Content-Length").toInt();
+  _startMs = millis();
+  _windowStartMs = _startMs;
+  _windowBytes = 0;
+  _chunkDoneUs = micros();
+}
+
+void HTTPUpdateServer::_updateStats(size_t receivedBytes)
+{
+  unsigned long now = millis();
+  _stats.receivedBytes += receivedBytes;
+  _stats.elapsedMs = now - _startMs;
+  _windowBytes += receivedBytes;
+  if (IOTWEBCONF_UPDATE_THROUGHPUT_WINDOW_MS <= now - _windowStartMs)
+  {
+    _stats.throughput = (unsigned long)
+        ((uint64_t)_windowBytes * 1000 / (now - _windowStartMs));
+    _windowStartMs = now;
+    _windowBytes = 0;
+  }
+  if ((_stats.throughput > 0) && (_stats.expectedBytes > _stats.receivedBytes))
+  {
+    _stats.etaMs = (unsigned long)
+        ((uint64_t)(_stats.expectedBytes - _stats.receivedBytes) * 1000 /
+         _stats.throughput);
+  }
+  else
+  {
+    _stats.etaMs = 0;
+  }
+  if (_progressCallback)
+    _progressCallback(_stats);
+}
+
+void HTTPUpdateServer::_finishStats(bool succeeded)
+{
+  _stats.state = succeeded ? IOTWEBCONF_UPDATE_SUCCEEDED : IOTWEBCONF_UPDATE_FAILED;
+  _stats.elapsedMs = millis() - _startMs;
+  _stats.etaMs = 0;
+  if (_progressCallback)
+    _progressCallback(_stats);
+}
+
+void HTTPUpdateServer::_sendStatus()
+{
+  static const char* states[] = { "idle", "running", "succeeded", "failed" };
+  char json[320];
+  snprintf(json, sizeof(json),
+    "{\"state\":\"%s\",\"received\":%u,\"written\":%u,\"expected\":%u,"
+    "\"elapsedMs\":%lu,\"flashWriteUs\":%lu,\"networkWaitUs\":%lu,"
+    "\"throughput\":%lu,\"etaMs\":%lu}",
+    states[_stats.state], (unsigned int)_stats.receivedBytes,
+    (unsigned int)_stats.writtenBytes, (unsigned int)_stats.expectedBytes,
+    _stats.elapsedMs, _stats.flashWriteUs, _stats.networkWaitUs,
+    _stats.throughput, _stats.etaMs);
+  _server->sendHeader("Cache-Control", "no-cache");
+  _server->send(200, "application/json", json);
+}
+
 void HTTPUpdateServer::_setUpdaterError()
 {
-  if (_serial_output) Update.printError(Serial);
+  if (_serial_output) _target->printError(Serial);
   StreamString str;
-  Update.printError(str);
+  _target->printError(str);
   _updaterError = str.c_str();
 }
 #endif
@@ -23,9 +23,119 @@
 #include <WebServer.h>
 #include <StreamString.h>
 #include <Update.h>
+#include <mbedtls/sha256.h>
 
 #define emptyString F("")
 
+// -- Flash is written by a separate task, while the next block is received, if
+// enabled. Uploaded data is collected in two block buffers of the size below
+// for this. (Otherwise chunks are passed to Update directly, that already
+// collects them in a buffer of one flash sector.)
+//#define IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+#define IOTWEBCONF_UPDATE_BLOCK_SIZE 4096
+
+// -- When the SHA-256 digest of the image is provided as a hex string in this
+// argument (e.g. /firmware?sha256=...) or header, the upload is verified
+// against it before the update is finished.
+#define IOTWEBCONF_UPDATE_SHA256_ARG "sha256"
+#define IOTWEBCONF_UPDATE_SHA256_HEADER "X-Update-SHA256"
+
+// -- Gzip compressed images are accepted and inflated during the upload if
+// enabled. Needs about 43 KB of heap while a compressed upload is running.
+#define IOTWEBCONF_UPDATE_GZIP
+
+#ifdef IOTWEBCONF_UPDATE_GZIP
+# if __has_include(<rom/miniz.h>)
+#  include <rom/miniz.h>
+# else
+#  include <miniz.h>
+# endif
+
+// -- Parsing state of a gzip stream.
+# define IOTWEBCONF_GZIP_DETECT 0
+# define IOTWEBCONF_GZIP_PLAIN 1
+# define IOTWEBCONF_GZIP_HEADER 2
+# define IOTWEBCONF_GZIP_EXTRA_LENGTH 3
+# define IOTWEBCONF_GZIP_EXTRA 4
+# define IOTWEBCONF_GZIP_NAME 5
+# define IOTWEBCONF_GZIP_COMMENT 6
+# define IOTWEBCONF_GZIP_HEADER_CRC 7
+# define IOTWEBCONF_GZIP_DATA 8
+# define IOTWEBCONF_GZIP_DONE 9
+# define IOTWEBCONF_GZIP_FAILED 10
+#endif
+
+// -- Throughput is averaged over windows of this length.
+#define IOTWEBCONF_UPDATE_THROUGHPUT_WINDOW_MS 500
+
+// -- State of the last upload.
+#define IOTWEBCONF_UPDATE_IDLE 0
+#define IOTWEBCONF_UPDATE_RUNNING 1
+#define IOTWEBCONF_UPDATE_SUCCEEDED 2
+#define IOTWEBCONF_UPDATE_FAILED 3
+
+/**
+ * Progress of the running (or the last) upload.
+ */
+typedef struct IotWebConfUpdateStats
+{
+  byte state;
+  // -- Bytes of the image uploaded so far (compressed, if compressed).
+  size_t receivedBytes;
+  // -- Bytes written to flash.
+  size_t writtenBytes;
+  // -- Approximate upload size from the request, zero if not known.
+  size_t expectedBytes;
+  unsigned long elapsedMs;
+  // -- Time spent with writing the flash, and waiting for the network.
+  unsigned long flashWriteUs;
+  unsigned long networkWaitUs;
+  // -- Upload speed in bytes/s over the last window.
+  unsigned long throughput;
+  // -- Estimated time left, zero if not known.
+  unsigned long etaMs;
+} IotWebConfUpdateStats;
+
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+# include <freertos/FreeRTOS.h>
+# include <freertos/queue.h>
+# include <freertos/task.h>
+
+/**
+ * For internal use only.
+ */
+typedef struct IotWebConfUpdateBlock
+{
+  uint8_t* data;
+  size_t length;
+  // -- Time of writing the block, set by the writer task.
+  unsigned long writeUs;
+} IotWebConfUpdateBlock;
+#endif
+
+/**
+ * Where the uploaded image goes. The default writes the flash with Update,
+ * and reboots into the new image. Other targets can be provided with
+ * HTTPUpdateServer::setUpdateTarget(), e.g. for measuring uploads without
+ * touching the flash.
+ */
+class IotWebConfUpdateTarget
+{
+  public:
+    virtual bool begin() { return Update.begin(UPDATE_SIZE_UNKNOWN); }
+    virtual size_t write(uint8_t* data, size_t length)
+    {
+      return Update.write(data, length);
+    }
+    // -- The size is set to the amount written.
+    virtual bool end() { return Update.end(true); }
+    virtual void abort() { Update.abort(); }
+    virtual bool hasError() { return Update.hasError(); }
+    virtual void printError(Print& out) { Update.printError(out); }
+    // -- Called after the success response was sent.
+    virtual void activate() { ESP.restart(); }
+};
+
 class WebServer;
 
 class HTTPUpdateServer
@@ -56,8 +166,61 @@ class HTTPUpdateServer
       _password = password;
     }
 
+    /**
+     * Called after every uploaded chunk, and at the end of the upload. The
+     * same data is also available as JSON on the "status" path under the
+     * update path (e.g. /firmware/status).
+     */
+    void setProgressCallback(std::function<void(const IotWebConfUpdateStats&)> callback)
+    {
+      _progressCallback = callback;
+    }
+
+    const IotWebConfUpdateStats& getStats()
+    {
+      return _stats;
+    }
+
+    /**
+     * Replaces Update as the target of the uploads. The target is not copied,
+     * and must outlive the update server.
+     */
+    void setUpdateTarget(IotWebConfUpdateTarget* target)
+    {
+      _target = target;
+    }
+
+    /**
+     * Replaces the username/password check with the provided function.
+     */
+    void setAuthenticator(std::function<bool()> authenticator)
+    {
+      _authenticator = authenticator;
+    }
+
   protected:
     void _setUpdaterError();
+    bool _isAuthenticated();
+    bool _startWrite();
+    void _write(const uint8_t* data, size_t length);
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+    void _writeBlock();
+    void _countBlock(const IotWebConfUpdateBlock& block);
+#endif
+    void _stopWrite(bool flush);
+    void _stopUpload();
+    bool _startDigest();
+    bool _checkDigest();
+    void _writeUpload(const uint8_t* data, size_t length);
+    void _startStats();
+    void _updateStats(size_t receivedBytes);
+    void _finishStats(bool succeeded);
+    void _sendStatus();
+#ifdef IOTWEBCONF_UPDATE_GZIP
+    void _inflate(const uint8_t* data, size_t length);
+    void _nextGzipField();
+    void _stopInflate();
+#endif
 
   private:
     bool _serial_output;
@@ -66,6 +229,36 @@ class HTTPUpdateServer
     String _password;
     bool _authenticated;
     String _updaterError;
+    IotWebConfUpdateTarget* _target;
+    static IotWebConfUpdateTarget _defaultTarget;
+    std::function<bool()> _authenticator;
+    std::function<void(const IotWebConfUpdateStats&)> _progressCallback;
+    IotWebConfUpdateStats _stats;
+    unsigned long _startMs;
+    unsigned long _chunkDoneUs;
+    unsigned long _windowStartMs;
+    size_t _windowBytes;
+    volatile bool _writeFailed;
+    bool _verifyDigest;
+    uint8_t _expectedDigest[32];
+    mbedtls_sha256_context _digest;
+#ifdef IOTWEBCONF_UPDATE_GZIP
+    byte _gzipState;
+    byte _gzipFlags;
+    byte _gzipCount;
+    uint16_t _gzipSkip;
+    tinfl_decompressor* _inflator;
+    uint8_t* _window;
+    size_t _windowOffset;
+#endif
+#ifdef IOTWEBCONF_UPDATE_DOUBLE_BUFFER
+    uint8_t* _block;
+    size_t _blockLength;
+    uint8_t* _blocks[2];
+    QueueHandle_t _fullBlocks;
+    QueueHandle_t _freeBlocks;
+    static void _writerTask(void* updateServer);
+#endif
 };
 #endif
 
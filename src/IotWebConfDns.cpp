@@ -0,0 +1,137 @@
+#include "IotWebConfDns.h"
+
+#define IOTWEBCONF_DNS_HEADER_SIZE 12
+#define IOTWEBCONF_DNS_TYPE_A 1
+#define IOTWEBCONF_DNS_TYPE_ANY 255
+
+uint8_t IotWebConfDnsResponder::_buffer[IOTWEBCONF_DNS_MAX_PACKET];
+
+IotWebConfDnsResponder::IotWebConfDnsResponder()
+{
+}
+
+boolean IotWebConfDnsResponder::start(uint16_t port, IPAddress ip)
+{
+  // -- Answer record: name pointer to the question, type A, class IN, TTL,
+  // and the 4 bytes of the address.
+  const uint8_t answerHead[] = {
+      0xC0, 0x0C, 0x00, IOTWEBCONF_DNS_TYPE_A, 0x00, 0x01,
+      (IOTWEBCONF_DNS_TTL >> 24) & 0xFF, (IOTWEBCONF_DNS_TTL >> 16) & 0xFF,
+      (IOTWEBCONF_DNS_TTL >> 8) & 0xFF, IOTWEBCONF_DNS_TTL & 0xFF,
+      0x00, 0x04};
+  memcpy(this->_answer, answerHead, sizeof(answerHead));
+  for (byte i = 0; i < 4; i++)
+  {
+    this->_answer[sizeof(answerHead) + i] = ip[i];
+  }
+
+  this->stop();
+  this->_running = this->_udp.begin(port) == 1;
+  return this->_running;
+}
+
+void IotWebConfDnsResponder::stop()
+{
+  if (this->_running)
+  {
+    this->_udp.stop();
+    this->_running = false;
+  }
+}
+
+boolean IotWebConfDnsResponder::processNextRequest()
+{
+  if (!this->_running)
+  {
+    return false;
+  }
+  int size = this->_udp.parsePacket();
+  if (size <= 0)
+  {
+    return false;
+  }
+  if (size > IOTWEBCONF_DNS_MAX_PACKET)
+  {
+    // -- Not a query we want to answer, skip it.
+    this->_udp.flush();
+    return true;
+  }
+  size = this->_udp.read(this->_buffer, size);
+  int length = this->respond(this->_buffer, size);
+  if (length <= 0)
+  {
+    return true;
+  }
+
+  this->_udp.beginPacket(this->_udp.remoteIP(), this->_udp.remotePort());
+  this->_udp.write(this->_buffer, length);
+  this->_udp.endPacket();
+  this->_answeredCount += 1;
+  return true;
+}
+
+int IotWebConfDnsResponder::respond(uint8_t* packet, int size)
+{
+  uint16_t qtype;
+  int length = parseQuestion(packet, size, &qtype);
+  if (length <= 0)
+  {
+    return 0;
+  }
+
+  // -- Turn the request into a response in place: QR and AA flags are set,
+  // opcode and RD are kept, RCODE is NoError. Only the question is kept.
+  boolean answered =
+      (qtype == IOTWEBCONF_DNS_TYPE_A) || (qtype == IOTWEBCONF_DNS_TYPE_ANY);
+  packet[2] = 0x84 | (packet[2] & 0x01);
+  packet[3] = 0x80;
+  packet[6] = 0x00;
+  packet[7] = answered ? 1 : 0;
+  memset(packet + 8, 0, 4);
+  if (answered)
+  {
+    memcpy(packet + length, this->_answer, sizeof(this->_answer));
+    length += sizeof(this->_answer);
+  }
+  return length;
+}
+
+/**
+ * Validates a standard query with a single question. Returns the length of
+ * the header and the question, or 0 if the packet is not to be answered.
+ */
+int IotWebConfDnsResponder::parseQuestion(
+    const uint8_t* packet, int size, uint16_t* qtype)
+{
+  if ((size < IOTWEBCONF_DNS_HEADER_SIZE) ||
+      (size > IOTWEBCONF_DNS_MAX_PACKET) ||
+      ((packet[2] & 0x80) != 0) || // -- Not a query.
+      ((packet[2] & 0x78) != 0) || // -- Not a standard query.
+      (packet[4] != 0) || (packet[5] != 1))
+  {
+    return 0;
+  }
+  int pos = IOTWEBCONF_DNS_HEADER_SIZE;
+  while ((pos < size) && (packet[pos] != 0))
+  {
+    if ((packet[pos] & 0xC0) != 0)
+    {
+      // -- Compression is not expected in a question.
+      return 0;
+    }
+    pos += packet[pos] + 1;
+  }
+  // -- Terminating zero, type and class. (A label running past the end of
+  // the packet also ends up here.)
+  if (pos + 5 > size)
+  {
+    return 0;
+  }
+  *qtype = (packet[pos + 1] << 8) | packet[pos + 2];
+  // -- Answer must still fit.
+  if (pos + 5 + (int)sizeof(_answer) > IOTWEBCONF_DNS_MAX_PACKET)
+  {
+    return 0;
+  }
+  return pos + 5;
+}
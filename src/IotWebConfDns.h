@@ -0,0 +1,62 @@
+
+#ifndef IotWebConfDns_h
+#define IotWebConfDns_h
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+// -- Largest DNS packet handled. (Plain UDP DNS is limited to 512 bytes.)
+#define IOTWEBCONF_DNS_MAX_PACKET 512
+
+// -- TTL of the answers in seconds.
+#define IOTWEBCONF_DNS_TTL 60
+
+/**
+ * Minimal DNS responder for the captive portal. Every A query is answered
+ * with the same address. The answer record is prepared on start, so a
+ * response is made by patching the request in place.
+ */
+class IotWebConfDnsResponder
+{
+public:
+  IotWebConfDnsResponder();
+
+  /**
+   * Start listening.
+   *   @port - UDP port to listen on.
+   *   @ip - The address provided for every A query.
+   */
+  boolean start(uint16_t port, IPAddress ip);
+  void stop();
+
+  /**
+   * Answers one pending query. Returns false, when there was no query pending.
+   */
+  boolean processNextRequest();
+
+  /**
+   * Returns the number of queries answered since startup.
+   */
+  unsigned long getAnsweredCount() { return this->_answeredCount; }
+
+  /**
+   * Turns the query in the packet into a response in place. Returns the
+   * length of the response, or 0 if the packet is not to be answered.
+   *   @packet - Buffer of IOTWEBCONF_DNS_MAX_PACKET bytes with the query.
+   *   @size - Length of the query.
+   */
+  int respond(uint8_t* packet, int size);
+
+private:
+  WiFiUDP _udp;
+  boolean _running = false;
+  unsigned long _answeredCount = 0;
+  uint8_t _answer[16];
+  // -- A query is answered before the next one is read, so responders share
+  // the packet buffer.
+  static uint8_t _buffer[IOTWEBCONF_DNS_MAX_PACKET];
+
+  static int parseQuestion(const uint8_t* packet, int size, uint16_t* qtype);
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "IotWebConfHeap.h"
+
+void IotWebConfHeapTracker::requestFinished(byte kind, uint32_t freeHeapBefore)
+{
+  uint32_t freeHeap;
+  uint32_t largestBlock;
+  sample(&freeHeap, &largestBlock);
+
+  if (kind < IOTWEBCONF_HEAP_KINDS)
+  {
+    IotWebConfHeapUsage* usage = &this->_usage[kind];
+    usage->requests += 1;
+    if (freeHeap < freeHeapBefore)
+    {
+      uint32_t retained = freeHeapBefore - freeHeap;
+      usage->retainingRequests += 1;
+      usage->retainedBytes += retained;
+      if (usage->maxRetainedBytes < retained)
+      {
+        usage->maxRetainedBytes = retained;
+      }
+    }
+  }
+
+  if (this->_minFreeHeap > freeHeap)
+  {
+    this->_minFreeHeap = freeHeap;
+  }
+  if (this->_minLargestBlock > largestBlock)
+  {
+    this->_minLargestBlock = largestBlock;
+  }
+  if ((freeHeap > 0) && (largestBlock <= freeHeap))
+  {
+    byte fragmentation = 100 - (uint64_t)largestBlock * 100 / freeHeap;
+    if (this->_maxFragmentation < fragmentation)
+    {
+      this->_maxFragmentation = fragmentation;
+    }
+  }
+}
+
+void IotWebConfHeapTracker::reset()
+{
+  memset(this->_usage, 0, sizeof(this->_usage));
+  this->_minFreeHeap = UINT32_MAX;
+  this->_minLargestBlock = UINT32_MAX;
+  this->_maxFragmentation = 0;
+}
+
+void IotWebConfHeapTracker::sample(uint32_t* freeHeap, uint32_t* largestBlock)
+{
+  *freeHeap = ESP.getFreeHeap();
+#ifdef ESP8266
+  *largestBlock = ESP.getMaxFreeBlockSize();
+#elif defined(ESP32)
+  *largestBlock = ESP.getMaxAllocHeap();
+#endif
+}
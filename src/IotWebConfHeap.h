@@ -0,0 +1,96 @@
+
+#ifndef IotWebConfHeap_h
+#define IotWebConfHeap_h
+
+#include <Arduino.h>
+
+// -- Number of request kinds tracked (see the IOTWEBCONF_HANDLER_* constants).
+#define IOTWEBCONF_HEAP_KINDS 7
+
+/**
+ * Heap usage of a request kind.
+ */
+typedef struct IotWebConfHeapUsage
+{
+  uint32_t requests;
+  // -- Requests leaving the heap with less free memory than before.
+  uint32_t retainingRequests;
+  uint32_t retainedBytes;
+  uint32_t maxRetainedBytes;
+} IotWebConfHeapUsage;
+
+/**
+ * Tracks the free heap before and after each request, and the low watermarks
+ * of the heap measured after the requests. Memory kept by a request (or freed
+ * by it) shows up as the difference, and fragmentation is computed from the
+ * largest free block compared to all free memory.
+ * Note, that the free heap is shared with WiFi and lwIP, that allocate and
+ * release buffers while a request is served. So on a connected device the
+ * retained bytes are an upper estimate, that mixes the network stack into the
+ * requests. The heap soak of the benchmark example replays the requests
+ * without a network stack running, to measure the requests alone.
+ */
+class IotWebConfHeapTracker
+{
+public:
+  /**
+   * Returns the usage of a request kind, or NULL for an unknown kind.
+   */
+  const IotWebConfHeapUsage* getUsage(byte kind)
+  {
+    return kind < IOTWEBCONF_HEAP_KINDS ? &this->_usage[kind] : NULL;
+  }
+
+  uint32_t getMinFreeHeap() { return this->_minFreeHeap; }
+  uint32_t getMinLargestBlock() { return this->_minLargestBlock; }
+
+  /**
+   * Highest fragmentation seen in percents: 0 means, that all free memory is
+   * in one block.
+   */
+  byte getMaxFragmentation() { return this->_maxFragmentation; }
+
+  /**
+   * Clears all counters and watermarks.
+   */
+  void reset();
+
+  /**
+   * Actual free heap and size of the largest free block.
+   */
+  static void sample(uint32_t* freeHeap, uint32_t* largestBlock);
+
+  // -- For internal use only
+  void requestFinished(byte kind, uint32_t freeHeapBefore);
+
+private:
+  IotWebConfHeapUsage _usage[IOTWEBCONF_HEAP_KINDS] = {};
+  uint32_t _minFreeHeap = UINT32_MAX;
+  uint32_t _minLargestBlock = UINT32_MAX;
+  byte _maxFragmentation = 0;
+};
+
+/**
+ * Tracks the heap from its creation until it goes out of scope.
+ */
+class IotWebConfHeapScope
+{
+public:
+  IotWebConfHeapScope(IotWebConfHeapTracker* tracker, byte kind)
+  {
+    this->_tracker = tracker;
+    this->_kind = kind;
+    this->_freeHeapBefore = ESP.getFreeHeap();
+  }
+  ~IotWebConfHeapScope()
+  {
+    this->_tracker->requestFinished(this->_kind, this->_freeHeapBefore);
+  }
+
+private:
+  IotWebConfHeapTracker* _tracker;
+  byte _kind;
+  uint32_t _freeHeapBefore;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "IotWebConfLog.h"
+
+#define IOTWEBCONF_LOG_MASK (IOTWEBCONF_LOG_SIZE - 1)
+
+IotWebConfLogRecord IotWebConfLog::_records[IOTWEBCONF_LOG_SIZE];
+volatile unsigned long IotWebConfLog::_nextSequence = 0;
+unsigned long IotWebConfLog::_drainSequence = 0;
+
+void IotWebConfLog::add(byte level, const __FlashStringHelper* message)
+{
+  next(level, message);
+  publish();
+}
+
+void IotWebConfLog::add(
+    byte level, const __FlashStringHelper* message, const char* text)
+{
+  IotWebConfLogRecord* record = next(level, message);
+  strncpy(record->text, text == NULL ? "" : text, IOTWEBCONF_LOG_TEXT_LEN - 1);
+  record->text[IOTWEBCONF_LOG_TEXT_LEN - 1] = '\0';
+  publish();
+}
+
+void IotWebConfLog::add(
+    byte level, const __FlashStringHelper* message, long value)
+{
+  IotWebConfLogRecord* record = next(level, message);
+  record->value = value;
+  record->hasValue = true;
+  publish();
+}
+
+/**
+ * Only constant data is stored, formatting is left for the reader.
+ */
+IotWebConfLogRecord* IotWebConfLog::next(
+    byte level, const __FlashStringHelper* message)
+{
+  IotWebConfLogRecord* record = &_records[_nextSequence & IOTWEBCONF_LOG_MASK];
+  record->timeMs = millis();
+  record->message = message;
+  record->level = level;
+  record->hasValue = false;
+  record->text[0] = '\0';
+  return record;
+}
+
+void IotWebConfLog::publish()
+{
+  _nextSequence = _nextSequence + 1;
+}
+
+boolean IotWebConfLog::format(unsigned long sequence, char* buffer, size_t size)
+{
+  if ((sequence < getFirstSequence()) || (sequence >= _nextSequence))
+  {
+    return false;
+  }
+  IotWebConfLogRecord* record = &_records[sequence & IOTWEBCONF_LOG_MASK];
+  static const char levels[] = "-EID";
+  int length = snprintf(
+      buffer, size, "[%8lu] %c ", record->timeMs,
+      levels[record->level & 0x03]);
+  if ((length < 0) || ((size_t)length >= size))
+  {
+    return true;
+  }
+  strncpy_P(buffer + length, (PGM_P)record->message, size - length);
+  buffer[size - 1] = '\0';
+  length = strlen(buffer);
+  if (record->hasValue)
+  {
+    snprintf(buffer + length, size - length, "%ld", record->value);
+  }
+  else if (record->text[0] != '\0')
+  {
+    snprintf(buffer + length, size - length, "%s", record->text);
+  }
+  // -- Record might have been overwritten while formatting.
+  return sequence >= getFirstSequence();
+}
+
+void IotWebConfLog::drain(Print* output, byte maxRecords)
+{
+  if (_drainSequence < getFirstSequence())
+  {
+    output->print(F("... "));
+    output->print(getFirstSequence() - _drainSequence);
+    output->println(F(" log records lost"));
+    _drainSequence = getFirstSequence();
+  }
+  char line[IOTWEBCONF_LOG_LINE_LEN];
+  while ((maxRecords-- > 0) && (_drainSequence < _nextSequence))
+  {
+    if (format(_drainSequence, line, sizeof(line)))
+    {
+      output->println(line);
+    }
+    _drainSequence += 1;
+  }
+}
@@ -0,0 +1,123 @@
+
+#ifndef IotWebConfLog_h
+#define IotWebConfLog_h
+
+#include <Arduino.h>
+
+// -- Log levels. Messages above IOTWEBCONF_LOG_LEVEL are compiled out.
+#define IOTWEBCONF_LOG_LEVEL_NONE 0
+#define IOTWEBCONF_LOG_LEVEL_ERROR 1
+#define IOTWEBCONF_LOG_LEVEL_INFO 2
+#define IOTWEBCONF_LOG_LEVEL_DEBUG 3
+
+#ifndef IOTWEBCONF_LOG_LEVEL
+# define IOTWEBCONF_LOG_LEVEL IOTWEBCONF_LOG_LEVEL_INFO
+#endif
+
+// -- Number of log records kept. Should be a power of two.
+#define IOTWEBCONF_LOG_SIZE 32
+
+// -- Variable text stored with a record is truncated to this length.
+#define IOTWEBCONF_LOG_TEXT_LEN 24
+
+// -- Maximal length of a formatted record.
+#define IOTWEBCONF_LOG_LINE_LEN 96
+
+// -- Logging macros. MSG should be a flash string (F("...")), TEXT is copied.
+#if IOTWEBCONF_LOG_LEVEL >= IOTWEBCONF_LOG_LEVEL_ERROR
+# define IOTWEBCONF_LOG_ERROR(MSG) \
+    IotWebConfLog::add(IOTWEBCONF_LOG_LEVEL_ERROR, MSG)
+#else
+# define IOTWEBCONF_LOG_ERROR(MSG)
+#endif
+#if IOTWEBCONF_LOG_LEVEL >= IOTWEBCONF_LOG_LEVEL_INFO
+# define IOTWEBCONF_LOG_INFO(MSG) \
+    IotWebConfLog::add(IOTWEBCONF_LOG_LEVEL_INFO, MSG)
+# define IOTWEBCONF_LOG_INFO_TEXT(MSG, TEXT) \
+    IotWebConfLog::add(IOTWEBCONF_LOG_LEVEL_INFO, MSG, TEXT)
+# define IOTWEBCONF_LOG_INFO_VALUE(MSG, VALUE) \
+    IotWebConfLog::add(IOTWEBCONF_LOG_LEVEL_INFO, MSG, (long)(VALUE))
+#else
+# define IOTWEBCONF_LOG_INFO(MSG)
+# define IOTWEBCONF_LOG_INFO_TEXT(MSG, TEXT)
+# define IOTWEBCONF_LOG_INFO_VALUE(MSG, VALUE)
+#endif
+#if IOTWEBCONF_LOG_LEVEL >= IOTWEBCONF_LOG_LEVEL_DEBUG
+# define IOTWEBCONF_LOG_DEBUG(MSG) \
+    IotWebConfLog::add(IOTWEBCONF_LOG_LEVEL_DEBUG, MSG)
+# define IOTWEBCONF_LOG_DEBUG_TEXT(MSG, TEXT) \
+    IotWebConfLog::add(IOTWEBCONF_LOG_LEVEL_DEBUG, MSG, TEXT)
+#else
+# define IOTWEBCONF_LOG_DEBUG(MSG)
+# define IOTWEBCONF_LOG_DEBUG_TEXT(MSG, TEXT)
+#endif
+
+/**
+ * For internal use only.
+ */
+typedef struct IotWebConfLogRecord
+{
+  unsigned long timeMs;
+  const __FlashStringHelper* message;
+  long value;
+  byte level;
+  boolean hasValue;
+  char text[IOTWEBCONF_LOG_TEXT_LEN];
+} IotWebConfLogRecord;
+
+/**
+ * Log records are stored in a RAM ring buffer, and formatted only when read.
+ * Records are never removed by reading: the buffer keeps the last
+ * IOTWEBCONF_LOG_SIZE records, and every reader tracks its own position with
+ * the sequence number of the records. Adding a record writes the slot first,
+ * and publishes it by incrementing the sequence afterwards.
+ */
+class IotWebConfLog
+{
+public:
+  static void add(byte level, const __FlashStringHelper* message);
+  static void add(byte level, const __FlashStringHelper* message, const char* text);
+  static void add(byte level, const __FlashStringHelper* message, long value);
+
+  /**
+   * Sequence number of the next record.
+   */
+  static unsigned long getNextSequence() { return _nextSequence; }
+
+  /**
+   * Sequence number of the oldest record still kept.
+   */
+  static unsigned long getFirstSequence()
+  {
+    return _nextSequence < IOTWEBCONF_LOG_SIZE
+        ? 0
+        : _nextSequence - IOTWEBCONF_LOG_SIZE;
+  }
+
+  /**
+   * Format a record as a text line (without line ending). Returns false, when
+   * the record is not kept anymore.
+   */
+  static boolean format(unsigned long sequence, char* buffer, size_t size);
+
+  /**
+   * Returns true, if there are records not printed by drain() yet.
+   */
+  static boolean hasPending() { return _drainSequence < _nextSequence; }
+
+  /**
+   * Print the records not printed yet to the output, but not more than
+   * maxRecords. Skipped (overwritten) records are reported.
+   */
+  static void drain(Print* output, byte maxRecords);
+
+private:
+  static IotWebConfLogRecord _records[IOTWEBCONF_LOG_SIZE];
+  static volatile unsigned long _nextSequence;
+  static unsigned long _drainSequence;
+
+  static IotWebConfLogRecord* next(byte level, const __FlashStringHelper* message);
+  static void publish();
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "IotWebConfPageWriter.h"
+
+IotWebConfPageWriter::IotWebConfPageWriter(IotWebConfServer* server)
+{
+  this->_server = server;
+}
+
+IotWebConfPageWriter::IotWebConfPageWriter(Print* client)
+{
+  this->_client = client;
+}
+
+void IotWebConfPageWriter::write(const char* data, size_t length)
+{
+  while (length > 0)
+  {
+    size_t count = sizeof(this->_buffer) - this->_length;
+    if (count > length)
+    {
+      count = length;
+    }
+    memcpy(this->_buffer + this->_length, data, count);
+    this->_length += count;
+    data += count;
+    length -= count;
+    if (this->_length == sizeof(this->_buffer))
+    {
+      this->flush();
+    }
+  }
+}
+
+void IotWebConfPageWriter::printP(PGM_P text)
+{
+  this->printTemplate(text, true, "", NULL);
+}
+
+/**
+ * Text is copied character by character, as flash can only be read in aligned
+ * words on ESP8266.
+ */
+void IotWebConfPageWriter::printTemplate(
+    const char* text, boolean progmem, const char* keys,
+    const char* const* values)
+{
+  char c = progmem ? pgm_read_byte(text) : *text;
+  while (c != '\0')
+  {
+    char next = progmem ? pgm_read_byte(text + 1) : text[1];
+    const char* key = NULL;
+    if ((c == '{') && (next != '\0') && (keys[0] != '\0') &&
+        ((progmem ? pgm_read_byte(text + 2) : text[2]) == '}'))
+    {
+      key = strchr(keys, next);
+    }
+    if (key != NULL)
+    {
+      const char* value = values[key - keys];
+      if (value != NULL)
+      {
+        this->print(value);
+      }
+      text += 3;
+    }
+    else
+    {
+      if (this->_length == sizeof(this->_buffer))
+      {
+        this->flush();
+      }
+      this->_buffer[this->_length++] = c;
+      text += 1;
+    }
+    c = progmem ? pgm_read_byte(text) : *text;
+  }
+}
+
+void IotWebConfPageWriter::flush()
+{
+  if (this->_length == 0)
+  {
+    return;
+  }
+  if (this->_server != NULL)
+  {
+    this->_server->write((const uint8_t*)this->_buffer, this->_length);
+  }
+  else
+  {
+    this->_client->write((const uint8_t*)this->_buffer, this->_length);
+  }
+  this->_length = 0;
+}
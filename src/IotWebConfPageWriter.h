@@ -0,0 +1,57 @@
+
+#ifndef IotWebConfPageWriter_h
+#define IotWebConfPageWriter_h
+
+#include <IotWebConfServer.h>
+
+// -- Size of the buffer collecting the page, before it is written to the
+// client.
+#define IOTWEBCONF_PAGE_BUFFER_SIZE 256
+
+/**
+ * Writes a page through a fixed buffer to the client of the actual request
+ * (or to a client taken over from it), so the page is never built in memory.
+ * Texts can be written from flash, and {x} placeholders of templates are
+ * replaced while writing. The buffer is written out, when it is full, and
+ * when the writer goes out of scope.
+ */
+class IotWebConfPageWriter
+{
+public:
+  IotWebConfPageWriter(IotWebConfServer* server);
+  IotWebConfPageWriter(Print* client);
+  ~IotWebConfPageWriter() { this->flush(); }
+
+  void write(const char* data, size_t length);
+  void print(const char* text) { this->write(text, strlen(text)); }
+  void printP(PGM_P text);
+
+  /**
+   * Write the text with the {x} placeholders replaced, where x is a character
+   * of keys, and the value is the matching item of values (NULL is written
+   * as empty).
+   */
+  void printTemplate(
+      const char* text, const char* keys, const char* const* values)
+  {
+    this->printTemplate(text, false, keys, values);
+  }
+  void printTemplateP(PGM_P text, const char* keys, const char* const* values)
+  {
+    this->printTemplate(text, true, keys, values);
+  }
+
+  void flush();
+
+private:
+  IotWebConfServer* _server = NULL;
+  Print* _client = NULL;
+  size_t _length = 0;
+  char _buffer[IOTWEBCONF_PAGE_BUFFER_SIZE];
+
+  void printTemplate(
+      const char* text, boolean progmem, const char* keys,
+      const char* const* values);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include "IotWebConfPathTable.h"
+
+#define IOTWEBCONF_PATH_TABLE_MASK (IOTWEBCONF_PATH_TABLE_SLOTS - 1)
+
+IotWebConfPathTable::IotWebConfPathTable()
+{
+  memset(this->_slots, -1, sizeof(this->_slots));
+}
+
+int8_t IotWebConfPathTable::add(const char* path)
+{
+  if (this->_count >= IOTWEBCONF_PATH_TABLE_SLOTS - 1)
+  {
+    return -1;
+  }
+  byte slot = hash(path, strlen(path));
+  while (this->_slots[slot] >= 0)
+  {
+    slot = (slot + 1) & IOTWEBCONF_PATH_TABLE_MASK;
+  }
+  this->_paths[this->_count] = path;
+  this->_slots[slot] = this->_count;
+  return this->_count++;
+}
+
+int8_t IotWebConfPathTable::find(const char* path, size_t length)
+{
+  byte slot = hash(path, length);
+  // -- There is at least one empty slot, that ends the search.
+  while (this->_slots[slot] >= 0)
+  {
+    if (strcmp(this->_paths[this->_slots[slot]], path) == 0)
+    {
+      return this->_slots[slot];
+    }
+    slot = (slot + 1) & IOTWEBCONF_PATH_TABLE_MASK;
+  }
+  return -1;
+}
+
+byte IotWebConfPathTable::hash(const char* path, size_t length)
+{
+  return (length * 3 + (length < 2 ? 0 : path[1])) & IOTWEBCONF_PATH_TABLE_MASK;
+}
@@ -0,0 +1,46 @@
+
+#ifndef IotWebConfPathTable_h
+#define IotWebConfPathTable_h
+
+#include <Arduino.h>
+
+// -- Number of slots in a path table. Must be a power of two. One slot is
+// always kept empty, so at most one less paths can be added.
+#define IOTWEBCONF_PATH_TABLE_SLOTS 16
+
+/**
+ * Hash table of constant URL paths with open addressing. Paths are looked up
+ * by their length and second character, then compared; a lookup visits
+ * the colliding paths only. Nothing is ever removed from the table, a path
+ * not fitting is refused instead of evicting an other one.
+ */
+class IotWebConfPathTable
+{
+public:
+  IotWebConfPathTable();
+
+  /**
+   * Add a path. Returns the index of the path (indexes are given in the order
+   * of adding, starting with 0), or -1 if the table is full. The path is not
+   * copied, it must outlive the table.
+   */
+  int8_t add(const char* path);
+
+  /**
+   * Returns the index of the path, or -1 if it was not added.
+   *   @path - The path looked for.
+   *   @length - Length of the path.
+   */
+  int8_t find(const char* path, size_t length);
+
+  byte getCount() { return this->_count; }
+
+private:
+  const char* _paths[IOTWEBCONF_PATH_TABLE_SLOTS - 1];
+  int8_t _slots[IOTWEBCONF_PATH_TABLE_SLOTS];
+  byte _count = 0;
+
+  static byte hash(const char* path, size_t length);
+};
+
+#endif
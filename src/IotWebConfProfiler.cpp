@@ -0,0 +1,43 @@
+#include "IotWebConfProfiler.h"
+
+static const char* const IOTWEBCONF_PROFILE_NAMES[] = {
+    "loop", "timers", "http", "dns", "save",
+    "setup_ap", "config", "not_found", "captive"};
+
+void IotWebConfProfiler::add(byte phase, unsigned long durationUs)
+{
+  if (phase >= IOTWEBCONF_PROFILE_COUNT)
+  {
+    return;
+  }
+  IotWebConfHistogram* histogram = &this->_histograms[phase];
+  // -- Bucket is the number of significant bits.
+  byte bucket = durationUs == 0 ? 0 : 32 - __builtin_clz((uint32_t)durationUs);
+  if (bucket >= IOTWEBCONF_PROFILE_BUCKETS)
+  {
+    bucket = IOTWEBCONF_PROFILE_BUCKETS - 1;
+  }
+  histogram->buckets[bucket] += 1;
+  histogram->count += 1;
+  histogram->sumUs += durationUs;
+  if (histogram->maxUs < durationUs)
+  {
+    histogram->maxUs = durationUs;
+  }
+}
+
+void IotWebConfProfiler::reset()
+{
+  memset(this->_histograms, 0, sizeof(this->_histograms));
+}
+
+const char* IotWebConfProfiler::phaseName(byte phase)
+{
+  return phase < IOTWEBCONF_PROFILE_COUNT ? IOTWEBCONF_PROFILE_NAMES[phase]
+                                          : "-";
+}
+
+unsigned long IotWebConfProfiler::bucketLimitUs(byte bucket)
+{
+  return bucket < IOTWEBCONF_PROFILE_BUCKETS - 1 ? 1UL << bucket : 0;
+}
@@ -0,0 +1,96 @@
+
+#ifndef IotWebConfProfiler_h
+#define IotWebConfProfiler_h
+
+#include <Arduino.h>
+
+// -- Number of histogram buckets. Bucket 0 counts durations below 1us, bucket
+// i counts durations from 2^(i-1)us below 2^i us, the last bucket counts all
+// longer durations.
+#define IOTWEBCONF_PROFILE_BUCKETS 22
+
+// -- Phases of doLoop() and request handlers measured.
+#define IOTWEBCONF_PROFILE_LOOP 0
+#define IOTWEBCONF_PROFILE_TIMERS 1
+#define IOTWEBCONF_PROFILE_HTTP 2
+#define IOTWEBCONF_PROFILE_DNS 3
+#define IOTWEBCONF_PROFILE_SAVE 4
+#define IOTWEBCONF_PROFILE_SETUP_AP 5
+#define IOTWEBCONF_PROFILE_CONFIG 6
+#define IOTWEBCONF_PROFILE_NOT_FOUND 7
+#define IOTWEBCONF_PROFILE_CAPTIVE 8
+#define IOTWEBCONF_PROFILE_COUNT 9
+
+/**
+ * Log-scaled histogram of durations.
+ */
+typedef struct IotWebConfHistogram
+{
+  uint32_t count;
+  uint32_t maxUs;
+  uint64_t sumUs;
+  uint32_t buckets[IOTWEBCONF_PROFILE_BUCKETS];
+} IotWebConfHistogram;
+
+/**
+ * Durations of the phases are collected in histograms of fixed size. Adding a
+ * sample is a few integer operations, nothing is allocated.
+ */
+class IotWebConfProfiler
+{
+public:
+  void add(byte phase, unsigned long durationUs);
+
+  /**
+   * Returns the histogram of a phase (one of the IOTWEBCONF_PROFILE_*
+   * constants), or NULL for an unknown phase.
+   */
+  const IotWebConfHistogram* getHistogram(byte phase)
+  {
+    return phase < IOTWEBCONF_PROFILE_COUNT ? &this->_histograms[phase] : NULL;
+  }
+
+  /**
+   * Clears all histograms.
+   */
+  void reset();
+
+  /**
+   * Short name of a phase.
+   */
+  static const char* phaseName(byte phase);
+
+  /**
+   * Upper limit of a bucket in microseconds (exclusive). Zero for the last,
+   * open bucket.
+   */
+  static unsigned long bucketLimitUs(byte bucket);
+
+private:
+  IotWebConfHistogram _histograms[IOTWEBCONF_PROFILE_COUNT] = {};
+};
+
+/**
+ * Measures the time from its creation until it goes out of scope.
+ */
+class IotWebConfProfileScope
+{
+public:
+  IotWebConfProfileScope(IotWebConfProfiler* profiler, byte phase)
+  {
+    this->_profiler = profiler;
+    this->_phase = phase;
+    this->_startUs = micros();
+  }
+  ~IotWebConfProfileScope()
+  {
+    this->_profiler->add(this->_phase, micros() - this->_startUs);
+  }
+
+private:
+  IotWebConfProfiler* _profiler;
+  byte _phase;
+  unsigned long _startUs;
+};
+
+#endif
@@ -0,0 +1,403 @@
+#include "IotWebConfPullUpdate.h"
+
+boolean IotWebConfPullUpdate::begin(const char* url, const char* sha256)
+{
+  this->stop();
+
+  if ((sha256 == NULL) || !parseDigest(sha256, this->_expectedDigest))
+  {
+    return false;
+  }
+
+  // -- Host and path are stored in the URL buffer as two strings.
+  if (strncmp(url, "http://", 7) != 0)
+  {
+    return false;
+  }
+  url += 7;
+  size_t hostLength = strcspn(url, ":/");
+  const char* path = url + hostLength;
+  uint16_t port = 80;
+  if (*path == ':')
+  {
+    char* portEnd;
+    port = strtoul(path + 1, &portEnd, 10);
+    path = portEnd;
+  }
+  if (*path == '\0')
+  {
+    path = "/";
+  }
+  if ((hostLength == 0) || (port == 0) || (*path != '/') ||
+      (hostLength + 1 + strlen(path) + 1 > IOTWEBCONF_PULL_URL_LEN))
+  {
+    return false;
+  }
+  memcpy(this->_url, url, hostLength);
+  this->_url[hostLength] = '\0';
+  strcpy(this->_url + hostLength + 1, path);
+  this->_host = this->_url;
+  this->_path = this->_url + hostLength + 1;
+  this->_port = port;
+  this->_resolved = false;
+
+  this->_received = 0;
+  this->_size = 0;
+  this->_retryCount = 0;
+  this->_retryDelayMs = 0;
+  this->_lastActivityMs = millis();
+  this->_state = IOTWEBCONF_PULL_WAITING;
+  return true;
+}
+
+void IotWebConfPullUpdate::stop()
+{
+  if ((this->_state == IOTWEBCONF_PULL_WAITING) ||
+      (this->_state == IOTWEBCONF_PULL_HEADER) ||
+      (this->_state == IOTWEBCONF_PULL_BODY))
+  {
+    this->fail();
+  }
+  this->_state = IOTWEBCONF_PULL_IDLE;
+}
+
+byte IotWebConfPullUpdate::process(size_t maxBytes)
+{
+  switch (this->_state)
+  {
+    case IOTWEBCONF_PULL_WAITING:
+      if (this->_retryDelayMs <= millis() - this->_lastActivityMs)
+      {
+        this->connect();
+      }
+      break;
+    case IOTWEBCONF_PULL_HEADER:
+      this->readHeader();
+      break;
+    case IOTWEBCONF_PULL_BODY:
+      this->readBody(maxBytes);
+      break;
+  }
+  return this->_state;
+}
+
+void IotWebConfPullUpdate::connect()
+{
+  // -- Name is resolved once, retries connect to the same address.
+  if (!this->_resolved)
+  {
+    if (!WiFi.hostByName(this->_host, this->_address))
+    {
+      this->retry();
+      return;
+    }
+    this->_resolved = true;
+  }
+#ifdef ESP32
+  boolean connected = this->_client.connect(
+      this->_address, this->_port, IOTWEBCONF_PULL_CONNECT_TIMEOUT_MS);
+#else
+  this->_client.setTimeout(IOTWEBCONF_PULL_CONNECT_TIMEOUT_MS);
+  boolean connected = this->_client.connect(this->_address, this->_port);
+#endif
+  if (!connected)
+  {
+    this->retry();
+    return;
+  }
+
+  // -- Already received part of the image is not requested again.
+  char request[IOTWEBCONF_PULL_URL_LEN + 96];
+  int length = snprintf(
+      request, sizeof(request),
+      "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n", this->_path,
+      this->_host);
+  if (this->_received > 0)
+  {
+    length += snprintf(
+        request + length, sizeof(request) - length, "Range: bytes=%u-\r\n",
+        (unsigned int)this->_received);
+  }
+  length += snprintf(request + length, sizeof(request) - length, "\r\n");
+  this->_client.write((const uint8_t*)request, length);
+
+  this->_statusCode = 0;
+  this->_contentLength = 0;
+  this->_rangeStart = 0;
+  this->_rangeTotal = 0;
+  this->_lineLength = 0;
+  this->_lastActivityMs = millis();
+  this->_state = IOTWEBCONF_PULL_HEADER;
+}
+
+/**
+ * Response header is processed line by line, as the data arrives.
+ */
+void IotWebConfPullUpdate::readHeader()
+{
+  while (this->_client.available() > 0)
+  {
+    int c = this->_client.read();
+    this->_lastActivityMs = millis();
+    if (c != '\n')
+    {
+      if ((c != '\r') && (this->_lineLength < IOTWEBCONF_PULL_LINE_LEN - 1))
+      {
+        this->_line[this->_lineLength++] = c;
+      }
+      continue;
+    }
+
+    this->_line[this->_lineLength] = '\0';
+    if (this->_lineLength == 0)
+    {
+      // -- End of the header.
+      if (this->startBody())
+      {
+        this->_state = IOTWEBCONF_PULL_BODY;
+      }
+      return;
+    }
+    if (this->_statusCode == 0)
+    {
+      const char* code = strchr(this->_line, ' ');
+      this->_statusCode = code == NULL ? -1 : atoi(code + 1);
+    }
+    else if (strncasecmp(this->_line, "Content-Length:", 15) == 0)
+    {
+      this->_contentLength = strtoul(this->_line + 15, NULL, 10);
+    }
+    else if (strncasecmp(this->_line, "Content-Range:", 14) == 0)
+    {
+      // -- Format is "bytes start-end/total".
+      const char* range = strstr(this->_line, "bytes ");
+      const char* total = strchr(this->_line, '/');
+      if ((range != NULL) && (total != NULL))
+      {
+        this->_rangeStart = strtoul(range + 6, NULL, 10);
+        this->_rangeTotal = strtoul(total + 1, NULL, 10);
+      }
+    }
+    this->_lineLength = 0;
+  }
+
+  if (!this->_client.connected() ||
+      (IOTWEBCONF_PULL_TIMEOUT_MS < millis() - this->_lastActivityMs))
+  {
+    this->retry();
+  }
+}
+
+boolean IotWebConfPullUpdate::startBody()
+{
+  size_t size;
+  if ((this->_statusCode == 206) && (this->_rangeStart == this->_received) &&
+      (this->_rangeTotal > 0))
+  {
+    size = this->_rangeTotal;
+  }
+  else if (this->_statusCode == 200)
+  {
+    if (this->_received > 0)
+    {
+      // -- Server does not support ranges, download starts over.
+      Update.end();
+      this->_received = 0;
+      this->_size = 0;
+    }
+    size = this->_contentLength;
+  }
+  else
+  {
+    this->fail();
+    return false;
+  }
+
+  if (this->_received == 0)
+  {
+    if ((size == 0) || !Update.begin(size))
+    {
+      this->fail();
+      return false;
+    }
+    this->_size = size;
+    this->startDigest();
+  }
+  else if (size != this->_size)
+  {
+    // -- Image changed on the server since the previous part.
+    this->fail();
+    return false;
+  }
+  return true;
+}
+
+void IotWebConfPullUpdate::readBody(size_t maxBytes)
+{
+  uint8_t buffer[IOTWEBCONF_PULL_BUFFER_SIZE];
+  while ((maxBytes > 0) && (this->_received < this->_size))
+  {
+    int available = this->_client.available();
+    if (available <= 0)
+    {
+      break;
+    }
+    size_t count = IOTWEBCONF_PULL_BUFFER_SIZE;
+    if (count > (size_t)available) count = available;
+    if (count > maxBytes) count = maxBytes;
+    if (count > this->_size - this->_received)
+    {
+      count = this->_size - this->_received;
+    }
+    int read = this->_client.read(buffer, count);
+    if (read <= 0)
+    {
+      break;
+    }
+    this->updateDigest(buffer, read);
+    if ((this->_received + read >= this->_size) && !this->checkDigest())
+    {
+      // -- The last part is not written, so the image is dropped.
+      this->fail();
+      return;
+    }
+    if (Update.write(buffer, read) != (size_t)read)
+    {
+      this->fail();
+      return;
+    }
+    this->_received += read;
+    maxBytes -= read;
+    this->_lastActivityMs = millis();
+    this->_retryCount = 0;
+  }
+
+  if (this->_received >= this->_size)
+  {
+    this->_client.stop();
+    if (Update.end())
+    {
+      this->_state = IOTWEBCONF_PULL_DONE;
+    }
+    else
+    {
+      this->_size = 0;
+      this->fail();
+    }
+  }
+  else if (
+      (!this->_client.connected() && (this->_client.available() <= 0)) ||
+      (IOTWEBCONF_PULL_TIMEOUT_MS < millis() - this->_lastActivityMs))
+  {
+    this->retry();
+  }
+}
+
+void IotWebConfPullUpdate::retry()
+{
+  this->_client.stop();
+  if (this->_retryCount >= IOTWEBCONF_PULL_MAX_RETRIES)
+  {
+    this->fail();
+    return;
+  }
+  this->_retryDelayMs = (unsigned long)IOTWEBCONF_PULL_RETRY_MS
+      << this->_retryCount;
+  this->_retryCount += 1;
+  this->_lastActivityMs = millis();
+  this->_state = IOTWEBCONF_PULL_WAITING;
+}
+
+void IotWebConfPullUpdate::fail()
+{
+  this->_client.stop();
+  this->stopDigest();
+  if (this->_size > 0)
+  {
+    // -- Not finished update is dropped.
+    Update.end();
+  }
+  this->_state = IOTWEBCONF_PULL_FAILED;
+}
+
+/**
+ * Digest is calculated over the received parts in order, so a resumed
+ * download continues the same digest.
+ */
+void IotWebConfPullUpdate::startDigest()
+{
+  this->stopDigest();
+#ifdef ESP8266
+  br_sha256_init(&this->_digest);
+#elif defined(ESP32)
+  mbedtls_sha256_init(&this->_digest);
+  mbedtls_sha256_starts(&this->_digest, 0);
+#endif
+  this->_digesting = true;
+}
+
+void IotWebConfPullUpdate::updateDigest(const uint8_t* data, size_t length)
+{
+#ifdef ESP8266
+  br_sha256_update(&this->_digest, data, length);
+#elif defined(ESP32)
+  mbedtls_sha256_update(&this->_digest, data, length);
+#endif
+}
+
+boolean IotWebConfPullUpdate::checkDigest()
+{
+  uint8_t actual[32];
+#ifdef ESP8266
+  br_sha256_out(&this->_digest, actual);
+#elif defined(ESP32)
+  mbedtls_sha256_finish(&this->_digest, actual);
+#endif
+  this->stopDigest();
+  return memcmp(actual, this->_expectedDigest, sizeof(actual)) == 0;
+}
+
+void IotWebConfPullUpdate::stopDigest()
+{
+#ifdef ESP32
+  if (this->_digesting)
+  {
+    mbedtls_sha256_free(&this->_digest);
+  }
+#endif
+  this->_digesting = false;
+}
+
+boolean IotWebConfPullUpdate::parseDigest(const char* hex, uint8_t* digest)
+{
+  if (strlen(hex) != 64)
+  {
+    return false;
+  }
+  for (byte i = 0; i < 64; i++)
+  {
+    char c = tolower(hex[i]);
+    byte value;
+    if ((c >= '0') && (c <= '9'))
+    {
+      value = c - '0';
+    }
+    else if ((c >= 'a') && (c <= 'f'))
+    {
+      value = c - 'a' + 10;
+    }
+    else
+    {
+      return false;
+    }
+    if ((i & 1) == 0)
+    {
+      digest[i / 2] = value << 4;
+    }
+    else
+    {
+      digest[i / 2] |= value;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,125 @@
+
+#ifndef IotWebConfPullUpdate_h
+#define IotWebConfPullUpdate_h
+
+#include <Arduino.h>
+#ifdef ESP8266
+# include <ESP8266WiFi.h>
+# include <Updater.h>
+# include <bearssl/bearssl_hash.h>
+#elif defined(ESP32)
+# include <WiFi.h>
+# include <Update.h>
+# include <mbedtls/sha256.h>
+#endif
+
+// -- Maximal length of the update URL.
+#define IOTWEBCONF_PULL_URL_LEN 128
+
+// -- Maximal length of a response header line processed.
+#define IOTWEBCONF_PULL_LINE_LEN 96
+
+// -- Size of the stack buffer used for moving data to the flash.
+#define IOTWEBCONF_PULL_BUFFER_SIZE 512
+
+// -- A connection without any data for this time is dropped, and retried.
+#define IOTWEBCONF_PULL_TIMEOUT_MS 10000
+
+// -- Connecting to the server blocks for this time at most.
+#define IOTWEBCONF_PULL_CONNECT_TIMEOUT_MS 1000
+
+// -- Download is resumed after this time, doubled with every further retry.
+#define IOTWEBCONF_PULL_RETRY_MS 2000
+#define IOTWEBCONF_PULL_MAX_RETRIES 8
+
+// -- State of a pull update.
+#define IOTWEBCONF_PULL_IDLE 0
+#define IOTWEBCONF_PULL_WAITING 1
+#define IOTWEBCONF_PULL_HEADER 2
+#define IOTWEBCONF_PULL_BODY 3
+#define IOTWEBCONF_PULL_DONE 4
+#define IOTWEBCONF_PULL_FAILED 5
+
+/**
+ * Downloads a firmware image over HTTP in small steps, and writes it with the
+ * Update object. When the connection breaks, the download is continued with a
+ * Range request from where it stopped.
+ * As plain HTTP is not authenticated, the SHA-256 digest of the image must be
+ * known in advance. The downloaded data is hashed on the fly, and the last
+ * part of the image is only written, when the digests match.
+ * Note, that some steps block: the host name is resolved once per download
+ * (until the resolver timeout), and every connection attempt waits
+ * IOTWEBCONF_PULL_CONNECT_TIMEOUT_MS at most. Use an IP address in the URL to
+ * avoid the name lookup. All other steps only process data already arrived.
+ */
+class IotWebConfPullUpdate
+{
+public:
+  /**
+   * Start downloading. Only plain "http://host[:port]/path" URLs are supported.
+   * Returns false, if the URL or the digest is not valid.
+   *   @sha256 - SHA-256 digest of the image as 64 hex digits.
+   */
+  boolean begin(const char* url, const char* sha256);
+
+  /**
+   * Abort the download, the image written so far is dropped.
+   */
+  void stop();
+
+  /**
+   * Advance the download with receiving at most maxBytes. Returns the state.
+   */
+  byte process(size_t maxBytes);
+
+  byte getState() { return this->_state; }
+  size_t getReceived() { return this->_received; }
+  /**
+   * Size of the image, or zero when not yet known.
+   */
+  size_t getSize() { return this->_size; }
+  byte getRetryCount() { return this->_retryCount; }
+
+private:
+  char _url[IOTWEBCONF_PULL_URL_LEN];
+  const char* _host = NULL;
+  const char* _path = NULL;
+  uint16_t _port = 80;
+  IPAddress _address;
+  boolean _resolved = false;
+  WiFiClient _client;
+  byte _state = IOTWEBCONF_PULL_IDLE;
+  size_t _received = 0;
+  size_t _size = 0;
+  byte _retryCount = 0;
+  unsigned long _lastActivityMs = 0;
+  unsigned long _retryDelayMs = 0;
+  int _statusCode = 0;
+  size_t _contentLength = 0;
+  size_t _rangeStart = 0;
+  size_t _rangeTotal = 0;
+  char _line[IOTWEBCONF_PULL_LINE_LEN];
+  byte _lineLength = 0;
+  uint8_t _expectedDigest[32];
+  boolean _digesting = false;
+#ifdef ESP8266
+  br_sha256_context _digest;
+#elif defined(ESP32)
+  mbedtls_sha256_context _digest;
+#endif
+
+  void connect();
+  void readHeader();
+  boolean startBody();
+  void readBody(size_t maxBytes);
+  void retry();
+  void fail();
+  void startDigest();
+  void updateDigest(const uint8_t* data, size_t length);
+  boolean checkDigest();
+  void stopDigest();
+
+  static boolean parseDigest(const char* hex, uint8_t* digest);
+};
+
+#endif
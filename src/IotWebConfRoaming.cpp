@@ -0,0 +1,35 @@
+#include "IotWebConfRoaming.h"
+
+void IotWebConfRoamingPolicy::addSample(int32_t rssi)
+{
+  if (rssi >= 0)
+  {
+    // -- Not a valid sample.
+    return;
+  }
+  if (this->_rssiAverage16 == 0)
+  {
+    this->_rssiAverage16 = rssi * 16;
+  }
+  else
+  {
+    // -- Exponential moving average with 1/8 weight of the new sample.
+    this->_rssiAverage16 += (rssi * 16 - this->_rssiAverage16) / 8;
+  }
+}
+
+boolean IotWebConfRoamingPolicy::isScanDue(unsigned long now)
+{
+  return this->isEnabled() && (this->_rssiAverage16 != 0) &&
+      (this->getSmoothedRssi() < this->_rssiThreshold) &&
+      ((this->_lastScanMs == 0) ||
+       (IOTWEBCONF_ROAMING_SCAN_INTERVAL_MS < now - this->_lastScanMs)) &&
+      ((this->_roamCount == 0) ||
+       (IOTWEBCONF_ROAMING_MIN_INTERVAL_MS < now - this->_lastRoamMs));
+}
+
+void IotWebConfRoamingPolicy::roamed(unsigned long now)
+{
+  this->_roamCount += 1;
+  this->_lastRoamMs = now;
+}
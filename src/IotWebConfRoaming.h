@@ -0,0 +1,80 @@
+
+#ifndef IotWebConfRoaming_h
+#define IotWebConfRoaming_h
+
+#include <Arduino.h>
+
+// -- Roaming (see ESPWIFI::setRoamingRssiThreshold()): RSSI is sampled with
+// this period.
+#define IOTWEBCONF_ROAMING_SAMPLE_MS 1000
+// -- Minimal time between two background scans looking for a better AP.
+#define IOTWEBCONF_ROAMING_SCAN_INTERVAL_MS 60000
+// -- Minimal time between two roaming attempts.
+#define IOTWEBCONF_ROAMING_MIN_INTERVAL_MS 300000
+// -- An AP is only better, when its RSSI is higher with at least this amount.
+#define IOTWEBCONF_ROAMING_HYSTERESIS_DB 8
+
+/**
+ * Decides when to look for a better access point, and which one is better.
+ * RSSI samples are smoothed with an exponential moving average, a scan is
+ * due, when the average is below the threshold, and scans and roaming
+ * attempts are rate limited. The WiFi itself is not touched, so the decisions
+ * can be checked with recorded samples.
+ */
+class IotWebConfRoamingPolicy
+{
+public:
+  /**
+   * Threshold in dBm (e.g. -75). Zero disables roaming.
+   */
+  void setRssiThreshold(int rssiThreshold)
+  {
+    this->_rssiThreshold = rssiThreshold;
+  }
+  boolean isEnabled() { return this->_rssiThreshold != 0; }
+
+  /**
+   * Forget the samples, e.g. when connected to another access point.
+   */
+  void resetAverage() { this->_rssiAverage16 = 0; }
+
+  /**
+   * Add a sample of the RSSI in dBm. Values of zero or above are not valid,
+   * and are ignored.
+   */
+  void addSample(int32_t rssi);
+
+  /**
+   * Returns true, if a scan for a better access point should be started now.
+   * (Call scanStarted(), when it was started.)
+   */
+  boolean isScanDue(unsigned long now);
+  void scanStarted(unsigned long now) { this->_lastScanMs = now; }
+
+  /**
+   * Returns true, if an access point seen with this RSSI is clearly better
+   * than the actual one.
+   */
+  boolean isBetter(int32_t rssi)
+  {
+    return rssi >= this->getSmoothedRssi() + IOTWEBCONF_ROAMING_HYSTERESIS_DB;
+  }
+  void roamed(unsigned long now);
+
+  /**
+   * Returns the smoothed RSSI in dBm. Zero if not available.
+   */
+  int getSmoothedRssi() { return this->_rssiAverage16 / 16; }
+  unsigned long getRoamCount() { return this->_roamCount; }
+
+private:
+  int _rssiThreshold = 0;
+  // -- Average is kept in 1/16 dBm. RSSI is always negative, so zero means
+  // no samples.
+  long _rssiAverage16 = 0;
+  unsigned long _lastScanMs = 0;
+  unsigned long _lastRoamMs = 0;
+  unsigned long _roamCount = 0;
+};
+
+#endif
@@ -0,0 +1,246 @@
+
+#ifndef IotWebConfServer_h
+#define IotWebConfServer_h
+
+#include <IotWebConfCompatibility.h>
+
+#ifdef ESP8266
+# include <ESP8266WiFi.h>
+# include <ESP8266WebServer.h>
+#elif defined(ESP32)
+# include <WiFi.h>
+# include <WebServer.h>
+#endif
+
+// -- Maximal number of request headers collected by the WebServer backend.
+#define IOTWEBCONF_SYNC_MAX_HEADERS 8
+
+/**
+ * The web server functions ESPWIFI needs for serving its requests. Request
+ * related methods refer to the request actually being handled.
+ */
+class IotWebConfServer
+{
+public:
+  virtual void begin() = 0;
+  virtual void handleClient() = 0;
+
+  virtual String uri() = 0;
+  virtual HTTPMethod method() = 0;
+  virtual String hostHeader() = 0;
+  virtual String header(const char* name) = 0;
+  virtual int args() = 0;
+  virtual String arg(int i) = 0;
+  virtual String argName(int i) = 0;
+  virtual String arg(const char* name) = 0;
+  virtual boolean hasArg(const char* name) = 0;
+
+  /**
+   * Copy the value of an argument to the target (truncated to size - 1
+   * characters, and terminated). Returns the full length of the value, or -1
+   * when there is no such argument. Target can be NULL with zero size for
+   * getting the length only.
+   */
+  virtual int readArg(const char* name, char* target, size_t size)
+  {
+    if (!this->hasArg(name))
+    {
+      return -1;
+    }
+    return copyValue(this->arg(name), target, size);
+  }
+
+  /**
+   * Copy the URI, the Host header, or a header of the request to the target,
+   * the same way as readArg() does. Returns -1 when there is no such header.
+   * The defaults go through the String methods, backends override them
+   * when they can copy without a temporary String.
+   */
+  virtual int readUri(char* target, size_t size)
+  {
+    return copyValue(this->uri(), target, size);
+  }
+  virtual int readHostHeader(char* target, size_t size)
+  {
+    return copyValue(this->hostHeader(), target, size);
+  }
+  virtual int readHeader(const char* name, char* target, size_t size)
+  {
+    String value = this->header(name);
+    return value.length() == 0 ? -1 : copyValue(value, target, size);
+  }
+
+  /**
+   * Length of the value of an argument, zero when there is no such argument.
+   */
+  int argLength(const char* name)
+  {
+    int length = this->readArg(name, NULL, 0);
+    return length < 0 ? 0 : length;
+  }
+  virtual boolean authenticate(const char* username, const char* password) = 0;
+  virtual void requestAuthentication() = 0;
+  virtual IPAddress localIP() = 0;
+
+  virtual void sendHeader(const String& name, const String& value) = 0;
+  virtual void send(int code, const char* contentType, const String& content) = 0;
+
+  /**
+   * Write a pre-serialized response (status line, headers and body).
+   */
+  virtual void write(const uint8_t* data, size_t length) = 0;
+
+  /**
+   * Close the connection of the request after the response was sent.
+   */
+  virtual void close() = 0;
+
+  /**
+   * Start a response of unknown length. The body is written with write(),
+   * and ends with endStream(). Backends, that keep connections alive, send
+   * the body in chunks (chunked transfer encoding), the default ends the
+   * response with closing the connection.
+   *   @headers - (Optional) Further header lines, each ending with "\r\n".
+   */
+  virtual void startStream(
+      int code, const char* contentType, const char* headers = NULL)
+  {
+    char head[96];
+    int length = snprintf(
+        head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n", code,
+        code == 404 ? "Not Found" : "OK", contentType);
+    this->write((const uint8_t*)head, length);
+    if (headers != NULL)
+    {
+      this->write((const uint8_t*)headers, strlen(headers));
+    }
+    this->write((const uint8_t*)"Connection: close\r\n\r\n", 21);
+  }
+  virtual void endStream() { this->close(); }
+
+  /**
+   * Take over the connection of the actual request, so the response can be
+   * continued after the request handler returned. Returns false, when the
+   * server does not support this.
+   */
+  virtual boolean takeClient(WiFiClient* client) { return false; }
+
+protected:
+  static int copyValue(const String& value, char* target, size_t size)
+  {
+    if (size > 0)
+    {
+      value.toCharArray(target, size);
+    }
+    return value.length();
+  }
+};
+
+/**
+ * Synchronous backend: the WebServer (or ESP8266WebServer) of the Arduino
+ * core. One client is served at a time, and handleClient() blocks while the
+ * response is sent.
+ */
+class IotWebConfSyncServer : public IotWebConfServer
+{
+public:
+  IotWebConfSyncServer(WebServer* server = NULL) { this->_server = server; }
+  void setWebServer(WebServer* server) { this->_server = server; }
+  WebServer* getWebServer() { return this->_server; }
+
+  /**
+   * Make a request header available by header(). The WebServer only keeps
+   * the headers listed in its last collectHeaders() call, so headers needed
+   * by the sketch must be added here instead, otherwise either the sketch or
+   * ESPWIFI loses its headers. Returns false, when there is no more space.
+   * (See IOTWEBCONF_SYNC_MAX_HEADERS.)
+   *   @name - Name of the header. Not copied, must outlive the server.
+   */
+  boolean collectHeader(const char* name)
+  {
+    if (this->_headerCount >= IOTWEBCONF_SYNC_MAX_HEADERS)
+    {
+      return false;
+    }
+    this->_headers[this->_headerCount++] = name;
+    if (this->_headersCollected)
+    {
+      this->_server->collectHeaders(this->_headers, this->_headerCount);
+    }
+    return true;
+  }
+
+  void begin()
+  {
+    // -- Headers are registered once, begin() is called on every state
+    // change.
+    if (!this->_headersCollected)
+    {
+      this->_server->collectHeaders(this->_headers, this->_headerCount);
+      this->_headersCollected = true;
+    }
+    this->_server->begin();
+  }
+  void handleClient() { this->_server->handleClient(); }
+
+  String uri() { return this->_server->uri(); }
+  HTTPMethod method() { return this->_server->method(); }
+  String hostHeader() { return this->_server->hostHeader(); }
+  String header(const char* name) { return this->_server->header(name); }
+  int args() { return this->_server->args(); }
+
+  // -- The WebServer of ESP8266 returns the URI and the Host header by
+  // reference, ESP32 copies them.
+  int readUri(char* target, size_t size)
+  {
+    return copyValue(this->_server->uri(), target, size);
+  }
+  int readHostHeader(char* target, size_t size)
+  {
+    return copyValue(this->_server->hostHeader(), target, size);
+  }
+  String arg(int i) { return this->_server->arg(i); }
+  String argName(int i) { return this->_server->argName(i); }
+  String arg(const char* name) { return this->_server->arg(name); }
+  boolean hasArg(const char* name)
+  {
+    return this->_server->hasArg(name);
+  }
+  boolean authenticate(const char* username, const char* password)
+  {
+    return this->_server->authenticate(username, password);
+  }
+  void requestAuthentication()
+  {
+    this->_server->requestAuthentication();
+  }
+  IPAddress localIP() { return this->_server->client().localIP(); }
+
+  void sendHeader(const String& name, const String& value)
+  {
+    this->_server->sendHeader(name, value);
+  }
+  void send(int code, const char* contentType, const String& content)
+  {
+    this->_server->send(code, contentType, content);
+  }
+  void write(const uint8_t* data, size_t length)
+  {
+    this->_server->client().write(data, length);
+  }
+  void close() { this->_server->client().stop(); }
+  boolean takeClient(WiFiClient* client)
+  {
+    *client = this->_server->client();
+    return true;
+  }
+
+private:
+  WebServer* _server;
+  const char* _headers[IOTWEBCONF_SYNC_MAX_HEADERS] = {
+      "Cookie", "X-Update-SHA256", "Content-Length"};
+  byte _headerCount = 3;
+  boolean _headersCollected = false;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "IotWebConfTimer.h"
+
+#define IOTWEBCONF_TIMER_SLOT_MASK (IOTWEBCONF_TIMER_WHEEL_SLOTS - 1)
+
+IotWebConfTimer::IotWebConfTimer()
+{
+}
+
+IotWebConfTimer::IotWebConfTimer(IotWebConfFunction<void()> callback)
+{
+  this->callback = callback;
+}
+
+////////////////////////////////////////////////////////////////
+
+IotWebConfTimerWheel::IotWebConfTimerWheel()
+{
+  for (byte i = 0; i < IOTWEBCONF_TIMER_WHEEL_SLOTS; i++)
+  {
+    this->_slots[i] = NULL;
+  }
+}
+
+void IotWebConfTimerWheel::start(
+    IotWebConfTimer* timer, unsigned long delayMs, unsigned long periodMs)
+{
+  this->stop(timer);
+
+  unsigned long now = millis();
+  if (!this->_started)
+  {
+    this->_lastTickMs = now;
+    this->_started = true;
+  }
+  // -- Ticks already passed, but not yet processed, are added, so the timer
+  // will not expire early.
+  unsigned long pendingTicks =
+      (now - this->_lastTickMs) / IOTWEBCONF_TIMER_TICK_MS;
+
+  timer->_expiresTick = this->_currentTick + pendingTicks + toTicks(delayMs);
+  timer->_periodTicks = periodMs == 0 ? 0 : toTicks(periodMs);
+  this->link(timer);
+}
+
+void IotWebConfTimerWheel::stop(IotWebConfTimer* timer)
+{
+  if (timer->_active)
+  {
+    this->unlink(timer);
+  }
+}
+
+void IotWebConfTimerWheel::process(unsigned long now)
+{
+  if (!this->_started)
+  {
+    this->_lastTickMs = now;
+    this->_started = true;
+    return;
+  }
+
+  unsigned long elapsedTicks =
+      (now - this->_lastTickMs) / IOTWEBCONF_TIMER_TICK_MS;
+  if (elapsedTicks == 0)
+  {
+    return;
+  }
+
+  if (elapsedTicks >= IOTWEBCONF_TIMER_WHEEL_SLOTS)
+  {
+    // -- We are late for more than a full revolution, so every slot needs to
+    // be visited once.
+    this->_lastTickMs += elapsedTicks * IOTWEBCONF_TIMER_TICK_MS;
+    this->_currentTick += elapsedTicks;
+    for (byte slot = 0; slot < IOTWEBCONF_TIMER_WHEEL_SLOTS; slot++)
+    {
+      this->processSlot(slot);
+    }
+  }
+  else
+  {
+    // -- The time of the tick is advanced with the tick itself, so a timer
+    // started by a callback counts the ticks still to be caught up as
+    // pending, and does not expire early.
+    while (elapsedTicks-- > 0)
+    {
+      this->_lastTickMs += IOTWEBCONF_TIMER_TICK_MS;
+      this->_currentTick += 1;
+      this->processSlot(this->_currentTick & IOTWEBCONF_TIMER_SLOT_MASK);
+    }
+  }
+}
+
+void IotWebConfTimerWheel::processSlot(byte slot)
+{
+  IotWebConfTimer* timer = this->_slots[slot];
+  while (timer != NULL)
+  {
+    // -- Callbacks might stop any timer, so the iteration is tracked by the
+    // wheel itself. (See unlink().)
+    this->_iteratorNext = timer->_nextTimer;
+    if ((long)(this->_currentTick - timer->_expiresTick) >= 0)
+    {
+      this->unlink(timer);
+      if (timer->_periodTicks > 0)
+      {
+        timer->_expiresTick = this->_currentTick + timer->_periodTicks;
+        this->link(timer);
+      }
+      if (timer->callback)
+      {
+        timer->callback();
+      }
+    }
+    timer = this->_iteratorNext;
+  }
+  this->_iteratorNext = NULL;
+}
+
+void IotWebConfTimerWheel::link(IotWebConfTimer* timer)
+{
+  // -- Timers are always added to the head of the slot, so a timer
+  // rescheduled during the processing of its slot is not visited again.
+  byte slot = timer->_expiresTick & IOTWEBCONF_TIMER_SLOT_MASK;
+  timer->_prevTimer = NULL;
+  timer->_nextTimer = this->_slots[slot];
+  if (this->_slots[slot] != NULL)
+  {
+    this->_slots[slot]->_prevTimer = timer;
+  }
+  this->_slots[slot] = timer;
+  timer->_active = true;
+}
+
+void IotWebConfTimerWheel::unlink(IotWebConfTimer* timer)
+{
+  if (this->_iteratorNext == timer)
+  {
+    this->_iteratorNext = timer->_nextTimer;
+  }
+  if (timer->_prevTimer != NULL)
+  {
+    timer->_prevTimer->_nextTimer = timer->_nextTimer;
+  }
+  else
+  {
+    this->_slots[timer->_expiresTick & IOTWEBCONF_TIMER_SLOT_MASK] =
+        timer->_nextTimer;
+  }
+  if (timer->_nextTimer != NULL)
+  {
+    timer->_nextTimer->_prevTimer = timer->_prevTimer;
+  }
+  timer->_prevTimer = NULL;
+  timer->_nextTimer = NULL;
+  timer->_active = false;
+}
+
+unsigned long IotWebConfTimerWheel::toTicks(unsigned long ms)
+{
+  unsigned long ticks =
+      (ms + IOTWEBCONF_TIMER_TICK_MS - 1) / IOTWEBCONF_TIMER_TICK_MS;
+  return ticks == 0 ? 1 : ticks;
+}
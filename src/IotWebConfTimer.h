@@ -0,0 +1,86 @@
+
+#ifndef IotWebConfTimer_h
+#define IotWebConfTimer_h
+
+#include <Arduino.h>
+#include <IotWebConfCallback.h>
+
+// -- Number of slots in the timer wheel. Must be a power of two.
+#define IOTWEBCONF_TIMER_WHEEL_SLOTS 32
+
+// -- Resolution of the timer wheel in milliseconds.
+#define IOTWEBCONF_TIMER_TICK_MS 10
+
+/**
+ * A timer, that can be registered with ESPWIFI::startTimer(). The timer
+ * object is owned by the caller and must outlive its registration, no
+ * memory is allocated by the timer wheel.
+ */
+class IotWebConfTimer
+{
+public:
+  IotWebConfTimer();
+
+  /**
+   * Create a timer.
+   *   @callback - Method to be called, when the timer expires.
+   */
+  IotWebConfTimer(IotWebConfFunction<void()> callback);
+
+  IotWebConfFunction<void()> callback;
+
+  /**
+   * Returns true, if the timer is scheduled in a timer wheel.
+   */
+  boolean isActive() { return this->_active; }
+
+  // -- For internal use only
+  IotWebConfTimer* _prevTimer = NULL;
+  IotWebConfTimer* _nextTimer = NULL;
+  unsigned long _expiresTick = 0;
+  unsigned long _periodTicks = 0;
+  boolean _active = false;
+};
+
+/**
+ * Hashed timer wheel. Timers are distributed into slots by their expiry tick,
+ * so each tick only visits the timers of a single slot.
+ */
+class IotWebConfTimerWheel
+{
+public:
+  IotWebConfTimerWheel();
+
+  /**
+   * Schedule a timer. A timer already scheduled is rescheduled.
+   *   @timer - The timer to be scheduled.
+   *   @delayMs - Milliseconds until first expiry.
+   *   @periodMs - (Optional) When not zero, the timer is rescheduled after
+   *     every expiry with this period.
+   */
+  void start(IotWebConfTimer* timer, unsigned long delayMs, unsigned long periodMs = 0);
+
+  /**
+   * Remove a timer from the wheel. Has no effect on inactive timers.
+   */
+  void stop(IotWebConfTimer* timer);
+
+  /**
+   * Advance the wheel to the provided time and call the expired timers.
+   */
+  void process(unsigned long now);
+
+private:
+  IotWebConfTimer* _slots[IOTWEBCONF_TIMER_WHEEL_SLOTS];
+  unsigned long _currentTick = 0;
+  unsigned long _lastTickMs = 0;
+  boolean _started = false;
+  IotWebConfTimer* _iteratorNext = NULL;
+
+  void link(IotWebConfTimer* timer);
+  void unlink(IotWebConfTimer* timer);
+  void processSlot(byte slot);
+  static unsigned long toTicks(unsigned long ms);
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "IotWebConfTrace.h"
+#if defined(IOTWEBCONF_TRACE_PERSISTENT) && defined(ESP32)
+# include <esp_attr.h>
+#endif
+
+#define IOTWEBCONF_TRACE_MAGIC 0x49574354
+#define IOTWEBCONF_TRACE_MASK (IOTWEBCONF_TRACE_SIZE - 1)
+
+#if defined(IOTWEBCONF_TRACE_PERSISTENT) && defined(ESP32)
+// -- No-init memory is not cleared on reset, begin() validates the content.
+RTC_NOINIT_ATTR IotWebConfTraceHeader IotWebConfTrace::_header;
+RTC_NOINIT_ATTR IotWebConfTraceRecord IotWebConfTrace::_records[IOTWEBCONF_TRACE_SIZE];
+#else
+IotWebConfTraceHeader IotWebConfTrace::_header;
+IotWebConfTraceRecord IotWebConfTrace::_records[IOTWEBCONF_TRACE_SIZE];
+#endif
+
+void IotWebConfTrace::begin()
+{
+#if defined(IOTWEBCONF_TRACE_PERSISTENT) && defined(ESP8266)
+  ESP.rtcUserMemoryRead(
+      IOTWEBCONF_TRACE_RTC_BLOCK, (uint32_t*)&_header, sizeof(_header));
+  ESP.rtcUserMemoryRead(
+      IOTWEBCONF_TRACE_RTC_BLOCK + sizeof(_header) / 4, (uint32_t*)_records,
+      sizeof(_records));
+#endif
+#ifdef IOTWEBCONF_TRACE_PERSISTENT
+  if ((_header.magic == IOTWEBCONF_TRACE_MAGIC) &&
+      (_header.check == checkValue()))
+  {
+    // -- Trace of the previous boot is kept.
+    _header.boot += 1;
+    _header.check = checkValue();
+    return;
+  }
+#endif
+  memset(_records, 0, sizeof(_records));
+  _header.magic = IOTWEBCONF_TRACE_MAGIC;
+  _header.next = 0;
+  _header.boot = 1;
+  _header.check = checkValue();
+}
+
+void IotWebConfTrace::record(
+    byte oldState, byte newState, byte reason, int8_t rssi)
+{
+  uint32_t slot = _header.next & IOTWEBCONF_TRACE_MASK;
+  IotWebConfTraceRecord* record = &_records[slot];
+  record->timeMs = millis();
+  record->freeHeap = ESP.getFreeHeap();
+  record->boot = _header.boot;
+  record->rssi = rssi;
+  record->reason = reason;
+  record->oldState = oldState;
+  record->newState = newState;
+  _header.next += 1;
+  _header.check = checkValue();
+#if defined(IOTWEBCONF_TRACE_PERSISTENT) && defined(ESP8266)
+  ESP.rtcUserMemoryWrite(
+      IOTWEBCONF_TRACE_RTC_BLOCK + (sizeof(_header) + slot * sizeof(*record)) / 4,
+      (uint32_t*)record, sizeof(*record));
+  ESP.rtcUserMemoryWrite(
+      IOTWEBCONF_TRACE_RTC_BLOCK, (uint32_t*)&_header, sizeof(_header));
+#endif
+}
+
+byte IotWebConfTrace::getCount()
+{
+  return _header.next < IOTWEBCONF_TRACE_SIZE
+      ? _header.next
+      : IOTWEBCONF_TRACE_SIZE;
+}
+
+const IotWebConfTraceRecord* IotWebConfTrace::get(byte index)
+{
+  if (index >= getCount())
+  {
+    return NULL;
+  }
+  uint32_t first = _header.next - getCount();
+  return &_records[(first + index) & IOTWEBCONF_TRACE_MASK];
+}
+
+const __FlashStringHelper* IotWebConfTrace::reasonName(byte reason)
+{
+  switch (reason)
+  {
+    case IOTWEBCONF_REASON_BOOT:
+      return F("boot");
+    case IOTWEBCONF_REASON_CONFIG_PIN:
+      return F("config-pin");
+    case IOTWEBCONF_REASON_AP_TIMEOUT:
+      return F("ap-timeout");
+    case IOTWEBCONF_REASON_AP_CLIENT_LEFT:
+      return F("ap-client-left");
+    case IOTWEBCONF_REASON_NETWORK_VISIBLE:
+      return F("network-visible");
+    case IOTWEBCONF_REASON_CONNECTED:
+      return F("connected");
+    case IOTWEBCONF_REASON_CONNECT_TIMEOUT:
+      return F("connect-timeout");
+    case IOTWEBCONF_REASON_DISCONNECT:
+      return F("disconnect");
+    case IOTWEBCONF_REASON_RETRY:
+      return F("retry");
+    case IOTWEBCONF_REASON_WRONG_AP:
+      return F("wrong-ap");
+    case IOTWEBCONF_REASON_ROAMING:
+      return F("roaming");
+    default:
+      return F("-");
+  }
+}
+
+uint16_t IotWebConfTrace::checkValue()
+{
+  uint32_t value = _header.magic ^ _header.next ^ ((uint32_t)_header.boot << 8);
+  return (uint16_t)(value ^ (value >> 16));
+}
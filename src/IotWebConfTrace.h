@@ -0,0 +1,107 @@
+
+#ifndef IotWebConfTrace_h
+#define IotWebConfTrace_h
+
+#include <Arduino.h>
+
+// -- Number of state transitions kept. Should be a power of two.
+#define IOTWEBCONF_TRACE_SIZE 16
+
+// -- The trace survives warm resets (watchdog, crash, ESP.restart()) if
+// enabled. On ESP32 it is placed in RTC no-init memory, on ESP8266 it is
+// mirrored to the RTC user memory, starting at the block defined here (RTC
+// user memory has 128 blocks of 4 bytes, the trace uses 4 blocks per record
+// and 3 more for the header).
+//#define IOTWEBCONF_TRACE_PERSISTENT
+#define IOTWEBCONF_TRACE_RTC_BLOCK 32
+
+// -- Reason of a state transition.
+#define IOTWEBCONF_REASON_NONE 0
+#define IOTWEBCONF_REASON_BOOT 1
+#define IOTWEBCONF_REASON_CONFIG_PIN 2
+#define IOTWEBCONF_REASON_AP_TIMEOUT 3
+#define IOTWEBCONF_REASON_AP_CLIENT_LEFT 4
+#define IOTWEBCONF_REASON_NETWORK_VISIBLE 5
+#define IOTWEBCONF_REASON_CONNECTED 6
+#define IOTWEBCONF_REASON_CONNECT_TIMEOUT 7
+#define IOTWEBCONF_REASON_DISCONNECT 8
+#define IOTWEBCONF_REASON_RETRY 9
+#define IOTWEBCONF_REASON_WRONG_AP 10
+#define IOTWEBCONF_REASON_ROAMING 11
+
+/**
+ * A state transition. Layout is fixed to 4 byte words, so it can be copied to
+ * the RTC memory as it is.
+ */
+typedef struct IotWebConfTraceRecord
+{
+  uint32_t timeMs;
+  uint32_t freeHeap;
+  uint16_t boot;
+  int8_t rssi;
+  uint8_t reason;
+  uint8_t oldState;
+  uint8_t newState;
+  uint8_t reserved[2];
+} IotWebConfTraceRecord;
+
+/**
+ * For internal use only.
+ */
+typedef struct IotWebConfTraceHeader
+{
+  uint32_t magic;
+  uint32_t next;
+  uint16_t boot;
+  uint16_t check;
+} IotWebConfTraceHeader;
+
+/**
+ * State transitions of ESPWIFI are recorded in a fixed ring buffer, the last
+ * IOTWEBCONF_TRACE_SIZE transitions are kept. Recording does not allocate
+ * memory, and does not format anything.
+ */
+class IotWebConfTrace
+{
+public:
+  /**
+   * Restore the trace kept over a warm reset, and start a new boot. Called by
+   * ESPWIFI::init().
+   */
+  static void begin();
+
+  /**
+   * Record a transition. Free heap is sampled here.
+   *   @rssi - Signal strength of the station link, zero when not connected.
+   */
+  static void record(byte oldState, byte newState, byte reason, int8_t rssi);
+
+  /**
+   * Number of the current boot. Boots are counted as long as the trace is
+   * kept (so it is always 1 without IOTWEBCONF_TRACE_PERSISTENT).
+   */
+  static uint16_t getBoot() { return _header.boot; }
+
+  /**
+   * Number of records kept.
+   */
+  static byte getCount();
+
+  /**
+   * Returns the index-th kept record, zero is the oldest one.
+   */
+  static const IotWebConfTraceRecord* get(byte index);
+
+  /**
+   * Short name of a reason.
+   */
+  static const __FlashStringHelper* reasonName(byte reason);
+
+private:
+  static IotWebConfTraceHeader _header;
+  static IotWebConfTraceRecord _records[IOTWEBCONF_TRACE_SIZE];
+
+  static uint16_t checkValue();
+};
+
+#endif